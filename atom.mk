@@ -18,7 +18,8 @@ LOCAL_LIBRARIES := \
 LOCAL_CONFIG_FILES := config.in
 $(call load-config)
 LOCAL_CONDITIONAL_LIBRARIES := \
-	CONFIG_ADEC_FDK_AAC:libaudio-decode-fdk-aac
+	CONFIG_ADEC_FDK_AAC:libaudio-decode-fdk-aac \
+	CONFIG_ADEC_NULL:libaudio-decode-null
 LOCAL_EXPORT_LDLIBS := -laudio-decode-core
 
 ifeq ("$(TARGET_OS)","windows")
@@ -37,14 +38,33 @@ LOCAL_DESCRIPTION := Audio decoding library: core files
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/core/include
 LOCAL_CFLAGS := -DADEC_API_EXPORTS -fvisibility=hidden -std=gnu99 -D_GNU_SOURCE
 LOCAL_SRC_FILES := \
+	core/src/adec_capture.c \
+	core/src/adec_catchup.c \
+	core/src/adec_cpu.c \
+	core/src/adec_drift.c \
 	core/src/adec_enums.c \
-	core/src/adec_format.c
+	core/src/adec_format.c \
+	core/src/adec_levels.c \
+	core/src/adec_mem.c \
+	core/src/adec_output.c \
+	core/src/adec_pipeline.c \
+	core/src/adec_shm.c \
+	core/src/adec_thread.c \
+	core/src/adec_trace.c
+# The real-time output path needs a libmedia-buffers release providing
+# mbuf_audio_frame_set_frame_info(): the stock output frames are created
+# blank on the loop thread, then their frame info is set and their
+# ancillary records are written in place by the decoding thread, before
+# the frames are finalized.
 LOCAL_LIBRARIES := \
 	libaudio-defs \
 	libfutils \
 	libmedia-buffers \
 	libmedia-buffers-memory \
+	libmedia-buffers-memory-generic \
+	libpomp \
 	libulog
+LOCAL_LDLIBS := -lm
 
 
 ifeq ("$(TARGET_OS)","windows")
@@ -82,6 +102,33 @@ include $(BUILD_LIBRARY)
 
 include $(CLEAR_VARS)
 
+# Null implementation (overhead measurements). can be enabled in the product
+# configuration
+LOCAL_MODULE := libaudio-decode-null
+LOCAL_CATEGORY_PATH := libs
+LOCAL_DESCRIPTION := Audio decoding library: null implementation
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/null/include
+LOCAL_CFLAGS := -DADEC_API_EXPORTS -fvisibility=hidden -std=gnu99 -D_GNU_SOURCE
+LOCAL_SRC_FILES := \
+	null/src/adec_null.c
+LOCAL_LIBRARIES := \
+	libaudio-decode-core \
+	libaudio-defs \
+	libfutils \
+	libmedia-buffers \
+	libmedia-buffers-memory \
+	libmedia-buffers-memory-generic \
+	libpomp \
+	libulog
+
+ifeq ("$(TARGET_OS)","windows")
+  LOCAL_LDLIBS += -lws2_32
+endif
+
+include $(BUILD_LIBRARY)
+
+include $(CLEAR_VARS)
+
 LOCAL_MODULE := adec
 LOCAL_DESCRIPTION := Audio decoding program
 LOCAL_CATEGORY_PATH := multimedia
@@ -103,3 +150,60 @@ ifeq ("$(TARGET_OS)","windows")
 endif
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := adec-replay
+LOCAL_DESCRIPTION := Audio decoding capture replay program
+LOCAL_CATEGORY_PATH := multimedia
+LOCAL_SRC_FILES := tools/adec_replay.c
+LOCAL_LIBRARIES := \
+	libaudio-decode \
+	libaudio-defs \
+	libfutils \
+	libmedia-buffers \
+	libmedia-buffers-memory \
+	libmedia-buffers-memory-generic \
+	libpomp \
+	libulog
+
+ifeq ("$(TARGET_OS)","windows")
+  LOCAL_LDLIBS += -lws2_32
+endif
+
+include $(BUILD_EXECUTABLE)
+
+ifdef TARGET_TEST
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := tst-audio-decode
+LOCAL_DESCRIPTION := Audio decoding library tests
+LOCAL_CATEGORY_PATH := multimedia
+LOCAL_CFLAGS := -std=gnu99 -D_GNU_SOURCE
+LOCAL_SRC_FILES := \
+	tests/adec_test.c \
+	tests/adec_test_alloc.c \
+	tests/adec_test_budget.c \
+	tests/adec_test_capture.c \
+	tests/adec_test_heaac.c \
+	tests/adec_test_lowdelay.c \
+	tests/adec_test_queue.c \
+	tests/adec_test_timeline.c \
+	tests/adec_test_trace.c
+LOCAL_LIBRARIES := \
+	libaudio-decode \
+	libaudio-decode-core \
+	libaudio-defs \
+	libcunit \
+	libfutils \
+	libmedia-buffers \
+	libpomp \
+	libulog
+# For the FDK AAC specific configuration in the heaac suite
+LOCAL_CONDITIONAL_LIBRARIES := \
+	OPTIONAL:libaudio-decode-fdk-aac
+
+include $(BUILD_EXECUTABLE)
+
+endif
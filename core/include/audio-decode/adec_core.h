@@ -49,30 +49,62 @@ extern "C" {
 #endif /* !ADEC_API_EXPORTS */
 
 
+/**
+ * Prefix of the mbuf ancillary data keys owned by the library.
+ *
+ * Ancillary data whose key starts with this prefix is not propagated from
+ * input frames to output frames.
+ */
+#define ADEC_ANCILLARY_KEY_PREFIX "adec."
+
+/**
+ * mbuf ancillary data key for the decoder timings.
+ *
+ * Content is a struct adec_timings, a single record per output frame. Set on
+ * the output frames unless the timing mode is ADEC_TIMING_MODE_NONE. Use
+ * adec_frame_get_timings() to read it.
+ */
+#define ADEC_ANCILLARY_KEY_TIMINGS "adec.timings"
+
+/**
+ * mbuf ancillary data key for the decoded audio levels.
+ *
+ * Content is a struct adec_levels. Only set on output frames when level
+ * metering is enabled (see the levels configuration field). Use
+ * adec_frame_get_levels() to read it.
+ */
+#define ADEC_ANCILLARY_KEY_LEVELS "adec.levels"
+
 /**
  * mbuf ancillary data key for the input timestamp.
  *
- * Content is a 64bits microseconds value on a monotonic clock
+ * @deprecated No longer set on output frames, will be removed in the next
+ * release; the input time is part of struct adec_timings.
  */
 #define ADEC_ANCILLARY_KEY_INPUT_TIME "adec.input_time"
 
 /**
  * mbuf ancillary data key for the dequeue timestamp.
  *
- * Content is a 64bits microseconds value on a monotonic clock
+ * @deprecated No longer set on output frames, will be removed in the next
+ * release; the dequeue time is part of struct adec_timings.
  */
 #define ADEC_ANCILLARY_KEY_DEQUEUE_TIME "adec.dequeue_time"
 
 /**
  * mbuf ancillary data key for the output timestamp.
  *
- * Content is a 64bits microseconds value on a monotonic clock
+ * @deprecated No longer set on output frames, will be removed in the next
+ * release; the output time is part of struct adec_timings.
  */
 #define ADEC_ANCILLARY_KEY_OUTPUT_TIME "adec.output_time"
 
 
 /* Forward declarations */
 struct adec_decoder;
+struct adec_shm;
+struct adec_capture_reader;
+struct adec_mem_group;
 
 
 /* Supported decoder implementations */
@@ -83,11 +115,388 @@ enum adec_decoder_implem {
 	/* Fraunhofer FDK AAC encoder */
 	ADEC_DECODER_IMPLEM_FDK_AAC,
 
+	/* Null decoder (outputs silence, for overhead measurements only;
+	 * never selected automatically) */
+	ADEC_DECODER_IMPLEM_NULL,
+
 	/* End of supported implementation */
 	ADEC_DECODER_IMPLEM_MAX,
 };
 
 
+/* Trace event types */
+enum adec_trace_event_type {
+	/* Frame accepted in the input queue */
+	ADEC_TRACE_EVENT_INPUT = 0,
+
+	/* Frame dequeued by the decoder */
+	ADEC_TRACE_EVENT_DEQUEUE,
+
+	/* Decoding of an access unit started */
+	ADEC_TRACE_EVENT_DECODE_START,
+
+	/* Decoding of an access unit ended */
+	ADEC_TRACE_EVENT_DECODE_END,
+
+	/* Frame output to the application (frame_output) */
+	ADEC_TRACE_EVENT_OUTPUT,
+
+	/* End of trace event types */
+	ADEC_TRACE_EVENT_MAX,
+};
+
+
+/* Trace export formats */
+enum adec_trace_format {
+	/* Human-readable text, one event per line */
+	ADEC_TRACE_FORMAT_TEXT = 0,
+
+	/* Chrome trace event JSON (chrome://tracing, Perfetto) */
+	ADEC_TRACE_FORMAT_CHROME_JSON,
+};
+
+
+/* Trace event */
+struct adec_trace_event {
+	/* Event timestamp in microseconds on a monotonic clock */
+	uint64_t ts_us;
+
+	/* Frame index (adef_frame_info.index) */
+	uint32_t index;
+
+	/* Identifier of the thread that recorded the event (kernel thread
+	 * id on Linux); input events are recorded on the thread that pushes
+	 * the frame, which is not necessarily the loop thread */
+	uint32_t thread_id;
+
+	/* Event type */
+	enum adec_trace_event_type type;
+};
+
+
+/* Decoder timing modes, used to timestamp frames on the decoding path */
+enum adec_timing_mode {
+	/* Precise monotonic clock, sampled for each frame (default) */
+	ADEC_TIMING_MODE_PRECISE = 0,
+
+	/* Coarse monotonic clock (CLOCK_MONOTONIC_COARSE where available,
+	 * typically a few milliseconds resolution but much cheaper to read);
+	 * output frames decoded from the same input buffer share the same
+	 * output time */
+	ADEC_TIMING_MODE_COARSE,
+
+	/* No timestamping: no clock is read on the decoding path and no
+	 * timings are kept */
+	ADEC_TIMING_MODE_NONE,
+};
+
+
+/* Input queue drop policies, applied when the input queue limits are
+ * exceeded */
+enum adec_drop_policy {
+	/* Drop the oldest queued frames until the queue is back within the
+	 * limits (default) */
+	ADEC_DROP_POLICY_OLDEST = 0,
+
+	/* Reject the new frames in the input filter while the queue is at
+	 * its limits */
+	ADEC_DROP_POLICY_NEWEST,
+
+	/* Drop all the queued frames but the latest one and conceal the
+	 * resulting gap (where supported by the implementation) */
+	ADEC_DROP_POLICY_SKIP_TO_LATEST,
+};
+
+
+/* Capture record types, see adec_capture_reader_read() */
+enum adec_capture_record_type {
+	/* Decoder configuration (first record of a capture) */
+	ADEC_CAPTURE_RECORD_CONFIG = 0,
+
+	/* adec_set_aac_asc() call; data is the ASC (if any) */
+	ADEC_CAPTURE_RECORD_ASC,
+
+	/* Input frame accepted by the input filter; data is the frame
+	 * content */
+	ADEC_CAPTURE_RECORD_FRAME,
+
+	/* adec_flush() call */
+	ADEC_CAPTURE_RECORD_FLUSH,
+
+	/* adec_stop() call */
+	ADEC_CAPTURE_RECORD_STOP,
+};
+
+
+/* Decoder threads scheduling policies */
+enum adec_sched_policy {
+	/* Default policy (SCHED_OTHER), not changed by the library */
+	ADEC_SCHED_POLICY_DEFAULT = 0,
+
+	/* Real-time first-in first-out policy (SCHED_FIFO) */
+	ADEC_SCHED_POLICY_FIFO,
+
+	/* Real-time round-robin policy (SCHED_RR) */
+	ADEC_SCHED_POLICY_RR,
+};
+
+
+/* Maximum number of output channels */
+#define ADEC_MAX_CHANNEL_COUNT 8
+
+/* Maximum latency catch-up speed-up in percent */
+#define ADEC_CATCHUP_MAX_SPEEDUP 25
+
+/* Maximum drift compensation correction in parts per million */
+#define ADEC_DRIFT_MAX_PPM 2000
+
+/* Maximum number of samples per channel that the drift compensation can add
+ * to an output frame */
+#define ADEC_DRIFT_MAX_EXTRA_SAMPLES 8
+
+/* Maximum output frame size in bytes (16-bit samples, 2048 samples per
+ * channel for HE-AAC, plus the drift compensation margin) */
+#define ADEC_MAX_OUTPUT_FRAME_SIZE                                             \
+	(ADEC_MAX_CHANNEL_COUNT * (2048 + ADEC_DRIFT_MAX_EXTRA_SAMPLES) * 2)
+
+
+/* Output channel positions */
+enum adec_channel {
+	/* Unknown position */
+	ADEC_CHANNEL_UNKNOWN = 0,
+
+	/* Front channels */
+	ADEC_CHANNEL_FRONT_LEFT,
+	ADEC_CHANNEL_FRONT_RIGHT,
+	ADEC_CHANNEL_FRONT_CENTER,
+
+	/* Low frequency effects */
+	ADEC_CHANNEL_LFE,
+
+	/* Side channels */
+	ADEC_CHANNEL_SIDE_LEFT,
+	ADEC_CHANNEL_SIDE_RIGHT,
+
+	/* Back channels */
+	ADEC_CHANNEL_BACK_LEFT,
+	ADEC_CHANNEL_BACK_RIGHT,
+	ADEC_CHANNEL_BACK_CENTER,
+
+	/* Height channels */
+	ADEC_CHANNEL_TOP_LEFT,
+	ADEC_CHANNEL_TOP_RIGHT,
+	ADEC_CHANNEL_TOP_CENTER,
+};
+
+
+/* Interleaved output channel order */
+enum adec_channel_order {
+	/* WAVE order (e.g. L, R, C, LFE, BL, BR for 5.1) */
+	ADEC_CHANNEL_ORDER_WAV = 0,
+
+	/* MPEG order (e.g. C, L, R, BL, BR, LFE for 5.1) */
+	ADEC_CHANNEL_ORDER_MPEG,
+};
+
+
+/* Decoder threads configuration; settings that cannot be applied (e.g. for
+ * lack of privileges) are logged and ignored */
+struct adec_thread_config {
+	/* CPU affinity mask, bit N set means the thread can run on CPU N
+	 * (0 means no affinity, keep the default) */
+	uint64_t cpu_affinity;
+
+	/* Scheduling policy */
+	enum adec_sched_policy sched_policy;
+
+	/* Scheduling priority, only used for the real-time policies
+	 * (0 means the minimum priority of the policy) */
+	int sched_priority;
+
+	/* Nice value, only used for the default policy (0 means unchanged) */
+	int nice;
+
+	/* Stack size in bytes (0 means the system default) */
+	size_t stack_size;
+};
+
+
+/* Decoder threads effective settings */
+struct adec_thread_stats {
+	/* Whether the settings below are valid (i.e. the decoder
+	 * thread has started) */
+	int valid;
+
+	/* Effective CPU affinity mask (0 if unknown) */
+	uint64_t cpu_affinity;
+
+	/* Effective scheduling policy */
+	enum adec_sched_policy sched_policy;
+
+	/* Effective scheduling priority */
+	int sched_priority;
+
+	/* Effective nice value */
+	int nice;
+
+	/* Effective stack size in bytes (0 if unknown) */
+	size_t stack_size;
+};
+
+
+/* Decoder statistics */
+struct adec_stats {
+	/* Frames that have passed the input filter */
+	unsigned int in_frames;
+
+	/* Frames that have been pushed to the decoder */
+	unsigned int pushed_frames;
+
+	/* Frames that have been pulled from the decoder */
+	unsigned int pulled_frames;
+
+	/* Frames that have been output (frame_output) */
+	unsigned int out_frames;
+
+	/* Output memories allocated on the decoding path (i.e. not taken
+	 * from a preallocated pool) */
+	unsigned int out_mem_allocs;
+
+	/* Output frames allocated on the decoding path */
+	unsigned int out_frame_allocs;
+
+	/* Ancillary data allocated on the decoding path */
+	unsigned int ancillary_allocs;
+
+	/* Input frames dropped because of the input queue limits or because
+	 * the decoder could not consume them, or rejected because of the
+	 * memory budget */
+	unsigned int in_dropped_frames;
+
+	/* Silent frames dropped (see the drop_silent configuration field) */
+	unsigned int silent_dropped_frames;
+
+	/* Frames dropped in real-time mode because no output memory was
+	 * available (the application holds all of them) */
+	unsigned int out_dropped_frames;
+
+	/* Output frames shortened by the latency catch-up, and number of
+	 * samples per channel removed (see the catchup configuration
+	 * field) */
+	unsigned int catchup_frames;
+	unsigned int catchup_removed_samples;
+
+	/* Decoder thread effective settings */
+	struct adec_thread_stats thread;
+};
+
+
+/* Decoder CPU accounting, see adec_get_cpu_stats(); durations are thread
+ * CPU time in nanoseconds spent in the decoder library calls, attributed to
+ * the decoded frames */
+struct adec_cpu_stats {
+	/* Number of measured frames */
+	unsigned int frame_count;
+
+	/* Total CPU time */
+	uint64_t total_ns;
+
+	/* Per-frame CPU time percentiles (12.5% resolution) */
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+
+	/* Maximum per-frame CPU time */
+	uint64_t max_ns;
+};
+
+
+/* Drift compensation status, see adec_get_drift_stats() */
+struct adec_drift_stats {
+	/* Whether the playout time has been reported at least once (the
+	 * other fields are only meaningful when set) */
+	int locked;
+
+	/* Latency set-point and last measured latency, in microseconds */
+	uint64_t target_latency_us;
+	int64_t latency_us;
+
+	/* Current resampling correction in parts per million (positive when
+	 * the output is shortened to reduce the latency) */
+	float correction_ppm;
+
+	/* Net number of samples per channel added (positive) or removed
+	 * (negative) by the resampling since the decoder creation */
+	int64_t sample_offset;
+};
+
+
+/* Memory usage of a decoder instance, see adec_get_memory_usage(); sizes
+ * are in bytes. Only the memory allocated or retained by the decoder for
+ * the frames data is counted: the memories of the application output pool
+ * or shared memory (output_pool, output_shm) are not */
+struct adec_memory_usage {
+	/* Input frames accepted by the input filter and not yet decoded
+	 * (the decoder holds them), except the frames whose memory is taken
+	 * from the decoder input pool, already counted in pool_bytes */
+	size_t in_queue_bytes;
+
+	/* Output memories allocated by the decoder, from the decoding until
+	 * the last reference is released, including the output frames kept
+	 * by the application after the frame_output callback; these stay
+	 * accounted in the group after the decoder is destroyed, until
+	 * released */
+	size_t output_bytes;
+
+	/* Memory pools allocated by the decoder, from their creation until
+	 * the decoder is destroyed: the real-time output pool and its scratch
+	 * memory (see the realtime configuration field), and the input pool
+	 * of the implementation (see adec_get_input_buffer_pool()); the
+	 * frames using their memories are not counted again */
+	size_t pool_bytes;
+
+	/* Sum of the above, as accounted in the group */
+	size_t total_bytes;
+
+	/* Usage and budget of the memory group of the decoder, all instances
+	 * included (a budget of 0 means unlimited) */
+	size_t group_bytes;
+	size_t group_budget_bytes;
+};
+
+
+/* Decoder timings of an output frame, see adec_get_frame_timings() (also
+ * the content of the ADEC_ANCILLARY_KEY_TIMINGS ancillary data); all values
+ * are in microseconds on a monotonic clock, 0 means unknown */
+struct adec_timings {
+	/* Time the frame was accepted in the input queue */
+	uint64_t input_time;
+
+	/* Time the frame was dequeued by the decoder */
+	uint64_t dequeue_time;
+
+	/* Time the decoded frame was pushed to the output queue */
+	uint64_t output_time;
+};
+
+
+/* Decoded audio levels, content of the ADEC_ANCILLARY_KEY_LEVELS ancillary
+ * data */
+struct adec_levels {
+	/* Number of valid entries in the arrays below */
+	uint32_t channel_count;
+
+	/* All channels are at or below the silence threshold */
+	uint32_t silent;
+
+	/* Per-channel absolute sample peak (0..32768) */
+	uint16_t peak[ADEC_MAX_CHANNEL_COUNT];
+
+	/* Per-channel RMS level (0.0 to 1.0 relative to full scale) */
+	float rms[ADEC_MAX_CHANNEL_COUNT];
+};
+
+
 /* Decoder initial configuration, implementation specific extension
  * Each implementation might provide implementation specific configuration with
  * a structure compatible with this base structure (i.e. which starts with the
@@ -98,6 +507,61 @@ struct adec_config_impl {
 };
 
 
+/* Shared memory output frame descriptor, see adec_shm_export() */
+struct adec_shm_desc {
+	/* Shared memory identifier */
+	uint64_t pool_id;
+
+	/* Slot index, to give back to adec_shm_release() */
+	uint32_t slot;
+
+	/* Frame data offset and length in the shared memory, in bytes */
+	uint64_t offset;
+	uint32_t length;
+
+	/* Frame timestamp and timescale */
+	uint64_t timestamp;
+	uint32_t timescale;
+};
+
+
+/* Capture record, see adec_capture_reader_read(); only the fields matching
+ * the record type are valid */
+struct adec_capture_record {
+	/* Record type */
+	enum adec_capture_record_type type;
+
+	/* Time since the capture start in microseconds (arrival time for
+	 * input frames, call time for API calls) */
+	uint64_t time_us;
+
+	/* ADEC_CAPTURE_RECORD_CONFIG */
+	struct {
+		enum adef_encoding encoding;
+		enum adec_decoder_implem implem;
+		int stream_input;
+	} config;
+
+	/* ADEC_CAPTURE_RECORD_ASC */
+	struct {
+		enum adef_aac_data_format data_format;
+	} asc;
+
+	/* ADEC_CAPTURE_RECORD_FRAME */
+	struct adef_frame frame;
+
+	/* ADEC_CAPTURE_RECORD_FLUSH */
+	struct {
+		int discard;
+	} flush;
+
+	/* Record data (ASC or frame content, can be NULL); valid until the
+	 * next read */
+	const uint8_t *data;
+	size_t len;
+};
+
+
 /* Decoder initial configuration */
 struct adec_config {
 	/* Decoder instance name (optional, can be null, copied internally) */
@@ -112,7 +576,12 @@ struct adec_config {
 
 	/* Input buffer pool preferred minimum buffer count, used
 	 * only if the implementation uses its own input buffer pool
-	 * (0 means no preference, use the default value) */
+	 * (0 means no preference, use the default value). The pool is
+	 * created on the first adec_get_input_buffer_pool() call with this
+	 * count and accounted in the memory budget; it grows when more
+	 * memories are in use only if the memory budget group has no budget
+	 * at creation, the grown memories being then accounted as queued
+	 * input frames */
 	unsigned int preferred_min_in_buf_count;
 
 	/* Output buffer pool preferred minimum buffer count
@@ -130,6 +599,159 @@ struct adec_config {
 	/* Preferred output buffers data format (optional, 0 means any) */
 	struct adef_format preferred_output_format;
 
+	/* Interleaved output channel order; the decoder writes the samples
+	 * directly in this order (see adec_get_output_channel_map()) */
+	enum adec_channel_order output_channel_order;
+
+	/* Stream input: the input frames carry arbitrary-sized chunks of a
+	 * byte stream (ADTS data format only) instead of one access unit
+	 * each; the decoder frames the stream internally and resynchronizes
+	 * on errors. The input frames format only needs the encoding and
+	 * data format, and only the first chunk timestamp is used: the output
+	 * frames timestamps and indexes are derived from the number of
+	 * decoded samples */
+	int stream_input;
+
+	/* Trace ring size in events (optional, 0 means no tracing; rounded
+	 * up to a power of 2). When enabled, per-frame timing events are
+	 * recorded in memory and can be retrieved with adec_get_trace_events()
+	 * or adec_export_trace(). */
+	unsigned int trace_event_count;
+
+	/* CPU accounting: when enabled, the thread CPU time spent decoding
+	 * each frame is measured and can be retrieved with
+	 * adec_get_cpu_stats(); costs two thread CPU clock reads per decoder
+	 * library call */
+	int cpu_accounting;
+
+	/* Capture file path (optional, can be NULL): when set, the input
+	 * frames with their arrival time and the API calls (set_aac_asc,
+	 * flush, stop) are recorded to this file, to be replayed offline
+	 * (see adec_capture_reader_open() and the adec-replay tool); the
+	 * file is written asynchronously by a dedicated thread, and records
+	 * are dropped (with a warning) if it cannot keep up */
+	const char *capture_path;
+
+	/* Timing mode used to timestamp frames on the decoding path
+	 * (ADEC_TIMING_MODE_PRECISE by default) */
+	enum adec_timing_mode timing_mode;
+
+	/* Real-time decoding: output memories are preallocated in a fixed-size
+	 * pool (preferred_min_out_buf_count memories), blank output frames are
+	 * created ahead on the loop thread with their timings and levels
+	 * records, filled in place by the decoding thread, the input frames
+	 * are released on the loop thread, their ancillary data is not copied
+	 * to the output frames and the error paths do not allocate: once the
+	 * first frame is decoded, the decoding thread does not allocate nor
+	 * free memory (see the *_allocs counters in struct adec_stats). When
+	 * no output memory is available the decoded frame is dropped (see the
+	 * out_dropped_frames counter in struct adec_stats) */
+	int realtime;
+
+	/* Output memories pool (optional, can be NULL; not owned by the
+	 * library and must outlive the decoder). When set, the decoder writes
+	 * the decoded samples directly into memories taken from this pool,
+	 * e.g. created with an mbuf_mem implementation wrapping device or
+	 * shared memory. Memories must be large enough for the largest
+	 * output frame (ADEC_MAX_OUTPUT_FRAME_SIZE); smaller ones, or an
+	 * exhausted pool, make the decoder fall back to allocating (see the
+	 * out_mem_allocs counter in struct adec_stats), or drop the frame in
+	 * real-time mode */
+	struct mbuf_pool *output_pool;
+
+	/* Shared memory output pool (optional, can be NULL; not owned by the
+	 * library and must outlive the decoder, see adec_shm_new()). Takes
+	 * precedence over output_pool; frames are written in its slots and
+	 * can be exported to another process with adec_shm_export() */
+	struct adec_shm *output_shm;
+
+	/* Input queue limits (optional, 0 means unlimited): maximum number
+	 * of queued input frames, and maximum queued duration in milliseconds
+	 * (computed from the adef_frame timestamps). Meant for live streams,
+	 * where a bounded latency is preferred over decoding every frame */
+	unsigned int max_in_queue_count;
+	unsigned int max_in_queue_duration_ms;
+
+	/* Drop policy applied when the input queue limits are exceeded */
+	enum adec_drop_policy in_queue_drop_policy;
+
+	/* Level metering: when enabled, the per-channel peak and RMS levels
+	 * are computed on the decoded samples and attached to the output
+	 * frames as ADEC_ANCILLARY_KEY_LEVELS ancillary data */
+	int levels;
+
+	/* Silence threshold for the level metering, as an absolute sample
+	 * value (0 means only all-zero frames are silent) */
+	unsigned int silence_threshold;
+
+	/* Drop the silent output frames instead of outputting them (requires
+	 * levels; see the silent_dropped_frames counter in struct
+	 * adec_stats) */
+	int drop_silent;
+
+	/* Drift compensation for live playout: when enabled, the decoded
+	 * frames go through an adaptive resampler whose ratio is steered by a
+	 * PI controller so that the latency between the newest output sample
+	 * and the sample being played (see adec_set_playout_time()) stays at
+	 * the set-point. Output frames can then hold slightly more or fewer
+	 * samples than the decoded frames (at most
+	 * ADEC_DRIFT_MAX_EXTRA_SAMPLES more); their timestamps are shifted
+	 * accordingly, see catchup */
+	int drift_compensation;
+
+	/* Drift compensation latency set-point in milliseconds (0 means the
+	 * latency measured at the first playout time report) */
+	unsigned int drift_target_latency_ms;
+
+	/* Drift compensation maximum correction in parts per million (0
+	 * means 1000, capped to ADEC_DRIFT_MAX_PPM) */
+	unsigned int drift_max_ppm;
+
+	/* Latency catch-up: when enabled, the playout delay is estimated from
+	 * the gap between the input frames timestamps and their arrival time
+	 * (the player is assumed to stall when a frame arrives late). While
+	 * this delay exceeds the lowest observed gap by more than the target,
+	 * the output is time-compressed without pitch change by removing
+	 * whole pitch periods from the decoded frames, so that the backlog
+	 * accumulated after a burst is played slightly faster. The output
+	 * frames timestamps are shifted by the samples removed (or added by
+	 * the drift compensation) since the last discarding flush, so that
+	 * they advance by the emitted samples; gaps between the decoded
+	 * frames timestamps are kept. The delay is measured on the decoded
+	 * frames timestamps */
+	int catchup;
+
+	/* Latency catch-up target in milliseconds: excess delay left
+	 * uncompressed (0 means 40ms) */
+	unsigned int catchup_target_latency_ms;
+
+	/* Latency catch-up maximum speed-up in percent (0 means 10%, capped
+	 * to ADEC_CATCHUP_MAX_SPEEDUP) */
+	unsigned int catchup_max_speedup;
+
+	/* Memory budget group (optional, can be NULL; not owned by the
+	 * library and must outlive the decoder and its output memories, see
+	 * adec_mem_group_new()). The memory of the decoder (see struct
+	 * adec_memory_usage for what is counted) is accounted in this group,
+	 * or in the process-wide group if NULL (see
+	 * adec_mem_group_set_budget()). The budget is enforced as follows:
+	 * the memory pools are not created if they do not fit (the decoder
+	 * creation fails with -ENOBUFS for the real-time output pool, the
+	 * input pool is not provided and does not grow), new input frames
+	 * that do not fit are rejected whatever the input queue drop policy
+	 * (see the in_dropped_frames counter in struct adec_stats), and
+	 * decoding is paused while the next output memory does not fit,
+	 * until the pending output frames are consumed or their memories
+	 * released. The budget can only be exceeded by one output memory
+	 * when the decoder has nothing pending, so that it does not stall.
+	 * Queued input frames are only dropped because of the input queue
+	 * limits */
+	struct adec_mem_group *mem_group;
+
+	/* Decoding threads configuration (optional, all zero means
+	 * system defaults; only relevant for CPU decoding implementations) */
+	struct adec_thread_config thread;
+
 	/* Implementation specific extensions (optional, can be NULL)
 	 * If not null, implem_cfg must match the following requirements:
 	 *  - this->implem_cfg->implem == this->implem
@@ -177,6 +799,240 @@ struct adec_cbs {
 ADEC_API const char *adec_decoder_implem_str(enum adec_decoder_implem implem);
 
 
+/**
+ * ToString function for enum adec_trace_event_type.
+ * @param type: trace event type value to convert
+ * @return a string description of the trace event type
+ */
+ADEC_API const char *adec_trace_event_type_str(enum adec_trace_event_type type);
+
+
+/**
+ * ToString function for enum adec_timing_mode.
+ * @param mode: timing mode value to convert
+ * @return a string description of the timing mode
+ */
+ADEC_API const char *adec_timing_mode_str(enum adec_timing_mode mode);
+
+
+/**
+ * ToString function for enum adec_drop_policy.
+ * @param policy: drop policy value to convert
+ * @return a string description of the drop policy
+ */
+ADEC_API const char *adec_drop_policy_str(enum adec_drop_policy policy);
+
+
+/**
+ * ToString function for enum adec_sched_policy.
+ * @param policy: scheduling policy value to convert
+ * @return a string description of the scheduling policy
+ */
+ADEC_API const char *adec_sched_policy_str(enum adec_sched_policy policy);
+
+
+/**
+ * ToString function for enum adec_channel.
+ * @param channel: channel position value to convert
+ * @return a string description of the channel position
+ */
+ADEC_API const char *adec_channel_str(enum adec_channel channel);
+
+
+/**
+ * ToString function for enum adec_channel_order.
+ * @param order: channel order value to convert
+ * @return a string description of the channel order
+ */
+ADEC_API const char *adec_channel_order_str(enum adec_channel_order order);
+
+
+/**
+ * Get the decoder timings attached to an output frame as ancillary data
+ * (ADEC_ANCILLARY_KEY_TIMINGS), e.g. by a consumer that only gets the
+ * frames.
+ * @param frame: output frame
+ * @param timings: decoder timings (output)
+ * @return 0 on success, -ENOENT if the frame has no timings, negative errno
+ * value in case of error
+ */
+ADEC_API int adec_frame_get_timings(struct mbuf_audio_frame *frame,
+				    struct adec_timings *timings);
+
+
+/**
+ * Get the decoded audio levels attached to an output frame.
+ * @param frame: output frame
+ * @param levels: decoded audio levels (output)
+ * @return 0 on success, -ENOENT if the frame has no levels, negative errno
+ * value in case of error
+ */
+ADEC_API int adec_frame_get_levels(struct mbuf_audio_frame *frame,
+				   struct adec_levels *levels);
+
+
+/**
+ * Create a shared memory output pool.
+ * The memory is backed by a memfd (or an unlinked POSIX shared memory
+ * object), split in fixed-size slots. It can be set as the output_shm
+ * decoder configuration field so that the decoded frames are written
+ * directly in shared memory; the file descriptor can then be passed to
+ * another process (e.g. with SCM_RIGHTS) which maps it and reads the frames
+ * described by adec_shm_export().
+ * @param slot_size: size of one slot in bytes (rounded up to the page size;
+ *        must hold one output frame, see ADEC_MAX_OUTPUT_FRAME_SIZE)
+ * @param slot_count: number of slots
+ * @param ret_obj: shared memory pool handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_shm_new(size_t slot_size,
+			  unsigned int slot_count,
+			  struct adec_shm **ret_obj);
+
+
+/**
+ * Destroy a shared memory output pool.
+ * The pool must not be in use by a decoder anymore; the remote mappings
+ * stay valid until unmapped.
+ * @param shm: shared memory pool handle
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_shm_destroy(struct adec_shm *shm);
+
+
+/**
+ * Get the file descriptor of a shared memory output pool.
+ * The descriptor remains owned by the pool.
+ * @param shm: shared memory pool handle
+ * @return the file descriptor on success, negative errno value in case of
+ *         error
+ */
+ADEC_API int adec_shm_get_fd(struct adec_shm *shm);
+
+
+/**
+ * Get the total size of a shared memory output pool (to map it).
+ * @param shm: shared memory pool handle
+ * @return the size in bytes, 0 in case of error
+ */
+ADEC_API size_t adec_shm_get_size(struct adec_shm *shm);
+
+
+/**
+ * Take a free slot of a shared memory output pool.
+ * The slot is returned to the pool when the memory is released and all
+ * its exports have been released.
+ * @param shm: shared memory pool handle
+ * @param size: required size in bytes
+ * @param ret_obj: memory wrapping the slot (output)
+ * @return 0 on success, -EAGAIN if all slots are in use, -ENOBUFS if the
+ *         slots are too small, negative errno value in case of error
+ */
+ADEC_API int adec_shm_get_mem(struct adec_shm *shm,
+			      size_t size,
+			      struct mbuf_mem **ret_obj);
+
+
+/**
+ * Export a frame stored in a shared memory output pool.
+ * The frame slot is kept in use until adec_shm_release() is called with the
+ * returned slot index, typically when the remote consumer returns it; the
+ * local frame can be unreferenced right after exporting.
+ * @param shm: shared memory pool handle
+ * @param frame: output frame
+ * @param desc: frame descriptor to send to the consumer (output)
+ * @return 0 on success, -EXDEV if the frame is not stored in this pool,
+ *         negative errno value in case of error
+ */
+ADEC_API int adec_shm_export(struct adec_shm *shm,
+			     struct mbuf_audio_frame *frame,
+			     struct adec_shm_desc *desc);
+
+
+/**
+ * Release an exported frame slot.
+ * @param shm: shared memory pool handle
+ * @param slot: slot index from the frame descriptor
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_shm_release(struct adec_shm *shm, uint32_t slot);
+
+
+/**
+ * Open a capture file for reading.
+ * @param path: capture file path (see the capture_path configuration field)
+ * @param ret_obj: capture reader handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_capture_reader_open(const char *path,
+				      struct adec_capture_reader **ret_obj);
+
+
+/**
+ * Close a capture file.
+ * @param reader: capture reader handle (can be NULL)
+ */
+ADEC_API void adec_capture_reader_close(struct adec_capture_reader *reader);
+
+
+/**
+ * Read the next record of a capture file.
+ * Records of unknown types are returned as is (with all their payload in
+ * the data field) and should be skipped.
+ * @param reader: capture reader handle
+ * @param record: record (output)
+ * @return 0 on success, -ENODATA at the end of the capture, negative errno
+ * value in case of error
+ */
+ADEC_API int adec_capture_reader_read(struct adec_capture_reader *reader,
+				      struct adec_capture_record *record);
+
+
+/**
+ * Create a memory budget group.
+ * Decoders are attached to a group through the mem_group configuration
+ * field; the memory they use is accounted in the group and limited by its
+ * budget.
+ * @param budget: budget in bytes (0 means unlimited)
+ * @param ret_obj: memory budget group handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_mem_group_new(size_t budget,
+				struct adec_mem_group **ret_obj);
+
+
+/**
+ * Destroy a memory budget group.
+ * @param group: memory budget group handle
+ * @return 0 on success, -EBUSY if decoders are still attached to the
+ *         group or output memories allocated by destroyed decoders are
+ *         still referenced, negative errno value in case of error
+ */
+ADEC_API int adec_mem_group_destroy(struct adec_mem_group *group);
+
+
+/**
+ * Set the budget of a memory budget group.
+ * Lowering the budget below the current usage does not free any memory
+ * but applies the budget policies to the new allocations.
+ * @param group: memory budget group handle, or NULL for the process-wide
+ *        group of the decoders without a mem_group (unlimited by default)
+ * @param budget: budget in bytes (0 means unlimited)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_mem_group_set_budget(struct adec_mem_group *group,
+				       size_t budget);
+
+
+/**
+ * Get the memory used by all the decoders of a memory budget group.
+ * @param group: memory budget group handle, or NULL for the process-wide
+ *        group
+ * @return the usage in bytes
+ */
+ADEC_API size_t adec_mem_group_get_usage(struct adec_mem_group *group);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
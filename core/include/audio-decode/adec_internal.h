@@ -27,6 +27,7 @@
 #ifndef _ADEC_INTERNAL_H_
 #define _ADEC_INTERNAL_H_
 
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdio.h>
 
@@ -131,6 +132,12 @@ struct adec_ops {
 
 	struct mbuf_audio_frame_queue *(*get_input_buffer_queue)(
 		struct adec_decoder *base);
+
+	/* Optional; returns the channel count or -EAGAIN if the output
+	 * format is not known yet */
+	int (*get_output_channel_map)(struct adec_decoder *base,
+				      enum adec_channel *map,
+				      size_t max_count);
 };
 
 
@@ -139,6 +146,91 @@ struct audio_info {
 };
 
 
+/* Lock-free trace ring, see adec_trace_new() */
+struct adec_trace;
+
+
+/* Per-frame CPU time accounting, see adec_cpu_acct_new() */
+struct adec_cpu_acct;
+
+
+/* Capture recorder, see adec_capture_new() */
+struct adec_capture;
+
+
+/* Drift compensation resampler, see adec_drift_new() */
+struct adec_drift;
+
+
+/* Latency catch-up time-compression, see adec_catchup_new() */
+struct adec_catchup;
+
+
+/* Output stage (memories, post-processing, output frames), see
+ * adec_output_new() */
+struct adec_output;
+
+
+/* Decoding pipeline (queues, decoding thread, flushes), see
+ * adec_pipeline_new() */
+struct adec_pipeline;
+
+
+/* Memory accounted for a decoder in its memory budget group, see
+ * adec_mem_attach() */
+struct adec_mem_account;
+
+
+/* Implementation callbacks of the decoding pipeline */
+struct adec_pipeline_cbs {
+	/* Input filter: returns true if the frame can be queued; called
+	 * before the input queue limits and the memory budget are
+	 * checked */
+	bool (*accept)(struct adec_decoder *base,
+		       struct mbuf_audio_frame *frame,
+		       struct adef_frame *info);
+
+	/* Decode an input frame, on the decoding thread; the output frames
+	 * are pushed with adec_output_push() with the given timings (input
+	 * and dequeue times set by the pipeline), the input frame is
+	 * released by the pipeline whatever the result */
+	int (*decode)(struct adec_decoder *base,
+		      struct mbuf_audio_frame *frame,
+		      struct adec_timings *timings);
+
+	/* Optional; input frames were dropped by the input queue limits
+	 * before the next decoded frame, skip is true with the
+	 * skip-to-latest policy (decoding thread) */
+	void (*dropped)(struct adec_decoder *base, bool skip);
+
+	/* Optional; the decoder state must be cleared after a discarding
+	 * flush (decoding thread) */
+	void (*reset)(struct adec_decoder *base);
+
+	/* Optional; returns true if the input frame memory is taken from an
+	 * input pool of the implementation, already accounted as
+	 * ADEC_MEM_POOL in the memory budget (input filter) */
+	bool (*pooled)(struct adec_decoder *base,
+		       struct mbuf_audio_frame *frame);
+};
+
+
+/* Memory budget accounting categories */
+enum adec_mem_kind {
+	/* Input frames queued for decoding, unless their memory is taken
+	 * from a pool of the implementation */
+	ADEC_MEM_IN_QUEUE = 0,
+
+	/* Output memories allocated with adec_mem_alloc(), until released */
+	ADEC_MEM_OUTPUT,
+
+	/* Memory pools allocated by the decoder */
+	ADEC_MEM_POOL,
+
+	ADEC_MEM_KIND_COUNT,
+};
+
+
 struct adec_decoder {
 	/* Reserved */
 	struct adec_decoder *base;
@@ -159,15 +251,65 @@ struct adec_decoder {
 	} reader;
 	atomic_uint_least64_t last_timestamp;
 
+	/* Trace ring (NULL if tracing is disabled) */
+	struct adec_trace *trace;
+
+	/* CPU accounting (NULL if disabled) */
+	struct adec_cpu_acct *cpu_acct;
+
+	/* Capture recorder (NULL if disabled) */
+	struct adec_capture *capture;
+
+	/* Drift compensation (NULL if disabled) */
+	struct adec_drift *drift;
+
+	/* Latency catch-up (NULL if disabled) */
+	struct adec_catchup *catchup;
+
+	/* Output stage (created by the implementation) */
+	struct adec_output *output;
+
+	/* Decoding pipeline (created by the implementation) */
+	struct adec_pipeline *pipeline;
+
+	/* Memory accounted in the memory budget group by this instance
+	 * (NULL until attached), see adec_mem_charge() */
+	struct adec_mem_account *mem_account;
+
+	/* Decoder thread effective settings, written by the decoder thread
+	 * before setting thread_stats_valid */
+	struct adec_thread_stats thread_stats;
+	atomic_int thread_stats_valid;
+
 	struct {
 		/* Frames that have passed the input filter */
-		unsigned int in;
+		atomic_uint in;
 		/* Frames that have been pushed to the decoder */
 		unsigned int pushed;
 		/* Frames that have been pulled from the decoder */
 		unsigned int pulled;
 		/* Frames that have been output (frame_output) */
 		unsigned int out;
+		/* Output memories allocated on the decoding path */
+		unsigned int out_mem_allocs;
+		/* Output frames allocated on the decoding path */
+		unsigned int out_frame_allocs;
+		/* Ancillary data allocated on the decoding path */
+		unsigned int ancillary_allocs;
+		/* Input frames dropped because of the input queue limits or
+		 * because the decoder could not consume them, or rejected
+		 * because of the memory budget (written by both the input
+		 * filter and the decoder thread) */
+		atomic_uint in_dropped;
+		/* Silent frames dropped */
+		unsigned int silent_dropped;
+		/* Frames dropped in real-time mode for lack of an output
+		 * memory */
+		unsigned int out_dropped;
+		/* Frames shortened and samples removed by the latency
+		 * catch-up */
+		atomic_uint catchup_frames;
+		atomic_uint catchup_removed_samples;
 	} counters;
 };
 
@@ -229,8 +371,7 @@ adec_default_input_filter_internal(struct adec_decoder *decoder,
  * Filter update function.
  * This function should be called at the end of a custom filter. It registers
  * that the frame was accepted. This function saves the frame timestamp for
- * monotonic checks, and sets the ADEC_ANCILLARY_KEY_INPUT_TIME ancillary data
- * on the frame.
+ * monotonic checks.
  *
  * @param decoder: The base video decoder.
  * @param frame: The accepted frame.
@@ -242,11 +383,764 @@ adec_default_input_filter_internal_confirm_frame(struct adec_decoder *decoder,
 						 struct adef_frame *frame_info);
 
 
+/**
+ * Copy the application ancillary data from an input frame to an output frame.
+ * Ancillary data owned by the library (ADEC_ANCILLARY_KEY_PREFIX) is not
+ * copied, so that nothing is allocated when the input frame carries no
+ * application data.
+ *
+ * @param in_frame: The input frame.
+ * @param out_frame: The output frame.
+ *
+ * @return the number of ancillary data copied, or a negative errno value in
+ * case of error
+ */
+ADEC_INTERNAL_API int
+adec_copy_ancillary_data(struct mbuf_audio_frame *in_frame,
+			 struct mbuf_audio_frame *out_frame);
+
+
+/**
+ * Set the ADEC_ANCILLARY_KEY_TIMINGS ancillary data on a frame.
+ *
+ * @param frame: The frame.
+ * @param timings: The decoder timings.
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int
+adec_frame_set_timings(struct mbuf_audio_frame *frame,
+		       const struct adec_timings *timings);
+
+
+/**
+ * Compute the levels of a block of interleaved 16-bit PCM samples.
+ *
+ * Vectorized for mono and stereo (SSE2 or NEON when available), other
+ * channel counts use the scalar path.
+ *
+ * @param samples: The interleaved samples.
+ * @param channel_count: The number of channels.
+ * @param frame_count: The number of samples per channel.
+ * @param silence_threshold: The silence threshold (absolute sample value).
+ * @param levels: The computed levels (output).
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_levels_compute(const int16_t *samples,
+					  unsigned int channel_count,
+					  size_t frame_count,
+					  unsigned int silence_threshold,
+					  struct adec_levels *levels);
+
+
+/**
+ * Set the ADEC_ANCILLARY_KEY_LEVELS ancillary data on a frame.
+ *
+ * @param frame: The frame.
+ * @param levels: The decoded audio levels.
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int
+adec_frame_set_levels(struct mbuf_audio_frame *frame,
+		      const struct adec_levels *levels);
+
+
 ADEC_INTERNAL_API struct adec_config_impl *
 adec_config_get_specific(struct adec_config *config,
 			 enum adec_decoder_implem implem);
 
 
+/**
+ * Get the current time according to a timing mode.
+ *
+ * @param mode: The timing mode.
+ *
+ * @return the current monotonic time in microseconds, or 0 if the mode is
+ * ADEC_TIMING_MODE_NONE
+ */
+ADEC_INTERNAL_API uint64_t adec_get_time_us(enum adec_timing_mode mode);
+
+
+/**
+ * Initialize the attributes of a decoder thread.
+ * This function initializes the attributes and sets the stack size according
+ * to the decoder configuration. The attributes must be destroyed using
+ * pthread_attr_destroy() after the thread creation.
+ *
+ * @param base: The base audio decoder.
+ * @param attr: The thread attributes to initialize.
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_thread_attr_init(struct adec_decoder *base,
+					    pthread_attr_t *attr);
+
+
+/**
+ * Apply the thread configuration to the calling decoder thread.
+ * This function must be called from the decoder thread itself. It applies the
+ * CPU affinity, scheduling policy and priority, and nice value from the
+ * decoder configuration; settings that cannot be applied are logged and
+ * ignored. The effective settings are then saved in the decoder statistics.
+ *
+ * @param base: The base audio decoder.
+ */
+ADEC_INTERNAL_API void adec_thread_apply_config(struct adec_decoder *base);
+
+
+/**
+ * Create a trace ring.
+ * The ring holds the last event_count events (rounded up to a power of 2).
+ * Recording is lock-free and can be done concurrently from any thread.
+ *
+ * @param event_count: ring size in events
+ * @param ret_obj: trace ring handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_trace_new(unsigned int event_count,
+				     struct adec_trace **ret_obj);
+
+
+/**
+ * Destroy a trace ring.
+ *
+ * @param trace: trace ring handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_trace_destroy(struct adec_trace *trace);
+
+
+/**
+ * Record a trace event.
+ * This function does nothing if tracing is disabled on the decoder.
+ *
+ * @param base: The base audio decoder.
+ * @param type: The event type.
+ * @param index: The frame index.
+ */
+ADEC_INTERNAL_API void adec_trace_record(struct adec_decoder *base,
+					 enum adec_trace_event_type type,
+					 uint32_t index);
+
+
+/**
+ * Read the events currently held in a trace ring, oldest first.
+ * Events that are being overwritten while reading are skipped.
+ *
+ * @param trace: trace ring handle
+ * @param events: events array (output)
+ * @param max_count: size of the events array
+ *
+ * @return the number of events copied, or a negative errno on error
+ */
+ADEC_INTERNAL_API int adec_trace_read(struct adec_trace *trace,
+				      struct adec_trace_event *events,
+				      size_t max_count);
+
+
+/**
+ * Export the events currently held in a trace ring.
+ *
+ * @param trace: trace ring handle
+ * @param format: export format
+ * @param dec_id: decoder instance ID (used as process ID in JSON traces)
+ * @param stream: output stream
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_trace_export(struct adec_trace *trace,
+					enum adec_trace_format format,
+					int dec_id,
+					FILE *stream);
+
+
+/**
+ * Create a CPU accounting context.
+ *
+ * @param ret_obj: CPU accounting handle (output)
+ *
+ * @return 0 on success, -ENOSYS if no thread CPU clock is available,
+ * negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_cpu_acct_new(struct adec_cpu_acct **ret_obj);
+
+
+/**
+ * Destroy a CPU accounting context.
+ *
+ * @param acct: CPU accounting handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_cpu_acct_destroy(struct adec_cpu_acct *acct);
+
+
+/**
+ * Start measuring a decoder library call.
+ * The thread CPU clock is used, so that the measure stays valid when
+ * several decoder instances share the same thread.
+ *
+ * @param base: The base audio decoder.
+ *
+ * @return the current thread CPU time in nanoseconds, or 0 if CPU
+ * accounting is disabled on the decoder
+ */
+ADEC_INTERNAL_API uint64_t adec_cpu_acct_start(struct adec_decoder *base);
+
+
+/**
+ * Get the thread CPU time elapsed since adec_cpu_acct_start().
+ *
+ * @param base: The base audio decoder.
+ * @param start: The value returned by adec_cpu_acct_start().
+ *
+ * @return the elapsed thread CPU time in nanoseconds, or 0 if CPU
+ * accounting is disabled on the decoder
+ */
+ADEC_INTERNAL_API uint64_t adec_cpu_acct_elapsed(struct adec_decoder *base,
+						 uint64_t start);
+
+
+/**
+ * Record the CPU time spent decoding a frame.
+ * This function does nothing if CPU accounting is disabled on the decoder.
+ *
+ * @param base: The base audio decoder.
+ * @param ns: The CPU time in nanoseconds.
+ */
+ADEC_INTERNAL_API void adec_cpu_acct_record(struct adec_decoder *base,
+					    uint64_t ns);
+
+
+/**
+ * Get the CPU accounting statistics.
+ *
+ * @param acct: CPU accounting handle
+ * @param stats: CPU statistics (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_cpu_acct_get(struct adec_cpu_acct *acct,
+					struct adec_cpu_stats *stats);
+
+
+/**
+ * Create a capture recorder.
+ * The file is created (or truncated) and starts with a
+ * ADEC_CAPTURE_RECORD_CONFIG record. Recording can be done concurrently
+ * from any thread: the records are copied to a buffer and written to the
+ * file by a writer thread, so that recording does not block on I/O.
+ *
+ * @param path: The capture file path.
+ * @param config: The decoder configuration.
+ * @param ret_obj: capture recorder handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_capture_new(const char *path,
+				       const struct adec_config *config,
+				       struct adec_capture **ret_obj);
+
+
+/**
+ * Destroy a capture recorder.
+ * The records still pending in the writer thread are written to the file
+ * before closing it.
+ *
+ * @param capture: capture recorder handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_capture_destroy(struct adec_capture *capture);
+
+
+/**
+ * Record an adec_set_aac_asc() call.
+ * The record functions do nothing if capture is disabled on the decoder.
+ *
+ * @param base: The base audio decoder.
+ * @param asc: The ASC data (can be NULL).
+ * @param asc_size: The ASC size.
+ * @param data_format: The AAC data format.
+ */
+ADEC_INTERNAL_API void
+adec_capture_record_asc(struct adec_decoder *base,
+			const uint8_t *asc,
+			size_t asc_size,
+			enum adef_aac_data_format data_format);
+
+
+/**
+ * Record an input frame accepted by the input filter.
+ *
+ * @param base: The base audio decoder.
+ * @param frame: The input frame.
+ * @param info: The input frame info.
+ */
+ADEC_INTERNAL_API void
+adec_capture_record_frame(struct adec_decoder *base,
+			  struct mbuf_audio_frame *frame,
+			  const struct adef_frame *info);
+
+
+/**
+ * Record an adec_flush() call.
+ *
+ * @param base: The base audio decoder.
+ * @param discard: The discard flag.
+ */
+ADEC_INTERNAL_API void adec_capture_record_flush(struct adec_decoder *base,
+						 int discard);
+
+
+/**
+ * Record an adec_stop() call.
+ *
+ * @param base: The base audio decoder.
+ */
+ADEC_INTERNAL_API void adec_capture_record_stop(struct adec_decoder *base);
+
+
+/**
+ * Create a drift compensation context.
+ *
+ * @param config: The decoder configuration.
+ * @param ret_obj: drift compensation handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_drift_new(const struct adec_config *config,
+				     struct adec_drift **ret_obj);
+
+
+/**
+ * Destroy a drift compensation context.
+ *
+ * @param drift: drift compensation handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_drift_destroy(struct adec_drift *drift);
+
+
+/**
+ * Reset the resampler history and the controller state, e.g. after a
+ * discarding flush; the latency set-point is kept.
+ * To be called from the decoding thread.
+ *
+ * @param drift: drift compensation handle
+ */
+ADEC_INTERNAL_API void adec_drift_reset(struct adec_drift *drift);
+
+
+/**
+ * Report the timestamp of the sample being played.
+ * Can be called from any thread.
+ *
+ * @param drift: drift compensation handle
+ * @param timestamp_us: The timestamp in microseconds.
+ */
+ADEC_INTERNAL_API void adec_drift_set_playout_time(struct adec_drift *drift,
+						   uint64_t timestamp_us);
+
+
+/**
+ * Resample a decoded frame in place.
+ * The controller is updated from the latency between the end of the frame
+ * and the last reported playout time, then the frame is resampled with the
+ * resulting ratio. The buffer must be able to hold frame_count +
+ * ADEC_DRIFT_MAX_EXTRA_SAMPLES samples per channel. This function does
+ * nothing if drift compensation is disabled on the decoder.
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ * @param samples: The interleaved 16-bit samples (input and output).
+ * @param channel_count: The number of channels.
+ * @param frame_count: The number of samples per channel.
+ * @param sample_rate: The sample rate in Hz.
+ * @param end_us: The timestamp of the end of the frame in microseconds.
+ *
+ * @return the number of output samples per channel on success, negative
+ * errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_drift_process(struct adec_decoder *base,
+					 int16_t *samples,
+					 unsigned int channel_count,
+					 unsigned int frame_count,
+					 unsigned int sample_rate,
+					 uint64_t end_us);
+
+
+/**
+ * Get the drift compensation status.
+ *
+ * @param drift: drift compensation handle
+ * @param stats: drift compensation status (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_drift_get(struct adec_drift *drift,
+				     struct adec_drift_stats *stats);
+
+
+/**
+ * Create a latency catch-up context.
+ *
+ * @param config: The decoder configuration.
+ * @param ret_obj: latency catch-up handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_catchup_new(const struct adec_config *config,
+				       struct adec_catchup **ret_obj);
+
+
+/**
+ * Destroy a latency catch-up context.
+ *
+ * @param catchup: latency catch-up handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_catchup_destroy(struct adec_catchup *catchup);
+
+
+/**
+ * Reset the delay estimation, e.g. after a discarding flush.
+ * To be called from the decoding thread.
+ *
+ * @param catchup: latency catch-up handle
+ */
+ADEC_INTERNAL_API void adec_catchup_reset(struct adec_catchup *catchup);
+
+
+/**
+ * Time-compress a decoded frame in place if the playout delay is above the
+ * target. The frame can only get shorter. This function does nothing if
+ * latency catch-up is disabled on the decoder.
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ * @param samples: The interleaved 16-bit samples (input and output).
+ * @param channel_count: The number of channels.
+ * @param frame_count: The number of samples per channel.
+ * @param sample_rate: The sample rate in Hz.
+ * @param timestamp_us: The frame timestamp in microseconds.
+ * @param arrival_us: The frame arrival time in microseconds (monotonic).
+ *
+ * @return the number of output samples per channel on success, negative
+ * errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_catchup_process(struct adec_decoder *base,
+					   int16_t *samples,
+					   unsigned int channel_count,
+					   unsigned int frame_count,
+					   unsigned int sample_rate,
+					   uint64_t timestamp_us,
+					   uint64_t arrival_us);
+
+
+/**
+ * Attach a decoder to its memory budget group (the mem_group configuration
+ * field, or the process-wide group).
+ *
+ * @param base: The base audio decoder.
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_mem_attach(struct adec_decoder *base);
+
+
+/**
+ * Detach a decoder from its memory budget group, releasing all the memory
+ * still accounted for it except the output memories allocated with
+ * adec_mem_alloc(), which stay accounted in the group until released. This
+ * function does nothing if the decoder is not attached.
+ *
+ * @param base: The base audio decoder.
+ */
+ADEC_INTERNAL_API void adec_mem_detach(struct adec_decoder *base);
+
+
+/**
+ * Account memory in the decoder memory budget group.
+ * Can be called from any thread.
+ *
+ * @param base: The base audio decoder.
+ * @param kind: The accounting category.
+ * @param size: The size in bytes.
+ * @param force: Account the memory even if the budget is exceeded.
+ *
+ * @return 0 on success, -ENOBUFS if the budget would be exceeded (the
+ * memory is then not accounted), negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_mem_charge(struct adec_decoder *base,
+				      enum adec_mem_kind kind,
+				      size_t size,
+				      int force);
+
+
+/**
+ * Release memory accounted with adec_mem_charge().
+ * Can be called from any thread.
+ *
+ * @param base: The base audio decoder.
+ * @param kind: The accounting category.
+ * @param size: The size in bytes.
+ */
+ADEC_INTERNAL_API void adec_mem_release(struct adec_decoder *base,
+					enum adec_mem_kind kind,
+					size_t size);
+
+
+/**
+ * Check whether accounting more memory would exceed the budget of the
+ * decoder memory budget group.
+ *
+ * @param base: The base audio decoder.
+ * @param size: The size in bytes to account (0 to check whether the budget
+ *              is already exceeded).
+ *
+ * @return true if the budget would be exceeded, false otherwise
+ */
+ADEC_INTERNAL_API bool adec_mem_over_budget(struct adec_decoder *base,
+					    size_t size);
+
+
+/**
+ * Allocate an output memory accounted as ADEC_MEM_OUTPUT in the decoder
+ * memory budget group until its last reference is released, possibly after
+ * the decoder is destroyed. The memory is always accounted: the caller must
+ * check adec_mem_over_budget() beforehand.
+ *
+ * @param base: The base audio decoder.
+ * @param size: The memory size in bytes.
+ * @param mem: The memory (output).
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_mem_alloc(struct adec_decoder *base,
+				     size_t size,
+				     struct mbuf_mem **mem);
+
+
+/**
+ * Set the function called when an output memory allocated with
+ * adec_mem_alloc() is released, from the releasing thread. Once this
+ * function returns with a NULL callback, the previous callback is no longer
+ * called.
+ *
+ * @param base: The base audio decoder.
+ * @param cb: The callback (can be NULL).
+ * @param userdata: The callback user data.
+ */
+ADEC_INTERNAL_API void adec_mem_set_release_cb(struct adec_decoder *base,
+					       void (*cb)(void *userdata),
+					       void *userdata);
+
+
+/**
+ * Get the memory usage of a decoder.
+ *
+ * @param base: The base audio decoder.
+ * @param usage: The memory usage (output).
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_mem_get_usage(struct adec_decoder *base,
+					 struct adec_memory_usage *usage);
+
+
+/**
+ * Create the output stage of a decoder.
+ * In real-time mode, unless the application supplies the output memories,
+ * the output memories are preallocated, and blank output frames are kept
+ * ready for the decoding thread. To be called from the loop thread.
+ *
+ * @param base: The base audio decoder.
+ * @param mem_size: The size of the output memories in bytes.
+ * @param ret_obj: output stage handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_output_new(struct adec_decoder *base,
+				      size_t mem_size,
+				      struct adec_output **ret_obj);
+
+
+/**
+ * Destroy the output stage of a decoder.
+ *
+ * @param output: output stage handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_output_destroy(struct adec_output *output);
+
+
+/**
+ * Get a memory to decode a frame into: from the application shared memory
+ * or pool if configured, then from the real-time pool, allocated otherwise
+ * (the allocated memories are accounted in the memory budget, see
+ * adec_mem_alloc()). In real-time mode, a scratch memory is returned
+ * instead of allocating; the frame decoded into it is dropped by
+ * adec_output_push().
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ * @param size: The minimum memory size in bytes.
+ * @param mem: The memory (output).
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_output_get_mem(struct adec_decoder *base,
+					  size_t size,
+					  struct mbuf_mem **mem);
+
+
+/**
+ * Create the decoding pipeline of a decoder: the input queue and its filter
+ * (input queue limits and memory budget), the decoding thread, the output
+ * queue and the flushes. The implementation only decodes the input frames
+ * through the callbacks and pushes the output frames with
+ * adec_output_push(); the output stage must be created beforehand.
+ * To be called from the loop thread.
+ *
+ * @param base: The base audio decoder.
+ * @param cbs: The implementation callbacks.
+ * @param thread_name: The decoding thread name (static string).
+ * @param ret_obj: pipeline handle (output)
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_pipeline_new(struct adec_decoder *base,
+					const struct adec_pipeline_cbs *cbs,
+					const char *thread_name,
+					struct adec_pipeline **ret_obj);
+
+
+/**
+ * Destroy the decoding pipeline of a decoder: the decoding thread is stopped
+ * and joined, and the queued frames are released.
+ * To be called from the loop thread.
+ *
+ * @param pipeline: pipeline handle (can be NULL)
+ */
+ADEC_INTERNAL_API void adec_pipeline_destroy(struct adec_pipeline *pipeline);
+
+
+/**
+ * Stop the decoding pipeline: the decoding thread exits once the pending
+ * flush is complete, then the stop callback is called on the loop.
+ *
+ * @param pipeline: pipeline handle
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_pipeline_stop(struct adec_pipeline *pipeline);
+
+
+/**
+ * Flush the decoding pipeline, see adec_flush().
+ * To be called from the loop thread.
+ *
+ * @param pipeline: pipeline handle
+ * @param discard: if true, the queued frames are discarded
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_INTERNAL_API int adec_pipeline_flush(struct adec_pipeline *pipeline,
+					  int discard);
+
+
+/**
+ * Get the input queue of the decoding pipeline.
+ *
+ * @param pipeline: pipeline handle
+ *
+ * @return the input queue, or NULL in case of error
+ */
+ADEC_INTERNAL_API struct mbuf_audio_frame_queue *
+adec_pipeline_get_input_queue(struct adec_pipeline *pipeline);
+
+
+/**
+ * Post-process a decoded frame and push it to the output queue.
+ * The levels are measured (and silent frames dropped if configured), then
+ * the latency catch-up and the drift compensation are applied, and the
+ * output frame is built on the memory with the application ancillary data
+ * of the input frame, the levels and the decoder timings as a single
+ * ADEC_ANCILLARY_KEY_TIMINGS record (in real-time mode, the application
+ * ancillary data is not copied and the records preallocated with the blank
+ * output frames are filled in place).
+ * When the latency catch-up or the drift compensation is enabled, the
+ * timestamp is shifted by the samples they removed or added since the last
+ * reset, so that the output timestamps advance by the emitted samples.
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ * @param in_frame: The input frame.
+ * @param info: The output frame info and format (the timestamp can be
+ *             updated).
+ * @param mem: The memory holding the interleaved decoded samples.
+ * @param frame_count: The number of decoded samples per channel.
+ * @param timings: The decoder timings (the output time is set).
+ *
+ * @return 1 if the frame was queued, 0 if it was dropped, negative errno
+ * value in case of error
+ */
+ADEC_INTERNAL_API int adec_output_push(struct adec_decoder *base,
+				       struct mbuf_audio_frame *in_frame,
+				       struct adef_frame *info,
+				       struct mbuf_mem *mem,
+				       unsigned int frame_count,
+				       struct adec_timings *timings);
+
+
+/**
+ * Release an input frame once decoded. In real-time mode the frame is
+ * unreferenced on the loop thread, so that the decoding thread does not free
+ * it.
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ * @param frame: The input frame (the reference is taken over).
+ */
+ADEC_INTERNAL_API void
+adec_output_release_input(struct adec_decoder *base,
+			  struct mbuf_audio_frame *frame);
+
+
+/**
+ * Reset the output post-processing state, e.g. after a discarding flush.
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ */
+ADEC_INTERNAL_API void adec_output_reset(struct adec_decoder *base);
+
+
+/**
+ * Get the timestamp of a frame in microseconds.
+ *
+ * @param info: The frame info.
+ *
+ * @return the timestamp in microseconds, or 0 if the frame has no timescale
+ */
+ADEC_INTERNAL_API uint64_t
+adec_frame_time_us(const struct adef_frame_info *info);
+
+
+/**
+ * Check whether an input queue is over the configured limits
+ * (max_in_queue_count and max_in_queue_duration_ms).
+ *
+ * @param config: The decoder configuration.
+ * @param count: The number of queued frames.
+ * @param head_time: The time of the oldest queued frame in microseconds.
+ * @param newest_time: The time of the newest queued frame in microseconds.
+ *
+ * @return true if the queue is over the limits, false otherwise
+ */
+ADEC_INTERNAL_API bool
+adec_in_queue_over_limits(const struct adec_config *config,
+			  unsigned int count,
+			  uint64_t head_time,
+			  uint64_t newest_time);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
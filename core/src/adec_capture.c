@@ -0,0 +1,579 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#	include <TargetConditionals.h>
+#endif
+
+/* Capture file layout (all integers little-endian):
+ *  - file header: magic (8 bytes), version (u32), reserved (u32)
+ *  - records: type (u8), reserved (3 bytes), payload length (u32),
+ *    time in microseconds since the capture start (u64), payload */
+#define ADEC_CAPTURE_MAGIC "ADECCAPT"
+#define ADEC_CAPTURE_VERSION 1
+#define ADEC_CAPTURE_FILE_HEADER_SIZE 16
+#define ADEC_CAPTURE_RECORD_HEADER_SIZE 16
+#define ADEC_CAPTURE_CONFIG_SIZE 12
+#define ADEC_CAPTURE_ASC_SIZE 4
+#define ADEC_CAPTURE_FRAME_SIZE 48
+#define ADEC_CAPTURE_FLUSH_SIZE 4
+/* Size of the buffer between the recording threads and the writer thread;
+ * records that do not fit are dropped */
+#define ADEC_CAPTURE_BUFFER_SIZE (1024 * 1024)
+/* Sanity limit for the reader */
+#define ADEC_CAPTURE_MAX_PAYLOAD_SIZE (16 * 1024 * 1024)
+
+#define ADEC_CAPTURE_PCM_INTERLEAVED (1 << 0)
+#define ADEC_CAPTURE_PCM_SIGNED (1 << 1)
+#define ADEC_CAPTURE_PCM_LITTLE_ENDIAN (1 << 2)
+
+
+struct adec_capture {
+	FILE *file;
+	uint64_t start_time;
+
+	/* Records ring buffer, written by the recording threads and read by
+	 * the writer thread; head and tail are byte counts since the start,
+	 * protected by the mutex (the writer thread writes the
+	 * [tail, head) data to the file outside of the lock) */
+	uint8_t *buf;
+	uint64_t head;
+	uint64_t tail;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool thread_launched;
+	bool stop;
+	bool write_error;
+	unsigned int dropped;
+};
+
+
+struct adec_capture_reader {
+	FILE *file;
+	uint8_t *payload;
+	size_t payload_size;
+};
+
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+	for (unsigned int i = 0; i < 4; i++)
+		*p++ = (v >> (8 * i)) & 0xff;
+	return p;
+}
+
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+	for (unsigned int i = 0; i < 8; i++)
+		*p++ = (v >> (8 * i)) & 0xff;
+	return p;
+}
+
+
+static const uint8_t *get_u32(const uint8_t *p, uint32_t *v)
+{
+	*v = 0;
+	for (unsigned int i = 0; i < 4; i++)
+		*v |= (uint32_t)*p++ << (8 * i);
+	return p;
+}
+
+
+static const uint8_t *get_u64(const uint8_t *p, uint64_t *v)
+{
+	*v = 0;
+	for (unsigned int i = 0; i < 8; i++)
+		*v |= (uint64_t)*p++ << (8 * i);
+	return p;
+}
+
+
+/* Copy data to the ring buffer at the head position; the caller must
+ * hold the mutex and have checked the free space */
+static void
+ring_put(struct adec_capture *capture, const void *data, size_t len)
+{
+	size_t pos = capture->head % ADEC_CAPTURE_BUFFER_SIZE;
+	size_t first = ADEC_CAPTURE_BUFFER_SIZE - pos;
+
+	if (first > len)
+		first = len;
+	memcpy(capture->buf + pos, data, first);
+	if (len > first)
+		memcpy(capture->buf,
+		       (const uint8_t *)data + first,
+		       len - first);
+	capture->head += len;
+}
+
+
+/* Queue a record for the writer thread; the fixed payload part is in
+ * header, followed by data. Only copies under the lock: the file is
+ * written by the writer thread, so that recording never blocks the
+ * caller on I/O. */
+static int capture_write(struct adec_capture *capture,
+			 enum adec_capture_record_type type,
+			 const uint8_t *header,
+			 size_t header_len,
+			 const void *data,
+			 size_t len)
+{
+	int ret = 0;
+	uint8_t buf[ADEC_CAPTURE_RECORD_HEADER_SIZE] = {0};
+	uint8_t *p = buf;
+	uint64_t time = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+	size_t total = sizeof(buf) + header_len + len;
+	unsigned int dropped = 0;
+
+	*p = type;
+	p += 4;
+	p = put_u32(p, header_len + len);
+
+	pthread_mutex_lock(&capture->mutex);
+	if (ADEC_CAPTURE_BUFFER_SIZE - (capture->head - capture->tail) <
+	    total) {
+		/* The writer thread lags behind: drop the record rather
+		 * than blocking the caller */
+		dropped = ++capture->dropped;
+		ret = -ENOBUFS;
+		goto out;
+	}
+	put_u64(p, time - capture->start_time);
+	ring_put(capture, buf, sizeof(buf));
+	if (header_len > 0)
+		ring_put(capture, header, header_len);
+	if (len > 0)
+		ring_put(capture, data, len);
+	pthread_cond_signal(&capture->cond);
+
+out:
+	pthread_mutex_unlock(&capture->mutex);
+	/* Log the first drop, then every 100 drops */
+	if (dropped % 100 == 1)
+		ULOGW("capture: record dropped (%zu bytes), "
+		      "%u record(s) dropped so far",
+		      total,
+		      dropped);
+	return ret;
+}
+
+
+static void *writer_thread(void *ptr)
+{
+	struct adec_capture *capture = ptr;
+	size_t pos, len;
+	bool error = false;
+
+#if defined(__APPLE__)
+#	if !TARGET_OS_IPHONE
+	(void)pthread_setname_np("adec_capture");
+#	endif
+#else
+	(void)pthread_setname_np(pthread_self(), "adec_capture");
+#endif
+
+	pthread_mutex_lock(&capture->mutex);
+	while (true) {
+		while (capture->head == capture->tail && !capture->stop)
+			pthread_cond_wait(&capture->cond, &capture->mutex);
+		/* Remaining records are flushed before exiting */
+		if (capture->head == capture->tail)
+			break;
+
+		/* Write the contiguous part of the pending data; the
+		 * recording threads only write to the free space, so the
+		 * data can be accessed outside of the lock */
+		pos = capture->tail % ADEC_CAPTURE_BUFFER_SIZE;
+		len = capture->head - capture->tail;
+		if (len > ADEC_CAPTURE_BUFFER_SIZE - pos)
+			len = ADEC_CAPTURE_BUFFER_SIZE - pos;
+		pthread_mutex_unlock(&capture->mutex);
+
+		if (!error &&
+		    fwrite(capture->buf + pos, len, 1, capture->file) != 1) {
+			ULOG_ERRNO("fwrite", EIO);
+			error = true;
+		}
+
+		pthread_mutex_lock(&capture->mutex);
+		capture->tail += len;
+		capture->write_error = error;
+	}
+	pthread_mutex_unlock(&capture->mutex);
+
+	return NULL;
+}
+
+
+int adec_capture_new(const char *path,
+		     const struct adec_config *config,
+		     struct adec_capture **ret_obj)
+{
+	int ret;
+	struct adec_capture *capture;
+	uint8_t header[ADEC_CAPTURE_FILE_HEADER_SIZE] = {0};
+	uint8_t cfg[ADEC_CAPTURE_CONFIG_SIZE];
+	uint8_t *p;
+
+	ULOG_ERRNO_RETURN_ERR_IF(path == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	capture = calloc(1, sizeof(*capture));
+	if (capture == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	capture->start_time = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+
+	capture->buf = malloc(ADEC_CAPTURE_BUFFER_SIZE);
+	if (capture->buf == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	capture->file = fopen(path, "wb");
+	if (capture->file == NULL) {
+		ret = -errno;
+		ULOG_ERRNO("fopen('%s')", -ret, path);
+		goto error;
+	}
+
+	memcpy(header, ADEC_CAPTURE_MAGIC, 8);
+	put_u32(header + 8, ADEC_CAPTURE_VERSION);
+	if (fwrite(header, sizeof(header), 1, capture->file) != 1) {
+		ret = -EIO;
+		ULOG_ERRNO("fwrite", -ret);
+		goto error;
+	}
+
+	ret = pthread_create(&capture->thread, NULL, writer_thread, capture);
+	if (ret != 0) {
+		ret = -ret;
+		ULOG_ERRNO("pthread_create", -ret);
+		goto error;
+	}
+	capture->thread_launched = true;
+
+	p = put_u32(cfg, config->encoding);
+	p = put_u32(p, config->implem);
+	put_u32(p, config->stream_input ? 1 : 0);
+	ret = capture_write(
+		capture, ADEC_CAPTURE_RECORD_CONFIG, cfg, sizeof(cfg), NULL, 0);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = capture;
+	return 0;
+
+error:
+	adec_capture_destroy(capture);
+	return ret;
+}
+
+
+void adec_capture_destroy(struct adec_capture *capture)
+{
+	if (capture == NULL)
+		return;
+
+	if (capture->thread_launched) {
+		pthread_mutex_lock(&capture->mutex);
+		capture->stop = true;
+		pthread_cond_signal(&capture->cond);
+		pthread_mutex_unlock(&capture->mutex);
+		pthread_join(capture->thread, NULL);
+	}
+	if (capture->dropped > 0 || capture->write_error)
+		ULOGW("capture: incomplete file (%u record(s) dropped%s)",
+		      capture->dropped,
+		      capture->write_error ? ", write error" : "");
+
+	if (capture->file != NULL)
+		fclose(capture->file);
+	free(capture->buf);
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->mutex);
+	free(capture);
+}
+
+
+void adec_capture_record_asc(struct adec_decoder *base,
+			     const uint8_t *asc,
+			     size_t asc_size,
+			     enum adef_aac_data_format data_format)
+{
+	uint8_t payload[ADEC_CAPTURE_ASC_SIZE];
+
+	if (base->capture == NULL)
+		return;
+
+	put_u32(payload, data_format);
+	(void)capture_write(base->capture,
+			    ADEC_CAPTURE_RECORD_ASC,
+			    payload,
+			    sizeof(payload),
+			    asc,
+			    (asc != NULL) ? asc_size : 0);
+}
+
+
+void adec_capture_record_frame(struct adec_decoder *base,
+			       struct mbuf_audio_frame *frame,
+			       const struct adef_frame *info)
+{
+	int ret;
+	uint8_t payload[ADEC_CAPTURE_FRAME_SIZE];
+	uint8_t *p;
+	uint32_t pcm = 0;
+	const void *data = NULL;
+	size_t len = 0;
+
+	if (base->capture == NULL)
+		return;
+
+	ret = mbuf_audio_frame_get_buffer(frame, &data, &len);
+	if (ret < 0) {
+		ULOG_ERRNO("mbuf_audio_frame_get_buffer", -ret);
+		return;
+	}
+
+	if (info->format.pcm.interleaved)
+		pcm |= ADEC_CAPTURE_PCM_INTERLEAVED;
+	if (info->format.pcm.signed_val)
+		pcm |= ADEC_CAPTURE_PCM_SIGNED;
+	if (info->format.pcm.little_endian)
+		pcm |= ADEC_CAPTURE_PCM_LITTLE_ENDIAN;
+	p = put_u32(payload, info->format.encoding);
+	p = put_u32(p, info->format.channel_count);
+	p = put_u32(p, info->format.bit_depth);
+	p = put_u32(p, info->format.sample_rate);
+	p = put_u32(p, pcm);
+	p = put_u32(p, info->format.aac.data_format);
+	p = put_u64(p, info->info.timestamp);
+	p = put_u32(p, info->info.timescale);
+	p = put_u64(p, info->info.capture_timestamp);
+	put_u32(p, info->info.index);
+
+	(void)capture_write(base->capture,
+			    ADEC_CAPTURE_RECORD_FRAME,
+			    payload,
+			    sizeof(payload),
+			    data,
+			    len);
+
+	mbuf_audio_frame_release_buffer(frame, data);
+}
+
+
+void adec_capture_record_flush(struct adec_decoder *base, int discard)
+{
+	uint8_t payload[ADEC_CAPTURE_FLUSH_SIZE];
+
+	if (base->capture == NULL)
+		return;
+
+	put_u32(payload, discard ? 1 : 0);
+	(void)capture_write(base->capture,
+			    ADEC_CAPTURE_RECORD_FLUSH,
+			    payload,
+			    sizeof(payload),
+			    NULL,
+			    0);
+}
+
+
+void adec_capture_record_stop(struct adec_decoder *base)
+{
+	if (base->capture == NULL)
+		return;
+
+	(void)capture_write(
+		base->capture, ADEC_CAPTURE_RECORD_STOP, NULL, 0, NULL, 0);
+}
+
+
+int adec_capture_reader_open(const char *path,
+			     struct adec_capture_reader **ret_obj)
+{
+	int ret;
+	struct adec_capture_reader *reader;
+	uint8_t header[ADEC_CAPTURE_FILE_HEADER_SIZE];
+	uint32_t version;
+
+	ULOG_ERRNO_RETURN_ERR_IF(path == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	reader = calloc(1, sizeof(*reader));
+	if (reader == NULL)
+		return -ENOMEM;
+
+	reader->file = fopen(path, "rb");
+	if (reader->file == NULL) {
+		ret = -errno;
+		ULOG_ERRNO("fopen('%s')", -ret, path);
+		goto error;
+	}
+
+	if (fread(header, sizeof(header), 1, reader->file) != 1 ||
+	    memcmp(header, ADEC_CAPTURE_MAGIC, 8) != 0) {
+		ret = -EPROTO;
+		ULOGE("'%s' is not a capture file", path);
+		goto error;
+	}
+	get_u32(header + 8, &version);
+	if (version != ADEC_CAPTURE_VERSION) {
+		ret = -EPROTO;
+		ULOGE("unsupported capture version %u", version);
+		goto error;
+	}
+
+	*ret_obj = reader;
+	return 0;
+
+error:
+	adec_capture_reader_close(reader);
+	return ret;
+}
+
+
+void adec_capture_reader_close(struct adec_capture_reader *reader)
+{
+	if (reader == NULL)
+		return;
+
+	if (reader->file != NULL)
+		fclose(reader->file);
+	free(reader->payload);
+	free(reader);
+}
+
+
+int adec_capture_reader_read(struct adec_capture_reader *reader,
+			     struct adec_capture_record *record)
+{
+	uint8_t header[ADEC_CAPTURE_RECORD_HEADER_SIZE];
+	const uint8_t *p;
+	uint32_t len, v, pcm;
+	size_t fixed;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(record == NULL, EINVAL);
+
+	if (fread(header, sizeof(header), 1, reader->file) != 1)
+		return feof(reader->file) ? -ENODATA : -EIO;
+
+	memset(record, 0, sizeof(*record));
+	record->type = header[0];
+	get_u32(header + 4, &len);
+	get_u64(header + 8, &record->time_us);
+	if (len > ADEC_CAPTURE_MAX_PAYLOAD_SIZE)
+		return -EPROTO;
+
+	if (len > reader->payload_size) {
+		uint8_t *payload = realloc(reader->payload, len);
+		if (payload == NULL)
+			return -ENOMEM;
+		reader->payload = payload;
+		reader->payload_size = len;
+	}
+	if (len > 0 && fread(reader->payload, len, 1, reader->file) != 1)
+		return -EPROTO;
+	p = reader->payload;
+
+	switch (record->type) {
+	case ADEC_CAPTURE_RECORD_CONFIG:
+		fixed = ADEC_CAPTURE_CONFIG_SIZE;
+		if (len < fixed)
+			return -EPROTO;
+		p = get_u32(p, &v);
+		record->config.encoding = v;
+		p = get_u32(p, &v);
+		record->config.implem = v;
+		get_u32(p, &v);
+		record->config.stream_input = v;
+		break;
+	case ADEC_CAPTURE_RECORD_ASC:
+		fixed = ADEC_CAPTURE_ASC_SIZE;
+		if (len < fixed)
+			return -EPROTO;
+		get_u32(p, &v);
+		record->asc.data_format = v;
+		break;
+	case ADEC_CAPTURE_RECORD_FRAME:
+		fixed = ADEC_CAPTURE_FRAME_SIZE;
+		if (len < fixed)
+			return -EPROTO;
+		p = get_u32(p, &v);
+		record->frame.format.encoding = v;
+		p = get_u32(p, &record->frame.format.channel_count);
+		p = get_u32(p, &record->frame.format.bit_depth);
+		p = get_u32(p, &record->frame.format.sample_rate);
+		p = get_u32(p, &pcm);
+		record->frame.format.pcm.interleaved =
+			!!(pcm & ADEC_CAPTURE_PCM_INTERLEAVED);
+		record->frame.format.pcm.signed_val =
+			!!(pcm & ADEC_CAPTURE_PCM_SIGNED);
+		record->frame.format.pcm.little_endian =
+			!!(pcm & ADEC_CAPTURE_PCM_LITTLE_ENDIAN);
+		p = get_u32(p, &v);
+		record->frame.format.aac.data_format = v;
+		p = get_u64(p, &record->frame.info.timestamp);
+		p = get_u32(p, &record->frame.info.timescale);
+		p = get_u64(p, &record->frame.info.capture_timestamp);
+		get_u32(p, &record->frame.info.index);
+		break;
+	case ADEC_CAPTURE_RECORD_FLUSH:
+		fixed = ADEC_CAPTURE_FLUSH_SIZE;
+		if (len < fixed)
+			return -EPROTO;
+		get_u32(p, &v);
+		record->flush.discard = v;
+		break;
+	case ADEC_CAPTURE_RECORD_STOP:
+		fixed = 0;
+		break;
+	default:
+		/* Unknown record, skipped by the caller */
+		fixed = len;
+		break;
+	}
+
+	record->data = (len > fixed) ? reader->payload + fixed : NULL;
+	record->len = len - fixed;
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define ADEC_CATCHUP_DEFAULT_TARGET_MS 40
+#define ADEC_CATCHUP_DEFAULT_SPEEDUP 10
+
+/* Excess delay above the target at which the maximum speed-up is reached */
+#define ADEC_CATCHUP_RAMP_US 100000
+
+/* Lowest gap tracking: minimum over two half-windows, so that the baseline
+ * follows the clocks drift */
+#define ADEC_CATCHUP_BASELINE_WINDOW_US 10000000
+
+/* Removed segment length range, covering the usual pitch periods; the
+ * minimum is also the correlation window */
+#define ADEC_CATCHUP_MIN_LAG_HZ 400
+#define ADEC_CATCHUP_MAX_LAG_HZ 66
+
+/* Minimum normalized correlation for a segment to be removed, unless the
+ * removal credit is saturated */
+#define ADEC_CATCHUP_MIN_CORR 0.8f
+
+/* Mean square value under which a segment is considered silent */
+#define ADEC_CATCHUP_SILENCE 1.f
+
+
+struct adec_catchup {
+	int64_t target_us;
+	double max_speedup;
+
+	/* Delay estimation: estimated playout delay and lowest gap between
+	 * arrival time and timestamp over the last two half-windows */
+	bool started;
+	int64_t delay_us;
+	int64_t baseline[2];
+	uint64_t baseline_start;
+
+	/* Samples per channel to remove, accumulated from the speed-up */
+	double credit;
+
+	/* Mono downmix scratch buffer (full rate then decimated) */
+	float *mono;
+	size_t mono_len;
+};
+
+
+int adec_catchup_new(const struct adec_config *config,
+		     struct adec_catchup **ret_obj)
+{
+	struct adec_catchup *catchup;
+	unsigned int speedup;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	catchup = calloc(1, sizeof(*catchup));
+	if (catchup == NULL)
+		return -ENOMEM;
+
+	catchup->target_us =
+		(int64_t)(config->catchup_target_latency_ms
+				  ? config->catchup_target_latency_ms
+				  : ADEC_CATCHUP_DEFAULT_TARGET_MS) *
+		1000;
+	speedup = config->catchup_max_speedup;
+	if (speedup == 0)
+		speedup = ADEC_CATCHUP_DEFAULT_SPEEDUP;
+	else if (speedup > ADEC_CATCHUP_MAX_SPEEDUP)
+		speedup = ADEC_CATCHUP_MAX_SPEEDUP;
+	catchup->max_speedup = speedup / 100.;
+
+	if (config->realtime) {
+		/* Sized for the largest frame: no allocation on the decoding
+		 * path */
+		catchup->mono_len = ADEC_MAX_OUTPUT_FRAME_SIZE /
+				    sizeof(int16_t) /
+				    ADEC_MAX_CHANNEL_COUNT * 2;
+		catchup->mono =
+			malloc(catchup->mono_len * sizeof(*catchup->mono));
+		if (catchup->mono == NULL) {
+			adec_catchup_destroy(catchup);
+			return -ENOMEM;
+		}
+	}
+
+	*ret_obj = catchup;
+	return 0;
+}
+
+
+void adec_catchup_destroy(struct adec_catchup *catchup)
+{
+	if (catchup == NULL)
+		return;
+
+	free(catchup->mono);
+	free(catchup);
+}
+
+
+void adec_catchup_reset(struct adec_catchup *catchup)
+{
+	catchup->started = false;
+	catchup->credit = 0.;
+}
+
+
+/* Update the delay estimation with a new frame; returns the excess delay */
+static int64_t update_delay(struct adec_catchup *catchup,
+			    uint64_t timestamp_us,
+			    uint64_t arrival_us)
+{
+	int64_t gap = (int64_t)(arrival_us - timestamp_us);
+	int64_t baseline;
+
+	if (!catchup->started) {
+		catchup->delay_us = gap;
+		catchup->baseline[0] = gap;
+		catchup->baseline[1] = gap;
+		catchup->baseline_start = arrival_us;
+		catchup->started = true;
+		return 0;
+	}
+
+	if (arrival_us - catchup->baseline_start >=
+	    ADEC_CATCHUP_BASELINE_WINDOW_US / 2) {
+		catchup->baseline[0] = catchup->baseline[1];
+		catchup->baseline[1] = gap;
+		catchup->baseline_start = arrival_us;
+	} else if (gap < catchup->baseline[1]) {
+		catchup->baseline[1] = gap;
+	}
+	baseline = catchup->baseline[0] < catchup->baseline[1]
+			   ? catchup->baseline[0]
+			   : catchup->baseline[1];
+
+	/* A frame arriving later than its playout time stalls the player,
+	 * the delay grows by the lateness */
+	if (gap > catchup->delay_us)
+		catchup->delay_us = gap;
+	if (catchup->delay_us < baseline)
+		catchup->delay_us = baseline;
+
+	return catchup->delay_us - baseline;
+}
+
+
+/* Normalized correlation between a[0..len) and b[0..len) */
+static float correlation(const float *a, const float *b, unsigned int len)
+{
+	float ab = 0.f, aa = 0.f, bb = 0.f;
+
+	for (unsigned int i = 0; i < len; i++) {
+		ab += a[i] * b[i];
+		aa += a[i] * a[i];
+		bb += b[i] * b[i];
+	}
+	if (aa < ADEC_CATCHUP_SILENCE * len && bb < ADEC_CATCHUP_SILENCE * len)
+		return 1.f;
+	if (aa == 0.f || bb == 0.f)
+		return 0.f;
+	return ab / sqrtf(aa * bb);
+}
+
+
+/* Find the lag in [min_lag, max_lag] where the frame start is the most
+ * similar to itself: coarse search on a decimated downmix, then refinement
+ * at full rate around the best coarse lag */
+static unsigned int find_lag(struct adec_catchup *catchup,
+			     const int16_t *samples,
+			     unsigned int channel_count,
+			     unsigned int frame_count,
+			     unsigned int sample_rate,
+			     unsigned int min_lag,
+			     unsigned int max_lag,
+			     float *best_corr)
+{
+	float *mono = catchup->mono;
+	float *dec = catchup->mono + frame_count;
+	unsigned int factor, dec_count, lag, best = min_lag, lo, hi;
+	float corr;
+
+	factor = (sample_rate >= 32000) ? 4 : (sample_rate >= 16000) ? 2 : 1;
+
+	for (unsigned int i = 0; i < frame_count; i++) {
+		int sum = 0;
+		for (unsigned int c = 0; c < channel_count; c++)
+			sum += samples[i * channel_count + c];
+		mono[i] = (float)sum / channel_count;
+	}
+	dec_count = frame_count / factor;
+	for (unsigned int i = 0; i < dec_count; i++) {
+		float sum = 0.f;
+		for (unsigned int j = 0; j < factor; j++)
+			sum += mono[i * factor + j];
+		dec[i] = sum / factor;
+	}
+
+	*best_corr = -1.f;
+	for (lag = min_lag / factor; lag <= max_lag / factor; lag++) {
+		corr = correlation(dec, dec + lag, min_lag / factor);
+		if (corr > *best_corr) {
+			*best_corr = corr;
+			best = lag * factor;
+		}
+	}
+
+	lo = (best > min_lag + factor) ? best - factor : min_lag;
+	hi = (best + factor < max_lag) ? best + factor : max_lag;
+	*best_corr = -1.f;
+	for (lag = lo; lag <= hi; lag++) {
+		corr = correlation(mono, mono + lag, min_lag);
+		if (corr > *best_corr) {
+			*best_corr = corr;
+			best = lag;
+		}
+	}
+
+	return best;
+}
+
+
+int adec_catchup_process(struct adec_decoder *base,
+			 int16_t *samples,
+			 unsigned int channel_count,
+			 unsigned int frame_count,
+			 unsigned int sample_rate,
+			 uint64_t timestamp_us,
+			 uint64_t arrival_us)
+{
+	struct adec_catchup *catchup = base->catchup;
+	const unsigned int c = channel_count;
+	int64_t excess;
+	double speedup;
+	unsigned int min_lag, max_lag, lag;
+	float corr;
+	size_t len;
+	bool saturated;
+
+	if (catchup == NULL)
+		return frame_count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(samples == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(c == 0 || c > ADEC_MAX_CHANNEL_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_rate == 0, EINVAL);
+
+	excess = update_delay(catchup, timestamp_us, arrival_us);
+	if (excess <= catchup->target_us) {
+		catchup->credit = 0.;
+		return frame_count;
+	}
+
+	speedup = catchup->max_speedup;
+	if (excess - catchup->target_us < ADEC_CATCHUP_RAMP_US) {
+		speedup *= (double)(excess - catchup->target_us) /
+			   ADEC_CATCHUP_RAMP_US;
+	}
+	catchup->credit += frame_count * speedup / (1. + speedup);
+
+	/* The removed segment and the one it is crossfaded with must both
+	 * fit in the frame */
+	min_lag = sample_rate / ADEC_CATCHUP_MIN_LAG_HZ;
+	max_lag = sample_rate / ADEC_CATCHUP_MAX_LAG_HZ;
+	if (max_lag > frame_count / 2)
+		max_lag = frame_count / 2;
+	if (min_lag == 0 || min_lag > max_lag)
+		return frame_count;
+	saturated = catchup->credit >= 2. * max_lag;
+	if (saturated)
+		catchup->credit = 2. * max_lag;
+	if (catchup->credit < min_lag)
+		return frame_count;
+
+	len = (size_t)frame_count * 2;
+	if (len > catchup->mono_len) {
+		float *mono = realloc(catchup->mono, len * sizeof(*mono));
+		if (mono == NULL)
+			return -ENOMEM;
+		catchup->mono = mono;
+		catchup->mono_len = len;
+	}
+
+	if (catchup->credit < max_lag)
+		max_lag = (unsigned int)catchup->credit;
+	lag = find_lag(catchup,
+		       samples,
+		       c,
+		       frame_count,
+		       sample_rate,
+		       min_lag,
+		       max_lag,
+		       &corr);
+	if (corr < ADEC_CATCHUP_MIN_CORR && !saturated)
+		return frame_count;
+
+	/* Crossfade the first period into the second one, then drop the
+	 * first period */
+	for (unsigned int i = 0; i < lag; i++) {
+		float w = (float)i / lag;
+		for (unsigned int ch = 0; ch < c; ch++) {
+			float a = samples[i * c + ch];
+			float b = samples[(i + lag) * c + ch];
+			samples[i * c + ch] = (int16_t)lrintf(a + w * (b - a));
+		}
+	}
+	memmove(&samples[lag * c],
+		&samples[2 * lag * c],
+		(size_t)(frame_count - 2 * lag) * c * sizeof(*samples));
+
+	catchup->credit -= lag;
+	catchup->delay_us -= (int64_t)lag * 1000000 / sample_rate;
+	atomic_fetch_add(&base->counters.catchup_frames, 1);
+	atomic_fetch_add(&base->counters.catchup_removed_samples, lag);
+
+	return frame_count - lag;
+}
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <time.h>
 #include <ulog.h>
@@ -45,4 +46,31 @@
 #include <audio-decode/adec_internal.h>
 #include <futils/futils.h>
 
+
+/**
+ * Get the size of the last output memory allocated by adec_output_get_mem(),
+ * the memory expected to be allocated for the next decoded frame (0 if none
+ * was allocated, the output memories being taken from a pool).
+ * To be called from the decoding thread.
+ *
+ * @param base: The base audio decoder.
+ *
+ * @return the size in bytes
+ */
+size_t adec_output_get_alloc_size(struct adec_decoder *base);
+
+
+/**
+ * Queue an output frame built by adec_output_push() for output on the loop
+ * thread.
+ * To be called from the decoding thread.
+ *
+ * @param pipeline: pipeline handle
+ * @param frame: The output frame (a new reference is taken).
+ *
+ * @return 0 on success, negative errno value in case of error
+ */
+int adec_pipeline_queue_output(struct adec_pipeline *pipeline,
+			       struct mbuf_audio_frame *frame);
+
 #endif /* !_ADEC_CORE_PRIV_H_ */
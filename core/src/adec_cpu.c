@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+
+/* Per-frame CPU time histogram: log2 buckets split in 8 linear sub-buckets
+ * (12.5% resolution), up to 2^40 ns (about 18 minutes) */
+#define ADEC_CPU_HIST_SUB_BITS 3
+#define ADEC_CPU_HIST_SUB (1 << ADEC_CPU_HIST_SUB_BITS)
+#define ADEC_CPU_HIST_MAX_BITS 40
+#define ADEC_CPU_HIST_SIZE                                                     \
+	((ADEC_CPU_HIST_MAX_BITS - ADEC_CPU_HIST_SUB_BITS + 1) *               \
+	 ADEC_CPU_HIST_SUB)
+
+
+struct adec_cpu_acct {
+	atomic_uint_least64_t total_ns;
+	atomic_uint_least64_t max_ns;
+	atomic_uint frame_count;
+	atomic_uint hist[ADEC_CPU_HIST_SIZE];
+};
+
+
+static unsigned int hist_index(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < ADEC_CPU_HIST_SUB)
+		return ns;
+	if (ns >> ADEC_CPU_HIST_MAX_BITS)
+		return ADEC_CPU_HIST_SIZE - 1;
+
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - ADEC_CPU_HIST_SUB_BITS + 1) * ADEC_CPU_HIST_SUB +
+	       ((ns >> (msb - ADEC_CPU_HIST_SUB_BITS)) &
+		(ADEC_CPU_HIST_SUB - 1));
+}
+
+
+/* Upper bound of a histogram bucket */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int shift, sub;
+
+	if (index < ADEC_CPU_HIST_SUB)
+		return index;
+
+	shift = index / ADEC_CPU_HIST_SUB - 1;
+	sub = index % ADEC_CPU_HIST_SUB;
+	return ((uint64_t)(ADEC_CPU_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+
+int adec_cpu_acct_new(struct adec_cpu_acct **ret_obj)
+{
+	struct adec_cpu_acct *acct;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+#ifndef CLOCK_THREAD_CPUTIME_ID
+	ULOGW("thread CPU clock not available, CPU accounting disabled");
+	return -ENOSYS;
+#endif /* !CLOCK_THREAD_CPUTIME_ID */
+
+	acct = calloc(1, sizeof(*acct));
+	if (acct == NULL)
+		return -ENOMEM;
+	atomic_init(&acct->total_ns, 0);
+	atomic_init(&acct->max_ns, 0);
+	atomic_init(&acct->frame_count, 0);
+	for (unsigned int i = 0; i < ADEC_CPU_HIST_SIZE; i++)
+		atomic_init(&acct->hist[i], 0);
+
+	*ret_obj = acct;
+	return 0;
+}
+
+
+void adec_cpu_acct_destroy(struct adec_cpu_acct *acct)
+{
+	free(acct);
+}
+
+
+uint64_t adec_cpu_acct_start(struct adec_decoder *base)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (base->cpu_acct == NULL)
+		return 0;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else /* !CLOCK_THREAD_CPUTIME_ID */
+	return 0;
+#endif /* !CLOCK_THREAD_CPUTIME_ID */
+}
+
+
+uint64_t adec_cpu_acct_elapsed(struct adec_decoder *base, uint64_t start)
+{
+	uint64_t now;
+
+	if (base->cpu_acct == NULL || start == 0)
+		return 0;
+
+	now = adec_cpu_acct_start(base);
+	return (now > start) ? now - start : 0;
+}
+
+
+void adec_cpu_acct_record(struct adec_decoder *base, uint64_t ns)
+{
+	struct adec_cpu_acct *acct = base->cpu_acct;
+
+	if (acct == NULL)
+		return;
+
+	/* Single writer (the thread decoding for this instance) */
+	atomic_fetch_add_explicit(&acct->total_ns, ns, memory_order_relaxed);
+	if (ns > atomic_load_explicit(&acct->max_ns, memory_order_relaxed))
+		atomic_store_explicit(&acct->max_ns, ns, memory_order_relaxed);
+	atomic_fetch_add_explicit(
+		&acct->hist[hist_index(ns)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(
+		&acct->frame_count, 1, memory_order_release);
+}
+
+
+int adec_cpu_acct_get(struct adec_cpu_acct *acct,
+		      struct adec_cpu_stats *stats)
+{
+	uint64_t p50, p90, p99, cumul = 0;
+	unsigned int count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(acct == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	memset(stats, 0, sizeof(*stats));
+	count = atomic_load_explicit(&acct->frame_count, memory_order_acquire);
+	stats->frame_count = count;
+	stats->total_ns =
+		atomic_load_explicit(&acct->total_ns, memory_order_relaxed);
+	stats->max_ns =
+		atomic_load_explicit(&acct->max_ns, memory_order_relaxed);
+	if (count == 0)
+		return 0;
+
+	/* Ranks of the percentiles, rounded up */
+	p50 = ((uint64_t)count * 50 + 99) / 100;
+	p90 = ((uint64_t)count * 90 + 99) / 100;
+	p99 = ((uint64_t)count * 99 + 99) / 100;
+	for (unsigned int i = 0; i < ADEC_CPU_HIST_SIZE; i++) {
+		uint64_t n = atomic_load_explicit(&acct->hist[i],
+						  memory_order_relaxed);
+		if (n == 0)
+			continue;
+		cumul += n;
+		if (stats->p50_ns == 0 && cumul >= p50)
+			stats->p50_ns = hist_value(i);
+		if (stats->p90_ns == 0 && cumul >= p90)
+			stats->p90_ns = hist_value(i);
+		if (stats->p99_ns == 0 && cumul >= p99) {
+			stats->p99_ns = hist_value(i);
+			break;
+		}
+	}
+	/* The bucket upper bounds can exceed the actual maximum */
+	if (stats->p50_ns > stats->max_ns)
+		stats->p50_ns = stats->max_ns;
+	if (stats->p90_ns > stats->max_ns)
+		stats->p90_ns = stats->max_ns;
+	if (stats->p99_ns > stats->max_ns)
+		stats->p99_ns = stats->max_ns;
+
+	return 0;
+}
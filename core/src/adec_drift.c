@@ -0,0 +1,344 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+
+/* PI controller gains, with the latency error in seconds: critically damped
+ * loop with a 40s time constant, slow enough for the pitch change to stay
+ * inaudible */
+#define ADEC_DRIFT_KP 0.05
+#define ADEC_DRIFT_KI (ADEC_DRIFT_KP * ADEC_DRIFT_KP / 4)
+
+/* Time constant of the latency measure low-pass filter in seconds, to
+ * smooth out the input arrival and playout report jitter */
+#define ADEC_DRIFT_FILTER_S 2.0
+
+#define ADEC_DRIFT_DEFAULT_MAX_PPM 1000
+
+/* Interpolation history: samples before the current position needed by the
+ * 4-tap interpolator */
+#define ADEC_DRIFT_HISTORY 3
+
+/* Fractional part of the resampler position */
+#define ADEC_DRIFT_FRAC_BITS 32
+#define ADEC_DRIFT_ONE ((uint64_t)1 << ADEC_DRIFT_FRAC_BITS)
+
+
+struct adec_drift {
+	/* Playout report and published status, protected by the mutex; the
+	 * playout report time is 0 until the first report */
+	pthread_mutex_t mutex;
+	uint64_t play_ts_us;
+	uint64_t play_time_us;
+	struct adec_drift_stats stats;
+
+	/* Controller state (decoding thread only); the target is 0 until
+	 * latched from the first measure if not configured */
+	uint64_t target_us;
+	double max_correction;
+	double latency_s;
+	double integral;
+	bool measured;
+
+	/* Resampler state (decoding thread only): position in the current
+	 * frame prefixed by the history, in ADEC_DRIFT_FRAC_BITS fixed point */
+	uint64_t pos;
+	bool primed;
+	unsigned int channel_count;
+	int16_t history[ADEC_DRIFT_HISTORY * ADEC_MAX_CHANNEL_COUNT];
+	int16_t *scratch;
+	size_t scratch_len;
+};
+
+
+int adec_drift_new(const struct adec_config *config,
+		   struct adec_drift **ret_obj)
+{
+	struct adec_drift *drift;
+	unsigned int max_ppm;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	drift = calloc(1, sizeof(*drift));
+	if (drift == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&drift->mutex, NULL);
+
+	max_ppm = config->drift_max_ppm;
+	if (max_ppm == 0)
+		max_ppm = ADEC_DRIFT_DEFAULT_MAX_PPM;
+	else if (max_ppm > ADEC_DRIFT_MAX_PPM)
+		max_ppm = ADEC_DRIFT_MAX_PPM;
+	drift->max_correction = max_ppm / 1e6;
+	drift->target_us = (uint64_t)config->drift_target_latency_ms * 1000;
+	drift->stats.target_latency_us = drift->target_us;
+
+	if (config->realtime) {
+		/* Sized for the largest frame: no allocation on the decoding
+		 * path */
+		drift->scratch_len =
+			ADEC_MAX_OUTPUT_FRAME_SIZE / sizeof(*drift->scratch) +
+			ADEC_DRIFT_HISTORY * ADEC_MAX_CHANNEL_COUNT;
+		drift->scratch =
+			malloc(drift->scratch_len * sizeof(*drift->scratch));
+		if (drift->scratch == NULL) {
+			adec_drift_destroy(drift);
+			return -ENOMEM;
+		}
+	}
+
+	*ret_obj = drift;
+	return 0;
+}
+
+
+void adec_drift_destroy(struct adec_drift *drift)
+{
+	if (drift == NULL)
+		return;
+
+	pthread_mutex_destroy(&drift->mutex);
+	free(drift->scratch);
+	free(drift);
+}
+
+
+void adec_drift_reset(struct adec_drift *drift)
+{
+	drift->primed = false;
+	drift->measured = false;
+	drift->integral = 0.;
+
+	pthread_mutex_lock(&drift->mutex);
+	/* The playout position is stale after a discarding flush */
+	drift->play_time_us = 0;
+	drift->stats.locked = 0;
+	drift->stats.correction_ppm = 0.f;
+	pthread_mutex_unlock(&drift->mutex);
+}
+
+
+void adec_drift_set_playout_time(struct adec_drift *drift,
+				 uint64_t timestamp_us)
+{
+	uint64_t now = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+
+	pthread_mutex_lock(&drift->mutex);
+	drift->play_ts_us = timestamp_us;
+	drift->play_time_us = now;
+	pthread_mutex_unlock(&drift->mutex);
+}
+
+
+/* Update the controller with the latency at the end of a frame of the given
+ * duration; returns the resampling correction */
+static double update_controller(struct adec_drift *drift,
+				uint64_t end_us,
+				double duration_s)
+{
+	uint64_t play_ts, play_time, now;
+	int64_t latency_us;
+	double alpha, error, correction, integral_max;
+
+	now = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+	pthread_mutex_lock(&drift->mutex);
+	play_ts = drift->play_ts_us;
+	play_time = drift->play_time_us;
+	pthread_mutex_unlock(&drift->mutex);
+	if (play_time == 0)
+		return 0.;
+
+	/* Extrapolate the playout position to now */
+	latency_us = (int64_t)(end_us - play_ts) - (int64_t)(now - play_time);
+
+	if (!drift->measured) {
+		drift->latency_s = latency_us / 1e6;
+		drift->measured = true;
+		if (drift->target_us == 0 && latency_us > 0) {
+			drift->target_us = latency_us;
+			ULOGI("drift compensation: latency set-point "
+			      "%" PRIu64 "us",
+			      drift->target_us);
+		}
+	} else {
+		alpha = duration_s / (ADEC_DRIFT_FILTER_S + duration_s);
+		drift->latency_s += alpha * (latency_us / 1e6 -
+					     drift->latency_s);
+	}
+
+	error = drift->latency_s - drift->target_us / 1e6;
+
+	/* Anti-windup: the integral term alone cannot exceed the maximum
+	 * correction */
+	integral_max = drift->max_correction / ADEC_DRIFT_KI;
+	drift->integral += error * duration_s;
+	if (drift->integral > integral_max)
+		drift->integral = integral_max;
+	else if (drift->integral < -integral_max)
+		drift->integral = -integral_max;
+
+	correction = ADEC_DRIFT_KP * error + ADEC_DRIFT_KI * drift->integral;
+	if (correction > drift->max_correction)
+		correction = drift->max_correction;
+	else if (correction < -drift->max_correction)
+		correction = -drift->max_correction;
+
+	pthread_mutex_lock(&drift->mutex);
+	drift->stats.locked = 1;
+	drift->stats.target_latency_us = drift->target_us;
+	drift->stats.latency_us = latency_us;
+	drift->stats.correction_ppm = correction * 1e6;
+	pthread_mutex_unlock(&drift->mutex);
+
+	return correction;
+}
+
+
+/* Catmull-Rom cubic interpolation between x0 and x1 */
+static inline int16_t
+interpolate(float xm1, float x0, float x1, float x2, float t)
+{
+	float y = x0 + 0.5f * t *
+			       (x1 - xm1 +
+				t * (2.f * xm1 - 5.f * x0 + 4.f * x1 - x2 +
+				     t * (3.f * (x0 - x1) + x2 - xm1)));
+	long v = lrintf(y);
+
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)v;
+}
+
+
+int adec_drift_process(struct adec_decoder *base,
+		       int16_t *samples,
+		       unsigned int channel_count,
+		       unsigned int frame_count,
+		       unsigned int sample_rate,
+		       uint64_t end_us)
+{
+	struct adec_drift *drift = base->drift;
+	const unsigned int c = channel_count;
+	size_t len;
+	uint64_t step, pos_end;
+	unsigned int out_count = 0;
+	double correction;
+
+	if (drift == NULL)
+		return frame_count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(samples == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(c == 0 || c > ADEC_MAX_CHANNEL_COUNT,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_rate == 0, EINVAL);
+	if (frame_count == 0)
+		return 0;
+
+	len = (size_t)(frame_count + ADEC_DRIFT_HISTORY) * c;
+	if (len > drift->scratch_len) {
+		int16_t *scratch = realloc(drift->scratch,
+					   len * sizeof(*scratch));
+		if (scratch == NULL)
+			return -ENOMEM;
+		drift->scratch = scratch;
+		drift->scratch_len = len;
+	}
+
+	if (!drift->primed || drift->channel_count != c) {
+		/* Start on the first sample, repeated as history */
+		for (unsigned int i = 0; i < ADEC_DRIFT_HISTORY; i++)
+			memcpy(&drift->history[i * c],
+			       samples,
+			       c * sizeof(*samples));
+		drift->pos = ADEC_DRIFT_ONE;
+		drift->channel_count = c;
+		drift->primed = true;
+	}
+
+	correction = update_controller(
+		drift, end_us, (double)frame_count / sample_rate);
+	step = (uint64_t)llround((1. + correction) * ADEC_DRIFT_ONE);
+
+	memcpy(drift->scratch,
+	       drift->history,
+	       ADEC_DRIFT_HISTORY * c * sizeof(*samples));
+	memcpy(&drift->scratch[ADEC_DRIFT_HISTORY * c],
+	       samples,
+	       (size_t)frame_count * c * sizeof(*samples));
+
+	/* The interpolator reads one sample before and two samples after the
+	 * integer position */
+	pos_end = (uint64_t)(frame_count + 1) << ADEC_DRIFT_FRAC_BITS;
+	while (drift->pos < pos_end &&
+	       out_count < frame_count + ADEC_DRIFT_MAX_EXTRA_SAMPLES) {
+		const int16_t *x0 = &drift->scratch
+			[(drift->pos >> ADEC_DRIFT_FRAC_BITS) * c];
+		const int16_t *xm1 = x0 - c;
+		const int16_t *x1 = x0 + c;
+		const int16_t *x2 = x1 + c;
+		float t = (float)(drift->pos & (ADEC_DRIFT_ONE - 1)) /
+			  ADEC_DRIFT_ONE;
+		int16_t *y = &samples[out_count * c];
+		for (unsigned int ch = 0; ch < c; ch++)
+			y[ch] = interpolate(xm1[ch], x0[ch], x1[ch], x2[ch], t);
+		out_count++;
+		drift->pos += step;
+	}
+	drift->pos -= (uint64_t)frame_count << ADEC_DRIFT_FRAC_BITS;
+
+	memcpy(drift->history,
+	       &drift->scratch[(size_t)frame_count * c],
+	       ADEC_DRIFT_HISTORY * c * sizeof(*samples));
+
+	pthread_mutex_lock(&drift->mutex);
+	drift->stats.sample_offset += (int64_t)out_count - frame_count;
+	pthread_mutex_unlock(&drift->mutex);
+
+	return out_count;
+}
+
+
+int adec_drift_get(struct adec_drift *drift, struct adec_drift_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(drift == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	pthread_mutex_lock(&drift->mutex);
+	*stats = drift->stats;
+	pthread_mutex_unlock(&drift->mutex);
+
+	return 0;
+}
@@ -34,6 +34,118 @@ const char *adec_decoder_implem_str(enum adec_decoder_implem implem)
 	switch (implem) {
 	case ADEC_DECODER_IMPLEM_FDK_AAC:
 		return "FDK_AAC";
+	case ADEC_DECODER_IMPLEM_NULL:
+		return "NULL";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_trace_event_type_str(enum adec_trace_event_type type)
+{
+	switch (type) {
+	case ADEC_TRACE_EVENT_INPUT:
+		return "INPUT";
+	case ADEC_TRACE_EVENT_DEQUEUE:
+		return "DEQUEUE";
+	case ADEC_TRACE_EVENT_DECODE_START:
+		return "DECODE_START";
+	case ADEC_TRACE_EVENT_DECODE_END:
+		return "DECODE_END";
+	case ADEC_TRACE_EVENT_OUTPUT:
+		return "OUTPUT";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_timing_mode_str(enum adec_timing_mode mode)
+{
+	switch (mode) {
+	case ADEC_TIMING_MODE_PRECISE:
+		return "PRECISE";
+	case ADEC_TIMING_MODE_COARSE:
+		return "COARSE";
+	case ADEC_TIMING_MODE_NONE:
+		return "NONE";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_drop_policy_str(enum adec_drop_policy policy)
+{
+	switch (policy) {
+	case ADEC_DROP_POLICY_OLDEST:
+		return "OLDEST";
+	case ADEC_DROP_POLICY_NEWEST:
+		return "NEWEST";
+	case ADEC_DROP_POLICY_SKIP_TO_LATEST:
+		return "SKIP_TO_LATEST";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_sched_policy_str(enum adec_sched_policy policy)
+{
+	switch (policy) {
+	case ADEC_SCHED_POLICY_DEFAULT:
+		return "DEFAULT";
+	case ADEC_SCHED_POLICY_FIFO:
+		return "FIFO";
+	case ADEC_SCHED_POLICY_RR:
+		return "RR";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_channel_str(enum adec_channel channel)
+{
+	switch (channel) {
+	case ADEC_CHANNEL_FRONT_LEFT:
+		return "FL";
+	case ADEC_CHANNEL_FRONT_RIGHT:
+		return "FR";
+	case ADEC_CHANNEL_FRONT_CENTER:
+		return "FC";
+	case ADEC_CHANNEL_LFE:
+		return "LFE";
+	case ADEC_CHANNEL_SIDE_LEFT:
+		return "SL";
+	case ADEC_CHANNEL_SIDE_RIGHT:
+		return "SR";
+	case ADEC_CHANNEL_BACK_LEFT:
+		return "BL";
+	case ADEC_CHANNEL_BACK_RIGHT:
+		return "BR";
+	case ADEC_CHANNEL_BACK_CENTER:
+		return "BC";
+	case ADEC_CHANNEL_TOP_LEFT:
+		return "TL";
+	case ADEC_CHANNEL_TOP_RIGHT:
+		return "TR";
+	case ADEC_CHANNEL_TOP_CENTER:
+		return "TC";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+
+const char *adec_channel_order_str(enum adec_channel_order order)
+{
+	switch (order) {
+	case ADEC_CHANNEL_ORDER_WAV:
+		return "WAV";
+	case ADEC_CHANNEL_ORDER_MPEG:
+		return "MPEG";
 	default:
 		return "UNKNOWN";
 	}
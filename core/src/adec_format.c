@@ -29,6 +29,31 @@
 #include <futils/timetools.h>
 
 
+uint64_t adec_get_time_us(enum adec_timing_mode mode)
+{
+	struct timespec cur_ts = {0, 0};
+	uint64_t ts_us = 0;
+
+	switch (mode) {
+	case ADEC_TIMING_MODE_NONE:
+		return 0;
+	case ADEC_TIMING_MODE_COARSE:
+#ifdef CLOCK_MONOTONIC_COARSE
+		if (clock_gettime(CLOCK_MONOTONIC_COARSE, &cur_ts) == 0)
+			break;
+#endif /* CLOCK_MONOTONIC_COARSE */
+		/* Fallback to the precise clock */
+		/* fallthrough */
+	default:
+		time_get_monotonic(&cur_ts);
+		break;
+	}
+
+	time_timespec_to_us(&cur_ts, &ts_us);
+	return ts_us;
+}
+
+
 void adec_call_frame_output_cb(struct adec_decoder *base,
 			       int status,
 			       struct mbuf_audio_frame *frame)
@@ -36,6 +61,13 @@ void adec_call_frame_output_cb(struct adec_decoder *base,
 	if (!base->cbs.frame_output)
 		return;
 
+	if (base->trace != NULL && status == 0 && frame != NULL) {
+		struct adef_frame info;
+		if (mbuf_audio_frame_get_frame_info(frame, &info) == 0)
+			adec_trace_record(
+				base, ADEC_TRACE_EVENT_OUTPUT, info.info.index);
+	}
+
 	base->cbs.frame_output(base, status, frame, base->userdata);
 	if (status == 0 && frame != NULL)
 		base->counters.out++;
@@ -131,20 +163,89 @@ void adec_default_input_filter_internal_confirm_frame(
 	struct mbuf_audio_frame *frame,
 	struct adef_frame *frame_info)
 {
-	int err;
-	uint64_t ts_us;
-	struct timespec cur_ts = {0, 0};
-
 	/* Save frame timestamp to last_timestamp */
 	uint_least64_t last_timestamp = frame_info->info.timestamp;
 	atomic_store(&decoder->last_timestamp, last_timestamp);
-	decoder->counters.in++;
+	atomic_fetch_add(&decoder->counters.in, 1);
+	adec_capture_record_frame(decoder, frame, frame_info);
+	adec_trace_record(
+		decoder, ADEC_TRACE_EVENT_INPUT, frame_info->info.index);
+}
 
-	/* Set the input time ancillary data to the frame */
-	time_get_monotonic(&cur_ts);
-	time_timespec_to_us(&cur_ts, &ts_us);
-	err = mbuf_audio_frame_add_ancillary_buffer(
-		frame, ADEC_ANCILLARY_KEY_INPUT_TIME, &ts_us, sizeof(ts_us));
-	if (err < 0)
-		ULOG_ERRNO("mbuf_audio_frame_add_ancillary_buffer", -err);
+
+struct ancillary_data_copier_ctx {
+	struct mbuf_audio_frame *out_frame;
+	int count;
+};
+
+
+static bool ancillary_data_copier(struct mbuf_ancillary_data *data,
+				  void *userdata)
+{
+	struct ancillary_data_copier_ctx *ctx = userdata;
+	const char *name = mbuf_ancillary_data_get_name(data);
+
+	/* Skip the library's own ancillary data */
+	if (name != NULL && strncmp(name,
+				    ADEC_ANCILLARY_KEY_PREFIX,
+				    strlen(ADEC_ANCILLARY_KEY_PREFIX)) == 0)
+		return true;
+
+	ctx->count++;
+	return mbuf_audio_frame_ancillary_data_copier(data, ctx->out_frame);
+}
+
+
+int adec_copy_ancillary_data(struct mbuf_audio_frame *in_frame,
+			     struct mbuf_audio_frame *out_frame)
+{
+	int ret;
+	struct ancillary_data_copier_ctx ctx = {
+		.out_frame = out_frame,
+		.count = 0,
+	};
+
+	ret = mbuf_audio_frame_foreach_ancillary_data(
+		in_frame, ancillary_data_copier, &ctx);
+	if (ret < 0)
+		return ret;
+
+	return ctx.count;
+}
+
+
+int adec_frame_set_timings(struct mbuf_audio_frame *frame,
+			   const struct adec_timings *timings)
+{
+	return mbuf_audio_frame_add_ancillary_buffer(
+		frame, ADEC_ANCILLARY_KEY_TIMINGS, timings, sizeof(*timings));
+}
+
+
+int adec_frame_get_timings(struct mbuf_audio_frame *frame,
+			   struct adec_timings *timings)
+{
+	int ret;
+	struct mbuf_ancillary_data *data;
+	const void *raw_data;
+	size_t len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(timings == NULL, EINVAL);
+
+	ret = mbuf_audio_frame_get_ancillary_data(
+		frame, ADEC_ANCILLARY_KEY_TIMINGS, &data);
+	if (ret < 0)
+		return ret;
+
+	raw_data = mbuf_ancillary_data_get_buffer(data, &len);
+	if (raw_data == NULL || len != sizeof(*timings)) {
+		ret = -EPROTO;
+		goto out;
+	}
+	memcpy(timings, raw_data, sizeof(*timings));
+
+out:
+	mbuf_ancillary_data_unref(data);
+	return ret;
 }
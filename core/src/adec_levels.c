@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <math.h>
+
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#	define ADEC_LEVELS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define ADEC_LEVELS_NEON
+#endif
+
+
+/* Per-channel accumulators; the peak is derived from the extrema so that the
+ * vector kernels do not have to deal with abs(INT16_MIN) */
+struct levels_acc {
+	int max[ADEC_MAX_CHANNEL_COUNT];
+	int min[ADEC_MAX_CHANNEL_COUNT];
+	uint64_t sum_sq[ADEC_MAX_CHANNEL_COUNT];
+};
+
+
+static void levels_scalar(const int16_t *samples,
+			  unsigned int channel_count,
+			  size_t frame_count,
+			  struct levels_acc *acc)
+{
+	for (size_t i = 0; i < frame_count; i++) {
+		for (unsigned int c = 0; c < channel_count; c++) {
+			int v = *samples++;
+			if (v > acc->max[c])
+				acc->max[c] = v;
+			if (v < acc->min[c])
+				acc->min[c] = v;
+			acc->sum_sq[c] += (uint64_t)(v * v);
+		}
+	}
+}
+
+
+#if defined(ADEC_LEVELS_SSE2)
+
+/* Mono or stereo interleaved samples, 8 samples per iteration; returns the
+ * number of frames processed */
+static size_t levels_simd(const int16_t *samples,
+			  unsigned int channel_count,
+			  size_t frame_count,
+			  struct levels_acc *acc)
+{
+	size_t n = frame_count * channel_count / 8;
+	const __m128i zero = _mm_setzero_si128();
+	/* Selects the left channel (low half of each 32-bit lane) */
+	const __m128i left = _mm_set1_epi32(0x0000ffff);
+	__m128i vmax = zero, vmin = zero;
+	__m128i acc0 = zero, acc1 = zero;
+	int16_t lmax[8], lmin[8];
+	uint64_t sum[2][2];
+
+	for (size_t i = 0; i < n; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i *)samples + i);
+		__m128i sq0, sq1;
+		vmax = _mm_max_epi16(vmax, x);
+		vmin = _mm_min_epi16(vmin, x);
+		if (channel_count == 1) {
+			/* Sums of two squares fit in an unsigned 32-bit */
+			sq0 = _mm_madd_epi16(x, x);
+			acc0 = _mm_add_epi64(acc0,
+					     _mm_unpacklo_epi32(sq0, zero));
+			acc0 = _mm_add_epi64(acc0,
+					     _mm_unpackhi_epi32(sq0, zero));
+		} else {
+			sq0 = _mm_madd_epi16(x, _mm_and_si128(x, left));
+			sq1 = _mm_madd_epi16(x, _mm_andnot_si128(left, x));
+			acc0 = _mm_add_epi64(acc0,
+					     _mm_unpacklo_epi32(sq0, zero));
+			acc0 = _mm_add_epi64(acc0,
+					     _mm_unpackhi_epi32(sq0, zero));
+			acc1 = _mm_add_epi64(acc1,
+					     _mm_unpacklo_epi32(sq1, zero));
+			acc1 = _mm_add_epi64(acc1,
+					     _mm_unpackhi_epi32(sq1, zero));
+		}
+	}
+
+	_mm_storeu_si128((__m128i *)lmax, vmax);
+	_mm_storeu_si128((__m128i *)lmin, vmin);
+	_mm_storeu_si128((__m128i *)sum[0], acc0);
+	_mm_storeu_si128((__m128i *)sum[1], acc1);
+	for (unsigned int i = 0; i < 8; i++) {
+		unsigned int c = i % channel_count;
+		if (lmax[i] > acc->max[c])
+			acc->max[c] = lmax[i];
+		if (lmin[i] < acc->min[c])
+			acc->min[c] = lmin[i];
+	}
+	for (unsigned int c = 0; c < channel_count; c++)
+		acc->sum_sq[c] += sum[c][0] + sum[c][1];
+
+	return n * 8 / channel_count;
+}
+
+#elif defined(ADEC_LEVELS_NEON)
+
+/* Mono or stereo interleaved samples, 8 frames per iteration; returns the
+ * number of frames processed */
+static size_t levels_simd(const int16_t *samples,
+			  unsigned int channel_count,
+			  size_t frame_count,
+			  struct levels_acc *acc)
+{
+	size_t n = frame_count / 8;
+	int16x8_t vmax[2], vmin[2];
+	uint64x2_t vsum[2];
+	int16_t lmax[8], lmin[8];
+	uint64_t sum[2];
+
+	for (unsigned int c = 0; c < channel_count; c++) {
+		vmax[c] = vdupq_n_s16(0);
+		vmin[c] = vdupq_n_s16(0);
+		vsum[c] = vdupq_n_u64(0);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		int16x8x2_t x;
+		if (channel_count == 1)
+			x.val[0] = vld1q_s16(samples + 8 * i);
+		else
+			x = vld2q_s16(samples + 16 * i);
+		for (unsigned int c = 0; c < channel_count; c++) {
+			int16x4_t lo = vget_low_s16(x.val[c]);
+			int16x4_t hi = vget_high_s16(x.val[c]);
+			vmax[c] = vmaxq_s16(vmax[c], x.val[c]);
+			vmin[c] = vminq_s16(vmin[c], x.val[c]);
+			/* Squares fit in an unsigned 32-bit */
+			vsum[c] = vpadalq_u32(
+				vsum[c],
+				vreinterpretq_u32_s32(vmull_s16(lo, lo)));
+			vsum[c] = vpadalq_u32(
+				vsum[c],
+				vreinterpretq_u32_s32(vmull_s16(hi, hi)));
+		}
+	}
+
+	for (unsigned int c = 0; c < channel_count; c++) {
+		vst1q_s16(lmax, vmax[c]);
+		vst1q_s16(lmin, vmin[c]);
+		vst1q_u64(sum, vsum[c]);
+		for (unsigned int i = 0; i < 8; i++) {
+			if (lmax[i] > acc->max[c])
+				acc->max[c] = lmax[i];
+			if (lmin[i] < acc->min[c])
+				acc->min[c] = lmin[i];
+		}
+		acc->sum_sq[c] += sum[0] + sum[1];
+	}
+
+	return n * 8;
+}
+
+#endif
+
+
+int adec_levels_compute(const int16_t *samples,
+			unsigned int channel_count,
+			size_t frame_count,
+			unsigned int silence_threshold,
+			struct adec_levels *levels)
+{
+	struct levels_acc acc;
+	size_t done = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(samples == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(levels == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(channel_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(channel_count > ADEC_MAX_CHANNEL_COUNT,
+				 EINVAL);
+
+	memset(&acc, 0, sizeof(acc));
+
+#if defined(ADEC_LEVELS_SSE2) || defined(ADEC_LEVELS_NEON)
+	if (channel_count <= 2)
+		done = levels_simd(samples, channel_count, frame_count, &acc);
+#endif
+	levels_scalar(samples + done * channel_count,
+		      channel_count,
+		      frame_count - done,
+		      &acc);
+
+	memset(levels, 0, sizeof(*levels));
+	levels->channel_count = channel_count;
+	levels->silent = 1;
+	for (unsigned int c = 0; c < channel_count; c++) {
+		unsigned int peak = acc.max[c];
+		if ((unsigned int)-acc.min[c] > peak)
+			peak = -acc.min[c];
+		levels->peak[c] = peak;
+		if (frame_count > 0) {
+			float ms = (float)acc.sum_sq[c] / frame_count;
+			levels->rms[c] = sqrtf(ms) / 32768.f;
+		}
+		if (peak > silence_threshold)
+			levels->silent = 0;
+	}
+
+	return 0;
+}
+
+
+int adec_frame_set_levels(struct mbuf_audio_frame *frame,
+			  const struct adec_levels *levels)
+{
+	return mbuf_audio_frame_add_ancillary_buffer(
+		frame, ADEC_ANCILLARY_KEY_LEVELS, levels, sizeof(*levels));
+}
+
+
+int adec_frame_get_levels(struct mbuf_audio_frame *frame,
+			  struct adec_levels *levels)
+{
+	int ret;
+	struct mbuf_ancillary_data *data;
+	const void *raw_data;
+	size_t len;
+
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(levels == NULL, EINVAL);
+
+	ret = mbuf_audio_frame_get_ancillary_data(
+		frame, ADEC_ANCILLARY_KEY_LEVELS, &data);
+	if (ret < 0)
+		return ret;
+
+	raw_data = mbuf_ancillary_data_get_buffer(data, &len);
+	if (raw_data == NULL || len != sizeof(*levels)) {
+		ret = -EPROTO;
+		goto out;
+	}
+	memcpy(levels, raw_data, sizeof(*levels));
+
+out:
+	mbuf_ancillary_data_unref(data);
+	return ret;
+}
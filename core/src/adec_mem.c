@@ -0,0 +1,330 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <media-buffers/mbuf_mem_generic.h>
+
+
+struct adec_mem_group {
+	/* Budget in bytes, 0 means unlimited */
+	atomic_size_t budget;
+	atomic_size_t used;
+	/* Number of live accounts (attached decoders, and destroyed decoders
+	 * whose output memories are still referenced) */
+	atomic_uint members;
+};
+
+
+/* Memory accounted for a decoder; it outlives the decoder while output
+ * memories allocated with adec_mem_alloc() are still referenced */
+struct adec_mem_account {
+	struct adec_mem_group *group;
+	atomic_size_t bytes[ADEC_MEM_KIND_COUNT];
+	/* References: the decoder and each allocated output memory */
+	atomic_uint refs;
+	/* Called when an output memory is released, until the decoder is
+	 * detached (protected by mutex) */
+	pthread_mutex_t mutex;
+	void (*release_cb)(void *userdata);
+	void *userdata;
+};
+
+
+/* Process-wide group of the decoders without a mem_group, unlimited unless
+ * set with adec_mem_group_set_budget() */
+static struct adec_mem_group s_default_group;
+
+
+int adec_mem_group_new(size_t budget, struct adec_mem_group **ret_obj)
+{
+	struct adec_mem_group *group;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	group = calloc(1, sizeof(*group));
+	if (group == NULL)
+		return -ENOMEM;
+	atomic_init(&group->budget, budget);
+	atomic_init(&group->used, 0);
+	atomic_init(&group->members, 0);
+
+	*ret_obj = group;
+	return 0;
+}
+
+
+int adec_mem_group_destroy(struct adec_mem_group *group)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(group == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(group == &s_default_group, EINVAL);
+
+	if (atomic_load(&group->members) != 0) {
+		ULOGE("%s: %u decoder(s) still accounted",
+		      __func__,
+		      atomic_load(&group->members));
+		return -EBUSY;
+	}
+
+	free(group);
+	return 0;
+}
+
+
+int adec_mem_group_set_budget(struct adec_mem_group *group, size_t budget)
+{
+	if (group == NULL)
+		group = &s_default_group;
+
+	atomic_store(&group->budget, budget);
+
+	return 0;
+}
+
+
+size_t adec_mem_group_get_usage(struct adec_mem_group *group)
+{
+	if (group == NULL)
+		group = &s_default_group;
+
+	return atomic_load(&group->used);
+}
+
+
+static void account_release(struct adec_mem_account *account,
+			    enum adec_mem_kind kind,
+			    size_t size)
+{
+	atomic_fetch_sub(&account->bytes[kind], size);
+	atomic_fetch_sub(&account->group->used, size);
+}
+
+
+static void account_unref(struct adec_mem_account *account)
+{
+	if (atomic_fetch_sub(&account->refs, 1) != 1)
+		return;
+
+	atomic_fetch_sub(&account->group->members, 1);
+	pthread_mutex_destroy(&account->mutex);
+	free(account);
+}
+
+
+int adec_mem_attach(struct adec_decoder *base)
+{
+	struct adec_mem_account *account;
+	struct adec_mem_group *group = base->config.mem_group;
+
+	if (group == NULL)
+		group = &s_default_group;
+
+	account = calloc(1, sizeof(*account));
+	if (account == NULL)
+		return -ENOMEM;
+	account->group = group;
+	for (unsigned int i = 0; i < ADEC_MEM_KIND_COUNT; i++)
+		atomic_init(&account->bytes[i], 0);
+	atomic_init(&account->refs, 1);
+	pthread_mutex_init(&account->mutex, NULL);
+	atomic_fetch_add(&group->members, 1);
+	base->mem_account = account;
+
+	return 0;
+}
+
+
+void adec_mem_detach(struct adec_decoder *base)
+{
+	struct adec_mem_account *account = base->mem_account;
+	size_t size;
+
+	if (account == NULL)
+		return;
+
+	/* The allocated output memories stay accounted until released */
+	for (unsigned int i = 0; i < ADEC_MEM_KIND_COUNT; i++) {
+		if (i == ADEC_MEM_OUTPUT)
+			continue;
+		size = atomic_exchange(&account->bytes[i], 0);
+		atomic_fetch_sub(&account->group->used, size);
+	}
+	pthread_mutex_lock(&account->mutex);
+	account->release_cb = NULL;
+	account->userdata = NULL;
+	pthread_mutex_unlock(&account->mutex);
+	base->mem_account = NULL;
+	account_unref(account);
+}
+
+
+int adec_mem_charge(struct adec_decoder *base,
+		    enum adec_mem_kind kind,
+		    size_t size,
+		    int force)
+{
+	struct adec_mem_account *account = base->mem_account;
+	struct adec_mem_group *group;
+	size_t used, budget;
+
+	ULOG_ERRNO_RETURN_ERR_IF(kind >= ADEC_MEM_KIND_COUNT, EINVAL);
+
+	if (account == NULL)
+		return 0;
+	group = account->group;
+
+	budget = atomic_load(&group->budget);
+	used = atomic_load(&group->used);
+	do {
+		if (!force && budget != 0 && used + size > budget)
+			return -ENOBUFS;
+	} while (!atomic_compare_exchange_weak(
+		&group->used, &used, used + size));
+	atomic_fetch_add(&account->bytes[kind], size);
+
+	return 0;
+}
+
+
+void adec_mem_release(struct adec_decoder *base,
+		      enum adec_mem_kind kind,
+		      size_t size)
+{
+	struct adec_mem_account *account = base->mem_account;
+
+	if (account == NULL || kind >= ADEC_MEM_KIND_COUNT)
+		return;
+
+	account_release(account, kind, size);
+}
+
+
+bool adec_mem_over_budget(struct adec_decoder *base, size_t size)
+{
+	struct adec_mem_account *account = base->mem_account;
+	size_t budget;
+
+	if (account == NULL)
+		return false;
+
+	budget = atomic_load(&account->group->budget);
+	return budget != 0 &&
+	       atomic_load(&account->group->used) + size > budget;
+}
+
+
+static void mem_release_cb(void *data, size_t len, void *userdata)
+{
+	struct adec_mem_account *account = userdata;
+
+	free(data);
+	account_release(account, ADEC_MEM_OUTPUT, len);
+
+	pthread_mutex_lock(&account->mutex);
+	if (account->release_cb != NULL)
+		account->release_cb(account->userdata);
+	pthread_mutex_unlock(&account->mutex);
+
+	account_unref(account);
+}
+
+
+int adec_mem_alloc(struct adec_decoder *base,
+		   size_t size,
+		   struct mbuf_mem **mem)
+{
+	int ret;
+	void *data;
+	struct adec_mem_account *account = base->mem_account;
+
+	if (account == NULL)
+		return mbuf_mem_generic_new(size, mem);
+
+	/* Always accounted: the decoding is paused beforehand when the memory
+	 * budget is reached, see adec_mem_over_budget() */
+	(void)adec_mem_charge(base, ADEC_MEM_OUTPUT, size, 1);
+	data = malloc(size);
+	if (data == NULL) {
+		account_release(account, ADEC_MEM_OUTPUT, size);
+		return -ENOMEM;
+	}
+	atomic_fetch_add(&account->refs, 1);
+	ret = mbuf_mem_generic_wrap(data, size, &mem_release_cb, account, mem);
+	if (ret < 0) {
+		free(data);
+		account_release(account, ADEC_MEM_OUTPUT, size);
+		account_unref(account);
+		return ret;
+	}
+
+	return 0;
+}
+
+
+void adec_mem_set_release_cb(struct adec_decoder *base,
+			     void (*cb)(void *userdata),
+			     void *userdata)
+{
+	struct adec_mem_account *account = base->mem_account;
+
+	if (account == NULL)
+		return;
+
+	pthread_mutex_lock(&account->mutex);
+	account->release_cb = cb;
+	account->userdata = userdata;
+	pthread_mutex_unlock(&account->mutex);
+}
+
+
+int adec_mem_get_usage(struct adec_decoder *base,
+		       struct adec_memory_usage *usage)
+{
+	struct adec_mem_account *account = base->mem_account;
+
+	ULOG_ERRNO_RETURN_ERR_IF(usage == NULL, EINVAL);
+
+	memset(usage, 0, sizeof(*usage));
+	if (account == NULL)
+		return 0;
+
+	usage->in_queue_bytes =
+		atomic_load(&account->bytes[ADEC_MEM_IN_QUEUE]);
+	usage->output_bytes = atomic_load(&account->bytes[ADEC_MEM_OUTPUT]);
+	usage->pool_bytes = atomic_load(&account->bytes[ADEC_MEM_POOL]);
+	usage->total_bytes = usage->in_queue_bytes + usage->output_bytes +
+			     usage->pool_bytes;
+	usage->group_bytes = atomic_load(&account->group->used);
+	usage->group_budget_bytes = atomic_load(&account->group->budget);
+
+	return 0;
+}
@@ -0,0 +1,725 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <string.h>
+
+#include <libpomp.h>
+#include <media-buffers/mbuf_mem.h>
+#include <media-buffers/mbuf_mem_generic.h>
+
+
+/* Number of preallocated output memories for real-time decoding if the
+ * preferred_min_out_buf_count configuration field is not set */
+#define ADEC_OUTPUT_DEFAULT_MEM_COUNT 10
+
+/* Number of blank output frames kept ready for the decoding thread in
+ * real-time mode (power of 2) */
+#define ADEC_OUTPUT_STOCK_SIZE 16
+
+/* Maximum number of frames waiting to be released on the loop thread in
+ * real-time mode (power of 2) */
+#define ADEC_OUTPUT_TRASH_SIZE 64
+
+
+/* Single producer, single consumer ring of frames */
+struct adec_frame_ring {
+	struct mbuf_audio_frame **slots;
+	unsigned int size;
+	atomic_uint read;
+	atomic_uint write;
+};
+
+
+struct adec_output {
+	struct adec_decoder *base;
+	/* Preallocated output memories (real-time decoding, unless the
+	 * application supplies them) */
+	struct mbuf_pool *pool;
+	size_t mem_size;
+	/* Memory accounted as ADEC_MEM_POOL (pool and scratch memory) */
+	size_t pool_bytes;
+	/* Size of the last allocated output memory (decoding thread only) */
+	size_t alloc_size;
+
+	/* Real-time decoding only: */
+	/* Memory decoded into when no output memory is available, the frame
+	 * is then dropped */
+	struct mbuf_mem *scratch;
+	/* Blank output frames created on the loop thread and taken by the
+	 * decoding thread */
+	struct adec_frame_ring stock;
+	struct mbuf_audio_frame *stock_slots[ADEC_OUTPUT_STOCK_SIZE];
+	/* Frames released by the decoding thread (input frames and its own
+	 * reference to the output frames), unreferenced on the loop thread */
+	struct adec_frame_ring trash;
+	struct mbuf_audio_frame *trash_slots[ADEC_OUTPUT_TRASH_SIZE];
+	/* Signaled by the decoding thread to refill the stock and empty the
+	 * trash */
+	struct pomp_evt *evt;
+
+	/* Output timeline (decoding thread only): samples per channel emitted
+	 * minus decoded since the last reset, negative when the latency
+	 * catch-up removed samples and positive when the drift compensation
+	 * added samples; the output timestamps are the decoded timestamps
+	 * shifted by this offset */
+	int64_t ts_offset;
+	unsigned int ts_sample_rate;
+};
+
+
+static bool ring_put(struct adec_frame_ring *ring,
+		     struct mbuf_audio_frame *frame)
+{
+	unsigned int w = atomic_load_explicit(&ring->write,
+					      memory_order_relaxed);
+	unsigned int r =
+		atomic_load_explicit(&ring->read, memory_order_acquire);
+
+	if (w - r == ring->size)
+		return false;
+	ring->slots[w & (ring->size - 1)] = frame;
+	atomic_store_explicit(&ring->write, w + 1, memory_order_release);
+	return true;
+}
+
+
+static struct mbuf_audio_frame *ring_get(struct adec_frame_ring *ring)
+{
+	struct mbuf_audio_frame *frame;
+	unsigned int r =
+		atomic_load_explicit(&ring->read, memory_order_relaxed);
+	unsigned int w = atomic_load_explicit(&ring->write,
+					      memory_order_acquire);
+
+	if (r == w)
+		return NULL;
+	frame = ring->slots[r & (ring->size - 1)];
+	atomic_store_explicit(&ring->read, r + 1, memory_order_release);
+	return frame;
+}
+
+
+static void ring_init(struct adec_frame_ring *ring,
+		      struct mbuf_audio_frame **slots,
+		      unsigned int size)
+{
+	ring->slots = slots;
+	ring->size = size;
+	atomic_init(&ring->read, 0);
+	atomic_init(&ring->write, 0);
+}
+
+
+static void ring_clear(struct adec_frame_ring *ring)
+{
+	struct mbuf_audio_frame *frame;
+
+	while ((frame = ring_get(ring)) != NULL)
+		mbuf_audio_frame_unref(frame);
+}
+
+
+/* Attach the blank timings and levels records of a stock frame, filled in
+ * place by the decoding thread (see fill_record()) */
+static int add_records(struct adec_output *output,
+		       struct mbuf_audio_frame *frame)
+{
+	int ret;
+	struct adec_decoder *self = output->base;
+	struct adec_timings timings = {0};
+	struct adec_levels levels = {0};
+
+	if (self->config.timing_mode != ADEC_TIMING_MODE_NONE) {
+		ret = adec_frame_set_timings(frame, &timings);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_frame_set_timings", -ret);
+			return ret;
+		}
+	}
+	if (self->config.levels) {
+		ret = adec_frame_set_levels(frame, &levels);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_frame_set_levels", -ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Called on the loop thread */
+static void maintain(struct adec_output *output)
+{
+	int ret;
+	struct adec_decoder *self = output->base;
+	struct adef_frame blank = {0};
+	struct mbuf_audio_frame *frame;
+	unsigned int count;
+
+	ring_clear(&output->trash);
+
+	count = atomic_load(&output->stock.write) -
+		atomic_load(&output->stock.read);
+	for (; count < output->stock.size; count++) {
+		/* The frame info is set by the decoding thread */
+		ret = mbuf_audio_frame_new(&blank, &frame);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_audio_frame_new", -ret);
+			return;
+		}
+		ret = add_records(output, frame);
+		if (ret < 0 || !ring_put(&output->stock, frame)) {
+			mbuf_audio_frame_unref(frame);
+			return;
+		}
+	}
+}
+
+
+static void evt_cb(struct pomp_evt *evt, void *userdata)
+{
+	maintain(userdata);
+}
+
+
+static int realtime_init(struct adec_output *output)
+{
+	int ret;
+	struct adec_decoder *self = output->base;
+
+	ring_init(&output->stock, output->stock_slots, ADEC_OUTPUT_STOCK_SIZE);
+	ring_init(&output->trash, output->trash_slots, ADEC_OUTPUT_TRASH_SIZE);
+
+	ret = adec_mem_charge(self, ADEC_MEM_POOL, output->mem_size, 0);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_mem_charge:scratch", -ret);
+		return ret;
+	}
+	output->pool_bytes += output->mem_size;
+	ret = mbuf_mem_generic_new(output->mem_size, &output->scratch);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_mem_generic_new:scratch", -ret);
+		return ret;
+	}
+
+	output->evt = pomp_evt_new();
+	if (output->evt == NULL) {
+		ret = -ENOMEM;
+		ADEC_LOG_ERRNO("pomp_evt_new", -ret);
+		return ret;
+	}
+	ret = pomp_evt_attach_to_loop(output->evt, self->loop, evt_cb, output);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop", -ret);
+		pomp_evt_destroy(output->evt);
+		output->evt = NULL;
+		return ret;
+	}
+
+	maintain(output);
+	return 0;
+}
+
+
+int adec_output_new(struct adec_decoder *base,
+		    size_t mem_size,
+		    struct adec_output **ret_obj)
+{
+	int ret;
+	struct adec_output *output;
+	struct adec_decoder *self = base;
+	unsigned int count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(mem_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	output = calloc(1, sizeof(*output));
+	if (output == NULL)
+		return -ENOMEM;
+	output->base = base;
+	output->mem_size = mem_size;
+
+	/* Preallocate the output memories for real-time decoding, unless the
+	 * application supplies them */
+	if (base->config.realtime && base->config.output_pool == NULL &&
+	    base->config.output_shm == NULL) {
+		count = base->config.preferred_min_out_buf_count;
+		if (count == 0)
+			count = ADEC_OUTPUT_DEFAULT_MEM_COUNT;
+		ret = adec_mem_charge(base, ADEC_MEM_POOL, mem_size * count, 0);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_mem_charge:output", -ret);
+			goto error;
+		}
+		output->pool_bytes += mem_size * count;
+		ret = mbuf_pool_new(mbuf_mem_generic_impl,
+				    mem_size,
+				    count,
+				    MBUF_POOL_NO_GROW,
+				    count,
+				    "adec_out_pool",
+				    &output->pool);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_pool_new:output", -ret);
+			output->pool = NULL;
+			goto error;
+		}
+	}
+
+	if (base->config.realtime) {
+		ret = realtime_init(output);
+		if (ret < 0)
+			goto error;
+	}
+
+	*ret_obj = output;
+	return 0;
+
+error:
+	adec_output_destroy(output);
+	return ret;
+}
+
+
+void adec_output_destroy(struct adec_output *output)
+{
+	int err;
+	struct adec_decoder *self;
+
+	if (output == NULL)
+		return;
+	self = output->base;
+
+	if (output->evt != NULL) {
+		err = pomp_evt_detach_from_loop(output->evt, self->loop);
+		if (err < 0)
+			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop", -err);
+		err = pomp_evt_destroy(output->evt);
+		if (err < 0)
+			ADEC_LOG_ERRNO("pomp_evt_destroy", -err);
+	}
+	if (output->stock.slots != NULL) {
+		ring_clear(&output->stock);
+		ring_clear(&output->trash);
+	}
+	if (output->scratch != NULL) {
+		err = mbuf_mem_unref(output->scratch);
+		if (err < 0)
+			ADEC_LOG_ERRNO("mbuf_mem_unref:scratch", -err);
+	}
+
+	if (output->pool != NULL) {
+		err = mbuf_pool_destroy(output->pool);
+		if (err < 0)
+			ADEC_LOG_ERRNO("mbuf_pool_destroy:output", -err);
+	}
+	adec_mem_release(self, ADEC_MEM_POOL, output->pool_bytes);
+
+	free(output);
+}
+
+
+/* Real-time decoding: drop the decoding thread reference to a frame on the
+ * loop thread, so that the frame is not freed on the decoding thread */
+static int release_frame(struct adec_output *output,
+			 struct mbuf_audio_frame *frame)
+{
+	if (output != NULL && output->evt != NULL &&
+	    ring_put(&output->trash, frame)) {
+		(void)pomp_evt_signal(output->evt);
+		return 0;
+	}
+	return mbuf_audio_frame_unref(frame);
+}
+
+
+/* Real-time decoding: no output memory available, the frame is decoded into
+ * the scratch memory and dropped instead of allocating (and logging) on the
+ * decoding thread */
+static bool get_scratch_mem(struct adec_output *output,
+			    size_t size,
+			    struct mbuf_mem **mem)
+{
+	if (output == NULL || output->scratch == NULL ||
+	    size > output->mem_size)
+		return false;
+	mbuf_mem_ref(output->scratch);
+	*mem = output->scratch;
+	return true;
+}
+
+
+int adec_output_get_mem(struct adec_decoder *base,
+			size_t size,
+			struct mbuf_mem **mem)
+{
+	int ret;
+	void *data;
+	size_t capacity = 0;
+	struct adec_decoder *self = base;
+	struct adec_output *output = base->output;
+	struct mbuf_pool *pool = base->config.output_pool;
+
+	if (base->config.output_shm != NULL) {
+		ret = adec_shm_get_mem(base->config.output_shm, size, mem);
+		if (ret == 0)
+			return 0;
+		if (get_scratch_mem(output, size, mem))
+			return 0;
+		ADEC_LOGW_ERRNO("adec_shm_get_mem", -ret);
+		pool = NULL;
+	}
+
+	/* Application pool first, then the real-time pool */
+	if (pool == NULL && base->output != NULL)
+		pool = base->output->pool;
+	if (pool != NULL) {
+		ret = mbuf_pool_get(pool, mem);
+		if (ret == 0) {
+			ret = mbuf_mem_get_data(*mem, &data, &capacity);
+			if (ret == 0 && capacity >= size)
+				return 0;
+			ADEC_LOGW("output memory too small (%zu < %zu)",
+				  capacity,
+				  size);
+			mbuf_mem_unref(*mem);
+			*mem = NULL;
+		} else if (get_scratch_mem(output, size, mem)) {
+			return 0;
+		} else {
+			/* Pool exhausted: the application holds too many
+			 * output frames, fallback to allocating */
+			ADEC_LOGW_ERRNO("mbuf_pool_get:output", -ret);
+		}
+	}
+
+	ret = adec_mem_alloc(base, size, mem);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_mem_alloc", -ret);
+		return ret;
+	}
+	base->counters.out_mem_allocs++;
+	if (output != NULL)
+		output->alloc_size = size;
+
+	return 0;
+}
+
+
+size_t adec_output_get_alloc_size(struct adec_decoder *base)
+{
+	return (base->output != NULL) ? base->output->alloc_size : 0;
+}
+
+
+uint64_t adec_frame_time_us(const struct adef_frame_info *info)
+{
+	if (info->timescale == 0)
+		return 0;
+	return info->timestamp * 1000000 / info->timescale;
+}
+
+
+bool adec_in_queue_over_limits(const struct adec_config *config,
+			       unsigned int count,
+			       uint64_t head_time,
+			       uint64_t newest_time)
+{
+	if (config->max_in_queue_count > 0 &&
+	    count > config->max_in_queue_count)
+		return true;
+	if (config->max_in_queue_duration_ms == 0 || newest_time <= head_time)
+		return false;
+	return newest_time - head_time >
+	       (uint64_t)config->max_in_queue_duration_ms * 1000;
+}
+
+
+/* Shift a decoded frame timestamp to the output timeline */
+static void shift_timestamp(struct adec_output *output,
+			    struct adef_frame *info,
+			    unsigned int sample_rate)
+{
+	int64_t delta;
+
+	if (output->ts_sample_rate != sample_rate) {
+		output->ts_offset = 0;
+		output->ts_sample_rate = sample_rate;
+	}
+	if (output->ts_offset == 0 || info->info.timescale == 0)
+		return;
+
+	delta = output->ts_offset * (int64_t)info->info.timescale /
+		sample_rate;
+	if (delta < 0 && (uint64_t)-delta > info->info.timestamp)
+		info->info.timestamp = 0;
+	else
+		info->info.timestamp += delta;
+}
+
+
+/* Write a record attached by add_records() in place: the frame is not
+ * shared yet and the record buffer is its own copy, so this does not
+ * allocate unlike attaching a new ancillary data */
+static int fill_record(struct mbuf_audio_frame *frame,
+		       const char *key,
+		       const void *data,
+		       size_t len)
+{
+	int ret;
+	struct mbuf_ancillary_data *anc;
+	const void *buf;
+	size_t buf_len = 0;
+
+	ret = mbuf_audio_frame_get_ancillary_data(frame, key, &anc);
+	if (ret < 0)
+		return ret;
+	buf = mbuf_ancillary_data_get_buffer(anc, &buf_len);
+	if (buf != NULL && buf_len == len)
+		memcpy((void *)buf, data, len);
+	else
+		ret = -EPROTO;
+	mbuf_ancillary_data_unref(anc);
+
+	return ret;
+}
+
+
+int adec_output_push(struct adec_decoder *base,
+		     struct mbuf_audio_frame *in_frame,
+		     struct adef_frame *info,
+		     struct mbuf_mem *mem,
+		     unsigned int frame_count,
+		     struct adec_timings *timings)
+{
+	int ret, err;
+	struct adec_decoder *self = base;
+	struct adec_output *output = base->output;
+	const struct adec_config *config = &base->config;
+	unsigned int channels = info->format.channel_count;
+	unsigned int sample_rate = info->format.sample_rate;
+	unsigned int out_count = frame_count;
+	struct mbuf_audio_frame *out_frame = NULL;
+	bool stocked = false;
+	struct adec_levels levels;
+	uint64_t end_us, arrival_us, src_us;
+	size_t mem_size, out_size;
+	int16_t *data;
+
+	if (output != NULL && mem == output->scratch) {
+		base->counters.out_dropped++;
+		return 0;
+	}
+
+	ret = mbuf_mem_get_data(mem, (void **)&data, &mem_size);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_mem_get_data", -ret);
+		return ret;
+	}
+
+	if (config->levels) {
+		/* Measure while the samples are still hot in cache */
+		ret = adec_levels_compute(data,
+					  channels,
+					  frame_count,
+					  config->silence_threshold,
+					  &levels);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_levels_compute", -ret);
+			return ret;
+		}
+		if (levels.silent && config->drop_silent) {
+			base->counters.silent_dropped++;
+			return 0;
+		}
+	}
+
+	/* The latency catch-up measures the delay on the decoded
+	 * timestamps */
+	src_us = adec_frame_time_us(&info->info);
+	if (output != NULL && (base->catchup != NULL || base->drift != NULL))
+		shift_timestamp(output, info, sample_rate);
+
+	if (base->catchup != NULL) {
+		arrival_us = timings->input_time;
+		if (arrival_us == 0)
+			arrival_us = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+		ret = adec_catchup_process(base,
+					   data,
+					   channels,
+					   out_count,
+					   sample_rate,
+					   src_us,
+					   arrival_us);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_catchup_process", -ret);
+			return ret;
+		}
+		out_count = ret;
+	}
+
+	if (base->drift != NULL) {
+		if (mem_size < (size_t)(frame_count +
+					ADEC_DRIFT_MAX_EXTRA_SAMPLES) *
+				       channels * sizeof(*data)) {
+			ret = -ENOBUFS;
+			ADEC_LOG_ERRNO("output memory too small", -ret);
+			return ret;
+		}
+		/* The playout position is reported in the output timeline */
+		end_us = adec_frame_time_us(&info->info) +
+			 (uint64_t)out_count * 1000000 / sample_rate;
+		ret = adec_drift_process(
+			base, data, channels, out_count, sample_rate, end_us);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_drift_process", -ret);
+			return ret;
+		}
+		out_count = ret;
+	}
+	if (output != NULL)
+		output->ts_offset += (int64_t)out_count - frame_count;
+	out_size = (size_t)out_count * channels * info->format.bit_depth / 8;
+
+	if (output != NULL && output->evt != NULL) {
+		out_frame = ring_get(&output->stock);
+		(void)pomp_evt_signal(output->evt);
+	}
+	if (out_frame != NULL) {
+		stocked = true;
+		ret = mbuf_audio_frame_set_frame_info(out_frame, info);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_audio_frame_set_frame_info", -ret);
+			goto out;
+		}
+	} else {
+		ret = mbuf_audio_frame_new(info, &out_frame);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_audio_frame_new", -ret);
+			return ret;
+		}
+		base->counters.out_frame_allocs++;
+	}
+
+	if (!config->realtime) {
+		ret = adec_copy_ancillary_data(in_frame, out_frame);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_copy_ancillary_data", -ret);
+			goto out;
+		}
+		base->counters.ancillary_allocs += ret;
+	}
+
+	ret = mbuf_audio_frame_set_buffer(out_frame, mem, 0, out_size);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_set_buffer", -ret);
+		goto out;
+	}
+
+	if (config->timing_mode != ADEC_TIMING_MODE_NONE) {
+		/* In coarse mode the output time is sampled once for all the
+		 * frames decoded from the same input */
+		if (config->timing_mode == ADEC_TIMING_MODE_PRECISE ||
+		    timings->output_time == 0)
+			timings->output_time =
+				adec_get_time_us(config->timing_mode);
+		if (stocked) {
+			ret = fill_record(out_frame,
+					  ADEC_ANCILLARY_KEY_TIMINGS,
+					  timings,
+					  sizeof(*timings));
+		} else {
+			ret = adec_frame_set_timings(out_frame, timings);
+			if (ret == 0)
+				base->counters.ancillary_allocs++;
+		}
+		if (ret < 0)
+			ADEC_LOG_ERRNO("adec_frame_set_timings", -ret);
+	}
+
+	if (config->levels) {
+		if (stocked) {
+			ret = fill_record(out_frame,
+					  ADEC_ANCILLARY_KEY_LEVELS,
+					  &levels,
+					  sizeof(levels));
+		} else {
+			ret = adec_frame_set_levels(out_frame, &levels);
+			if (ret == 0)
+				base->counters.ancillary_allocs++;
+		}
+		if (ret < 0)
+			ADEC_LOG_ERRNO("adec_frame_set_levels", -ret);
+	}
+
+	ret = mbuf_audio_frame_finalize(out_frame);
+	if (ret < 0)
+		ADEC_LOG_ERRNO("mbuf_audio_frame_finalize", -ret);
+
+	ret = adec_pipeline_queue_output(base->pipeline, out_frame);
+	if (ret < 0)
+		goto out;
+	ret = 1;
+
+out:
+	/* The frame can already have been output and released by the loop
+	 * thread */
+	err = release_frame(output, out_frame);
+	if (err < 0)
+		ADEC_LOG_ERRNO("mbuf_audio_frame_unref", -err);
+	return ret;
+}
+
+
+void adec_output_release_input(struct adec_decoder *base,
+				struct mbuf_audio_frame *frame)
+{
+	int err;
+	struct adec_decoder *self = base;
+
+	err = release_frame(base->output, frame);
+	if (err < 0)
+		ADEC_LOG_ERRNO("mbuf_audio_frame_unref", -err);
+}
+
+
+void adec_output_reset(struct adec_decoder *base)
+{
+	/* Restart the drift compensation, the latency catch-up and the output
+	 * timeline from the next frame */
+	if (base->drift != NULL)
+		adec_drift_reset(base->drift);
+	if (base->catchup != NULL)
+		adec_catchup_reset(base->catchup);
+	if (base->output != NULL)
+		base->output->ts_offset = 0;
+}
@@ -0,0 +1,1151 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#	include <TargetConditionals.h>
+#endif
+
+#include <futils/mbox.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+
+
+/* Maximum number of pending non-discarding flushes (power of 2) */
+#define ADEC_PIPELINE_MAX_BARRIERS 8
+/* Initial capacity of the input frames arrays */
+#define ADEC_PIPELINE_IN_ENTRIES 16
+/* Delay after which an admitted input frame that was not received by the
+ * decoding thread is forgotten (its push failed after the input filter), in
+ * microseconds */
+#define ADEC_PIPELINE_ADMIT_TIMEOUT_US 1000000
+
+#define ADEC_MSG_FLUSH 'f'
+#define ADEC_MSG_STOP 's'
+#define ADEC_MSG_BARRIER 'b'
+
+
+/* Input frame admitted by the input filter, or queued for decoding */
+struct adec_in_entry {
+	/* Only used for matching while admitted, referenced once queued */
+	struct mbuf_audio_frame *frame;
+	/* Size accounted in the memory budget */
+	size_t size;
+	/* Frame time in microseconds */
+	uint64_t time;
+	/* Admission time in microseconds */
+	uint64_t admit_time;
+	/* Input time of the decoder timings (0 if unknown) */
+	uint64_t input_time;
+};
+
+
+struct adec_pipeline {
+	struct adec_decoder *base;
+	struct adec_pipeline_cbs cbs;
+	const char *thread_name;
+	struct mbuf_audio_frame_queue *in_queue;
+	struct mbuf_audio_frame_queue *out_queue;
+	struct pomp_evt *out_queue_evt;
+	struct mbox *mbox;
+
+	pthread_t thread;
+	atomic_int thread_launched;
+	atomic_int should_stop;
+	atomic_int flush;
+	atomic_int flushing;
+	atomic_int flush_discard;
+	/* A discarding flush is pending until its callback is called (loop
+	 * thread) */
+	atomic_int discard_pending;
+	/* Non-discarding flush barrier: the flush is complete once all the
+	 * input frames accepted before the flush request have been decoded
+	 * and all the resulting output frames have been consumed. The
+	 * counters are free-running and compared with wrap-around */
+	atomic_uint in_accepted;
+	atomic_uint in_consumed;
+	atomic_uint out_queued;
+	atomic_uint out_consumed;
+	/* Decoding paused by the memory budget until the pending output
+	 * frames are consumed or the allocated output memories released,
+	 * then resumed through resume_evt */
+	atomic_int paused;
+	struct pomp_evt *resume_evt;
+	/* Barrier requests (flush() -> decoder thread): in_accepted marks,
+	 * written on the loop thread and read on the decoder thread */
+	unsigned int barrier_in_marks[ADEC_PIPELINE_MAX_BARRIERS];
+	atomic_uint barrier_in_write;
+	unsigned int barrier_in_read;
+	/* Barriers reached (decoder thread -> loop thread): out_queued
+	 * marks, written on the decoder thread and read on the loop thread */
+	unsigned int barrier_out_marks[ADEC_PIPELINE_MAX_BARRIERS];
+	atomic_uint barrier_out_write;
+	unsigned int barrier_out_read;
+	/* A barrier flush callback is pending, the output is suspended
+	 * until it is called (loop thread only) */
+	bool barrier_cb_pending;
+	/* Input frames admitted by the input filter and not yet received by
+	 * the decoder thread, in push order (protected by in_mutex) */
+	pthread_mutex_t in_mutex;
+	struct adec_in_entry *admitted;
+	unsigned int admitted_count;
+	unsigned int admitted_size;
+	/* Input frames received by the decoder thread and waiting to be
+	 * decoded, the head frame being decoded (decoder thread only) */
+	struct adec_in_entry *queued;
+	unsigned int queued_head;
+	unsigned int queued_count;
+	unsigned int queued_size;
+	/* Number of queued frames and time of the head frame in microseconds,
+	 * written by the decoder thread under in_mutex for the drop-newest
+	 * policy of the input filter */
+	atomic_uint in_queued;
+	atomic_uint_least64_t in_head_time;
+};
+
+
+static void call_flush_done(void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+	unsigned int w = atomic_load(&self->barrier_out_write);
+
+	/* The barriers completed by the discarding flush are reported first,
+	 * one callback each */
+	while (self->barrier_out_read != w) {
+		self->barrier_out_read++;
+		adec_call_flush_cb(self->base);
+	}
+
+	atomic_store(&self->discard_pending, 0);
+	adec_call_flush_cb(self->base);
+}
+
+
+static void call_stop_done(void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+
+	adec_call_stop_cb(self->base);
+}
+
+
+/* Resume decoding if paused by the memory budget (any thread) */
+static void resume_decoding(void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+	int err;
+
+	if (!atomic_exchange(&self->paused, 0))
+		return;
+	err = pomp_evt_signal(self->resume_evt);
+	if (err < 0)
+		ADEC_LOG_ERRNO("pomp_evt_signal", -err);
+}
+
+
+static void out_queue_evt_cb(struct pomp_evt *evt, void *userdata);
+
+
+static void mbox_cb(int fd, uint32_t revents, void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+	int ret, err;
+	char message;
+
+	do {
+		/* Read from the mailbox */
+		ret = mbox_peek(self->mbox, &message);
+		if (ret < 0) {
+			if (ret != -EAGAIN)
+				ADEC_LOG_ERRNO("mbox_peek", -ret);
+			break;
+		}
+
+		switch (message) {
+		case ADEC_MSG_FLUSH:
+			err = pomp_loop_idle_add_with_cookie(
+				self->base->loop, call_flush_done, self, self);
+			if (err < 0)
+				ADEC_LOG_ERRNO("pomp_loop_idle_add_with_cookie",
+					       -err);
+			break;
+		case ADEC_MSG_BARRIER:
+			/* The output queue may already be empty, or not
+			 * signaled yet: drain it up to the barrier */
+			out_queue_evt_cb(self->out_queue_evt, self);
+			break;
+		case ADEC_MSG_STOP:
+			err = pomp_loop_idle_add_with_cookie(
+				self->base->loop, call_stop_done, self, self);
+			if (err < 0)
+				ADEC_LOG_ERRNO("pomp_loop_idle_add_with_cookie",
+					       -err);
+			break;
+		default:
+			ADEC_LOGE("unknown message: %c", message);
+			break;
+		}
+	} while (ret == 0);
+}
+
+
+static void call_barrier_done(void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+
+	self->barrier_cb_pending = false;
+	adec_call_flush_cb(self->base);
+
+	/* Resume the output after the barrier */
+	out_queue_evt_cb(self->out_queue_evt, self);
+}
+
+
+/* Called on the loop thread before each output frame is consumed; returns
+ * true if the output must be suspended until the flush callback of a
+ * reached barrier is called from an idle function */
+static bool check_output_barrier(struct adec_pipeline *self)
+{
+	int err;
+	unsigned int r, mark;
+
+	if (self->barrier_cb_pending)
+		return true;
+	r = self->barrier_out_read;
+	if (r == atomic_load(&self->barrier_out_write))
+		return false;
+	mark = self->barrier_out_marks[r % ADEC_PIPELINE_MAX_BARRIERS];
+	if ((int)(atomic_load(&self->out_consumed) - mark) < 0)
+		return false;
+
+	/* All the frames queued before the barrier have been output: call
+	 * the flush callback outside of the output queue processing, the
+	 * following frames are output afterwards */
+	self->barrier_out_read = r + 1;
+	err = pomp_loop_idle_add_with_cookie(
+		self->base->loop, call_barrier_done, self, self);
+	if (err < 0) {
+		ADEC_LOG_ERRNO("pomp_loop_idle_add_with_cookie", -err);
+		adec_call_flush_cb(self->base);
+		return false;
+	}
+	self->barrier_cb_pending = true;
+	return true;
+}
+
+
+/* The frames accepted before a barrier have been decoded: the barrier now
+ * waits for the frames in the output queue (decoder thread) */
+static void reach_barrier(struct adec_pipeline *self)
+{
+	unsigned int w = atomic_load(&self->barrier_out_write);
+
+	self->barrier_out_marks[w % ADEC_PIPELINE_MAX_BARRIERS] =
+		atomic_load(&self->out_queued);
+	atomic_store(&self->barrier_out_write, w + 1);
+	self->barrier_in_read++;
+}
+
+
+/* Called on the decoder thread after each input frame is consumed */
+static void check_input_barrier(struct adec_pipeline *self)
+{
+	int ret;
+	unsigned int mark;
+	bool reached = false;
+	char message;
+
+	while (self->barrier_in_read != atomic_load(&self->barrier_in_write)) {
+		mark = self->barrier_in_marks[self->barrier_in_read %
+					      ADEC_PIPELINE_MAX_BARRIERS];
+		if ((int)(atomic_load(&self->in_consumed) - mark) < 0)
+			break;
+		reach_barrier(self);
+		reached = true;
+	}
+	if (!reached)
+		return;
+
+	message = ADEC_MSG_BARRIER;
+	ret = mbox_push(self->mbox, &message);
+	if (ret < 0)
+		ADEC_LOG_ERRNO("mbox_push", -ret);
+}
+
+
+static void out_queue_evt_cb(struct pomp_evt *evt, void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+	struct mbuf_audio_frame *out_frame;
+	int err;
+
+	do {
+		if (check_output_barrier(self))
+			break;
+		err = mbuf_audio_frame_queue_pop(self->out_queue, &out_frame);
+		if (err == -EAGAIN) {
+			break;
+		} else if (err < 0) {
+			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_pop:out_queue",
+				       -err);
+			break;
+		}
+		if (!atomic_load(&self->flush_discard)) {
+			adec_call_frame_output_cb(self->base, 0, out_frame);
+		} else {
+			struct adef_frame out_info = {};
+			err = mbuf_audio_frame_get_frame_info(out_frame,
+							      &out_info);
+			if (err < 0)
+				ADEC_LOG_ERRNO(
+					"mbuf_audio_frame_get_frame_info",
+					-err);
+			ADEC_LOGD("discarding frame %d", out_info.info.index);
+		}
+		mbuf_audio_frame_unref(out_frame);
+		atomic_fetch_add(&self->out_consumed, 1);
+	} while (err == 0);
+
+	resume_decoding(self);
+}
+
+
+static int discard_queue(struct adec_pipeline *self,
+			 struct mbuf_audio_frame_queue *queue,
+			 atomic_uint *consumed)
+{
+	int ret;
+	struct mbuf_audio_frame *frame;
+
+	/* Pop rather than flush to keep the barrier counters in sync */
+	while ((ret = mbuf_audio_frame_queue_pop(queue, &frame)) == 0) {
+		mbuf_audio_frame_unref(frame);
+		atomic_fetch_add(consumed, 1);
+	}
+
+	return (ret == -EAGAIN) ? 0 : ret;
+}
+
+
+static int complete_flush(struct adec_pipeline *self)
+{
+	int ret;
+	char message;
+
+	if (atomic_load(&self->flush_discard)) {
+		/* Flush the output queue */
+		ret = discard_queue(self,
+				    self->out_queue,
+				    &self->out_consumed);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_pop:out_queue",
+				       -ret);
+			return ret;
+		}
+		adec_output_reset(self->base);
+	}
+
+	atomic_store(&self->flushing, 0);
+	atomic_store(&self->flush_discard, 0);
+
+	/* Call the flush callback on the loop */
+	message = ADEC_MSG_FLUSH;
+	ret = mbox_push(self->mbox, &message);
+	if (ret < 0)
+		ADEC_LOG_ERRNO("mbox_push", -ret);
+
+	return ret;
+}
+
+
+/* Publish the decoding queue state to the input filter */
+static void publish_queued(struct adec_pipeline *self)
+{
+	uint64_t head_time = 0;
+
+	if (self->queued_count > 0)
+		head_time = self->queued[self->queued_head].time;
+	pthread_mutex_lock(&self->in_mutex);
+	atomic_store(&self->in_queued, self->queued_count);
+	atomic_store(&self->in_head_time, head_time);
+	pthread_mutex_unlock(&self->in_mutex);
+}
+
+
+static int queued_push(struct adec_pipeline *self,
+		       const struct adec_in_entry *entry)
+{
+	unsigned int i, size;
+	struct adec_in_entry *queued;
+
+	if (self->queued_count == self->queued_size) {
+		/* Grow the ring, unwrapping it */
+		size = self->queued_size * 2;
+		queued = malloc(size * sizeof(*queued));
+		if (queued == NULL)
+			return -ENOMEM;
+		for (i = 0; i < self->queued_count; i++) {
+			queued[i] = self->queued[(self->queued_head + i) %
+						 self->queued_size];
+		}
+		free(self->queued);
+		self->queued = queued;
+		self->queued_size = size;
+		self->queued_head = 0;
+	}
+	i = (self->queued_head + self->queued_count) % self->queued_size;
+	self->queued[i] = *entry;
+	self->queued_count++;
+
+	return 0;
+}
+
+
+static void queued_pop(struct adec_pipeline *self, struct adec_in_entry *entry)
+{
+	*entry = self->queued[self->queued_head];
+	self->queued_head = (self->queued_head + 1) % self->queued_size;
+	self->queued_count--;
+}
+
+
+/* Release a consumed input frame and its memory budget */
+static void release_input(struct adec_pipeline *self,
+			  struct adec_in_entry *entry)
+{
+	if (entry->size > 0)
+		adec_mem_release(self->base, ADEC_MEM_IN_QUEUE, entry->size);
+	adec_output_release_input(self->base, entry->frame);
+	atomic_fetch_add(&self->in_consumed, 1);
+}
+
+
+/* Size of an input frame accounted in the memory budget while queued */
+static size_t input_mem_size(struct adec_pipeline *self,
+			     struct mbuf_audio_frame *frame)
+{
+	ssize_t size;
+
+	if (self->cbs.pooled != NULL && self->cbs.pooled(self->base, frame))
+		return 0;
+	size = mbuf_audio_frame_get_size(frame);
+	return (size > 0) ? size : 0;
+}
+
+
+static void remove_admitted(struct adec_pipeline *self, unsigned int i)
+{
+	self->admitted_count--;
+	memmove(&self->admitted[i],
+		&self->admitted[i + 1],
+		(self->admitted_count - i) * sizeof(*self->admitted));
+}
+
+
+/* Move the frames pushed to the input queue to the decoding queue, where
+ * they are counted; the frames are matched with the frames admitted by the
+ * input filter (the input filter is called before the frame is actually
+ * queued, and the push can still fail afterwards) */
+static void receive_input(struct adec_pipeline *self)
+{
+	int ret, err;
+	unsigned int i;
+	uint64_t now;
+	struct mbuf_audio_frame *frame;
+	struct adec_in_entry entry;
+	struct adef_frame info;
+	bool received = false;
+
+	while ((ret = mbuf_audio_frame_queue_pop(self->in_queue, &frame)) ==
+	       0) {
+		pthread_mutex_lock(&self->in_mutex);
+		for (i = 0; i < self->admitted_count; i++) {
+			if (self->admitted[i].frame == frame)
+				break;
+		}
+		if (i < self->admitted_count) {
+			entry = self->admitted[i];
+			remove_admitted(self, i);
+			pthread_mutex_unlock(&self->in_mutex);
+		} else {
+			/* Admitted too long ago and already forgotten: admit
+			 * it again, the budget is not enforced */
+			pthread_mutex_unlock(&self->in_mutex);
+			entry.time = 0;
+			err = mbuf_audio_frame_get_frame_info(frame, &info);
+			if (err == 0)
+				entry.time = adec_frame_time_us(&info.info);
+			entry.size = input_mem_size(self, frame);
+			entry.input_time = 0;
+			(void)adec_mem_charge(
+				self->base, ADEC_MEM_IN_QUEUE, entry.size, 1);
+			atomic_fetch_add(&self->in_accepted, 1);
+		}
+		entry.frame = frame;
+		err = queued_push(self, &entry);
+		if (err < 0) {
+			ADEC_LOG_ERRNO("queued_push", -err);
+			release_input(self, &entry);
+			atomic_fetch_add(&self->base->counters.in_dropped, 1);
+			continue;
+		}
+		received = true;
+	}
+	if (ret != -EAGAIN)
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_pop:input", -ret);
+	if (received)
+		publish_queued(self);
+
+	/* Forget the admitted frames whose push failed */
+	pthread_mutex_lock(&self->in_mutex);
+	if (self->admitted_count == 0)
+		goto out;
+	now = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+	for (i = 0; i < self->admitted_count;) {
+		if (now - self->admitted[i].admit_time <
+		    ADEC_PIPELINE_ADMIT_TIMEOUT_US) {
+			i++;
+			continue;
+		}
+		if (self->admitted[i].size > 0) {
+			adec_mem_release(self->base,
+					 ADEC_MEM_IN_QUEUE,
+					 self->admitted[i].size);
+		}
+		atomic_fetch_add(&self->in_consumed, 1);
+		remove_admitted(self, i);
+	}
+out:
+	pthread_mutex_unlock(&self->in_mutex);
+}
+
+
+static void drop_input_head(struct adec_pipeline *self)
+{
+	struct adec_in_entry entry;
+
+	queued_pop(self, &entry);
+	release_input(self, &entry);
+	atomic_fetch_add(&self->base->counters.in_dropped, 1);
+}
+
+
+/* Apply the input queue limits before decoding the head frame (drop-oldest
+ * and skip-to-latest policies) */
+static void trim_input_queue(struct adec_pipeline *self)
+{
+	unsigned int count, drop, tail;
+	enum adec_drop_policy policy = self->base->config.in_queue_drop_policy;
+
+	if (policy == ADEC_DROP_POLICY_NEWEST)
+		return;
+
+	while (self->queued_count > 1) {
+		count = self->queued_count;
+		tail = (self->queued_head + count - 1) % self->queued_size;
+		if (!adec_in_queue_over_limits(
+			    &self->base->config,
+			    count,
+			    self->queued[self->queued_head].time,
+			    self->queued[tail].time))
+			return;
+
+		drop = (policy == ADEC_DROP_POLICY_SKIP_TO_LATEST) ? count - 1
+								   : 1;
+		for (unsigned int i = 0; i < drop; i++)
+			drop_input_head(self);
+		publish_queued(self);
+		ADEC_LOGD("input queue over limits: %u frame(s) dropped (%s)",
+			  drop,
+			  adec_drop_policy_str(policy));
+		if (self->cbs.dropped != NULL)
+			self->cbs.dropped(
+				self->base,
+				policy == ADEC_DROP_POLICY_SKIP_TO_LATEST);
+		check_input_barrier(self);
+	}
+}
+
+
+static void discard_input(struct adec_pipeline *self)
+{
+	struct adec_in_entry entry;
+
+	receive_input(self);
+	while (self->queued_count > 0) {
+		queued_pop(self, &entry);
+		release_input(self, &entry);
+	}
+	publish_queued(self);
+}
+
+
+static void start_flush(struct adec_pipeline *self)
+{
+	if (atomic_load(&self->flush_discard)) {
+		/* Flush the input queue */
+		discard_input(self);
+		/* A discarding flush also completes the pending barriers,
+		 * reported before it by call_flush_done() */
+		while (self->barrier_in_read !=
+		       atomic_load(&self->barrier_in_write))
+			reach_barrier(self);
+		if (self->cbs.reset != NULL)
+			self->cbs.reset(self->base);
+	}
+
+	atomic_store(&self->flush, 0);
+	atomic_store(&self->flushing, 1);
+}
+
+
+/* Pause decoding while the output memory of the next frame does not fit in
+ * the memory budget and output frames or memories of the decoder are
+ * pending; out_queue_evt_cb() and the output memories release resume it.
+ * Without anything pending, the decoding goes on so that the budget can
+ * only be exceeded by one output memory */
+static bool pause_decoding(struct adec_pipeline *self)
+{
+	struct adec_memory_usage usage;
+
+	if (!adec_mem_over_budget(self->base,
+				  adec_output_get_alloc_size(self->base)))
+		return false;
+
+	/* Set before checking the pending frames not to miss the wake-up */
+	atomic_store(&self->paused, 1);
+	if (atomic_load(&self->out_queued) != atomic_load(&self->out_consumed))
+		return true;
+	(void)adec_mem_get_usage(self->base, &usage);
+	if (usage.output_bytes > 0)
+		return true;
+	atomic_store(&self->paused, 0);
+	return false;
+}
+
+
+static void check_input_queue(struct adec_pipeline *self)
+{
+	int ret;
+	struct adec_in_entry entry;
+	struct adec_in_entry *head;
+	struct adec_timings timings;
+	enum adec_timing_mode timing_mode = self->base->config.timing_mode;
+
+	receive_input(self);
+	while (self->queued_count > 0) {
+		trim_input_queue(self);
+		if (pause_decoding(self))
+			break;
+
+		/* The head frame stays queued while decoded */
+		head = &self->queued[self->queued_head];
+		timings = (struct adec_timings){
+			.input_time = head->input_time,
+		};
+		if (timing_mode != ADEC_TIMING_MODE_NONE)
+			timings.dequeue_time = adec_get_time_us(timing_mode);
+		ret = self->cbs.decode(self->base, head->frame, &timings);
+		if (ret < 0)
+			ADEC_LOG_ERRNO("decode", -ret);
+		queued_pop(self, &entry);
+		publish_queued(self);
+		release_input(self, &entry);
+		check_input_barrier(self);
+
+		if (atomic_load(&self->flush))
+			start_flush(self);
+		receive_input(self);
+	}
+	check_input_barrier(self);
+	if (atomic_load(&self->flush))
+		start_flush(self);
+}
+
+
+static void input_event_cb(struct pomp_evt *evt, void *userdata)
+{
+	struct adec_pipeline *self = userdata;
+	check_input_queue(self);
+}
+
+
+static void *decoder_thread(void *ptr)
+{
+	int ret;
+	struct adec_pipeline *self = ptr;
+	struct pomp_loop *loop = NULL;
+	struct pomp_evt *in_queue_evt = NULL;
+	bool resume_attached = false;
+	char message;
+
+#if defined(__APPLE__)
+#	if !TARGET_OS_IPHONE
+	ret = pthread_setname_np(self->thread_name);
+	if (ret != 0)
+		ADEC_LOG_ERRNO("pthread_setname_np", ret);
+#	endif
+#else
+	ret = pthread_setname_np(pthread_self(), self->thread_name);
+	if (ret != 0)
+		ADEC_LOG_ERRNO("pthread_setname_np", ret);
+#endif
+
+	adec_thread_apply_config(self->base);
+
+	loop = pomp_loop_new();
+	if (!loop) {
+		ADEC_LOG_ERRNO("pomp_loop_new", ENOMEM);
+		goto exit;
+	}
+	ret = mbuf_audio_frame_queue_get_event(self->in_queue, &in_queue_evt);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_get_event", -ret);
+		goto exit;
+	}
+	ret = pomp_evt_attach_to_loop(in_queue_evt, loop, input_event_cb, self);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop", -ret);
+		goto exit;
+	}
+	ret = pomp_evt_attach_to_loop(
+		self->resume_evt, loop, input_event_cb, self);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop:resume", -ret);
+		goto exit;
+	}
+	resume_attached = true;
+
+	while (!atomic_load(&self->should_stop) ||
+	       atomic_load(&self->flushing)) {
+		/* Complete the flush started by check_input_queue() */
+		if (atomic_load(&self->flushing)) {
+			ret = complete_flush(self);
+			if (ret < 0)
+				ADEC_LOG_ERRNO("complete_flush", -ret);
+			continue;
+		}
+
+		ret = pomp_loop_wait_and_process(loop, 5);
+		if (ret == -ETIMEDOUT) {
+			check_input_queue(self);
+		} else if (ret < 0) {
+			ADEC_LOG_ERRNO("pomp_loop_wait_and_process", -ret);
+			if (!atomic_load(&self->should_stop)) {
+				/* Avoid looping on errors */
+				usleep(5000);
+			}
+		}
+	}
+
+	/* Call the stop callback on the loop */
+	message = ADEC_MSG_STOP;
+	ret = mbox_push(self->mbox, &message);
+	if (ret < 0)
+		ADEC_LOG_ERRNO("mbox_push", -ret);
+
+exit:
+	if (resume_attached) {
+		ret = pomp_evt_detach_from_loop(self->resume_evt, loop);
+		if (ret != 0)
+			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop:resume",
+				       -ret);
+	}
+	if (in_queue_evt != NULL) {
+		ret = pomp_evt_detach_from_loop(in_queue_evt, loop);
+		if (ret != 0)
+			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop", -ret);
+	}
+	if (loop != NULL) {
+		ret = pomp_loop_destroy(loop);
+		if (ret != 0)
+			ADEC_LOG_ERRNO("pomp_loop_destroy", -ret);
+	}
+
+	return NULL;
+}
+
+
+/* Record a frame admitted by the input filter (called with in_mutex
+ * held) */
+static int admit(struct adec_pipeline *self,
+		 struct mbuf_audio_frame *frame,
+		 size_t size,
+		 uint64_t time)
+{
+	unsigned int count = self->admitted_size * 2;
+	struct adec_in_entry *admitted, *entry;
+
+	if (self->admitted_count == self->admitted_size) {
+		admitted = realloc(self->admitted, count * sizeof(*admitted));
+		if (admitted == NULL)
+			return -ENOMEM;
+		self->admitted = admitted;
+		self->admitted_size = count;
+	}
+	entry = &self->admitted[self->admitted_count++];
+	entry->frame = frame;
+	entry->size = size;
+	entry->time = time;
+	entry->admit_time = adec_get_time_us(ADEC_TIMING_MODE_PRECISE);
+	entry->input_time = 0;
+	if (self->base->config.timing_mode != ADEC_TIMING_MODE_NONE) {
+		entry->input_time =
+			adec_get_time_us(self->base->config.timing_mode);
+	}
+
+	return 0;
+}
+
+
+static bool input_filter(struct mbuf_audio_frame *frame, void *userdata)
+{
+	struct adef_frame info;
+	int ret;
+	unsigned int count;
+	uint64_t time, head_time;
+	size_t size;
+	struct adec_pipeline *self = userdata;
+
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, false);
+
+	/* Rejected until a discarding flush is complete */
+	if (atomic_load(&self->discard_pending) ||
+	    atomic_load(&self->should_stop))
+		return false;
+
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	if (ret != 0)
+		return false;
+
+	if (!self->cbs.accept(self->base, frame, &info))
+		return false;
+
+	time = adec_frame_time_us(&info.info);
+	size = input_mem_size(self, frame);
+
+	pthread_mutex_lock(&self->in_mutex);
+	if (self->base->config.in_queue_drop_policy ==
+	    ADEC_DROP_POLICY_NEWEST) {
+		/* The queued frames are counted by the decoder thread, the
+		 * admitted frames are not received yet */
+		count = atomic_load(&self->in_queued) + self->admitted_count;
+		head_time = time;
+		if (atomic_load(&self->in_queued) > 0)
+			head_time = atomic_load(&self->in_head_time);
+		else if (self->admitted_count > 0)
+			head_time = self->admitted[0].time;
+		if (adec_in_queue_over_limits(
+			    &self->base->config, count + 1, head_time, time))
+			goto reject;
+	}
+
+	/* Memory budget: back-pressure only, whatever the drop policy */
+	if (size > 0 &&
+	    adec_mem_charge(self->base, ADEC_MEM_IN_QUEUE, size, 0) < 0)
+		goto reject;
+
+	ret = admit(self, frame, size, time);
+	if (ret < 0) {
+		adec_mem_release(self->base, ADEC_MEM_IN_QUEUE, size);
+		goto reject;
+	}
+	atomic_fetch_add(&self->in_accepted, 1);
+	pthread_mutex_unlock(&self->in_mutex);
+
+	adec_default_input_filter_internal_confirm_frame(
+		self->base, frame, &info);
+
+	return true;
+
+reject:
+	pthread_mutex_unlock(&self->in_mutex);
+	atomic_fetch_add(&self->base->counters.in_dropped, 1);
+	return false;
+}
+
+
+int adec_pipeline_new(struct adec_decoder *base,
+		      const struct adec_pipeline_cbs *cbs,
+		      const char *thread_name,
+		      struct adec_pipeline **ret_obj)
+{
+	int ret;
+	struct adec_pipeline *self = NULL;
+	pthread_attr_t attr;
+	struct mbuf_audio_frame_queue_args queue_args = {
+		.filter = input_filter,
+	};
+
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs->accept == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs->decode == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(thread_name == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->base = base;
+	self->cbs = *cbs;
+	self->thread_name = thread_name;
+	queue_args.filter_userdata = self;
+	pthread_mutex_init(&self->in_mutex, NULL);
+
+	/* Initialize the mailbox for inter-thread messages  */
+	self->mbox = mbox_new(1);
+	if (self->mbox == NULL) {
+		ret = -ENOMEM;
+		ADEC_LOG_ERRNO("mbox_new", -ret);
+		goto error;
+	}
+	ret = pomp_loop_add(base->loop,
+			    mbox_get_read_fd(self->mbox),
+			    POMP_FD_EVENT_IN,
+			    &mbox_cb,
+			    self);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("pomp_loop_add", -ret);
+		mbox_destroy(self->mbox);
+		self->mbox = NULL;
+		goto error;
+	}
+
+	/* Create the ouput buffers queue */
+	ret = mbuf_audio_frame_queue_new(&self->out_queue);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_new:output", -ret);
+		goto error;
+	}
+	ret = mbuf_audio_frame_queue_get_event(self->out_queue,
+					       &self->out_queue_evt);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_get_event", -ret);
+		goto error;
+	}
+	ret = pomp_evt_attach_to_loop(
+		self->out_queue_evt, base->loop, &out_queue_evt_cb, self);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop", -ret);
+		self->out_queue_evt = NULL;
+		goto error;
+	}
+
+	/* Signaled when the output frames are consumed or the output
+	 * memories released while decoding is paused by the memory budget,
+	 * attached to the decoding thread loop */
+	self->resume_evt = pomp_evt_new();
+	if (self->resume_evt == NULL) {
+		ret = -ENOMEM;
+		ADEC_LOG_ERRNO("pomp_evt_new:resume", -ret);
+		goto error;
+	}
+	adec_mem_set_release_cb(base, &resume_decoding, self);
+
+	/* Input frames arrays, grown when needed */
+	self->admitted = calloc(ADEC_PIPELINE_IN_ENTRIES,
+				sizeof(*self->admitted));
+	self->queued = calloc(ADEC_PIPELINE_IN_ENTRIES, sizeof(*self->queued));
+	if (self->admitted == NULL || self->queued == NULL) {
+		ret = -ENOMEM;
+		ADEC_LOG_ERRNO("calloc", -ret);
+		goto error;
+	}
+	self->admitted_size = ADEC_PIPELINE_IN_ENTRIES;
+	self->queued_size = ADEC_PIPELINE_IN_ENTRIES;
+
+	/* Create the input buffers queue */
+	ret = mbuf_audio_frame_queue_new_with_args(&queue_args,
+						   &self->in_queue);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_new_with_args", -ret);
+		goto error;
+	}
+
+	ret = adec_thread_attr_init(base, &attr);
+	if (ret < 0)
+		goto error;
+	ret = pthread_create(&self->thread, &attr, decoder_thread, self);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		ret = -ret;
+		ADEC_LOG_ERRNO("pthread_create", -ret);
+		goto error;
+	}
+	atomic_store(&self->thread_launched, true);
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	adec_pipeline_destroy(self);
+	return ret;
+}
+
+
+void adec_pipeline_destroy(struct adec_pipeline *self)
+{
+	int err;
+
+	if (self == NULL)
+		return;
+
+	/* Stop and join the decoding thread */
+	adec_pipeline_stop(self);
+	if (atomic_load(&self->thread_launched)) {
+		err = pthread_join(self->thread, NULL);
+		if (err != 0)
+			ADEC_LOG_ERRNO("pthread_join", err);
+	}
+
+	/* Free the resources */
+	if (self->out_queue_evt != NULL) {
+		err = pomp_evt_detach_from_loop(self->out_queue_evt,
+						self->base->loop);
+		if (err < 0)
+			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop", -err);
+	}
+	if (self->out_queue != NULL) {
+		err = discard_queue(self,
+				    self->out_queue,
+				    &self->out_consumed);
+		if (err < 0)
+			ADEC_LOG_ERRNO("discard_queue:output", -err);
+		err = mbuf_audio_frame_queue_destroy(self->out_queue);
+		if (err < 0)
+			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_destroy", -err);
+	}
+	if (self->in_queue != NULL) {
+		discard_input(self);
+		for (unsigned int i = 0; i < self->admitted_count; i++) {
+			adec_mem_release(self->base,
+					 ADEC_MEM_IN_QUEUE,
+					 self->admitted[i].size);
+		}
+		err = mbuf_audio_frame_queue_destroy(self->in_queue);
+		if (err < 0)
+			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_destroy", -err);
+	}
+	if (self->resume_evt != NULL) {
+		adec_mem_set_release_cb(self->base, NULL, NULL);
+		err = pomp_evt_destroy(self->resume_evt);
+		if (err < 0)
+			ADEC_LOG_ERRNO("pomp_evt_destroy:resume", -err);
+	}
+	if (self->mbox != NULL) {
+		err = pomp_loop_remove(self->base->loop,
+				       mbox_get_read_fd(self->mbox));
+		if (err < 0)
+			ADEC_LOG_ERRNO("pomp_loop_remove", -err);
+		mbox_destroy(self->mbox);
+	}
+
+	err = pomp_loop_idle_remove_by_cookie(self->base->loop, self);
+	if (err < 0)
+		ADEC_LOG_ERRNO("pomp_loop_idle_remove_by_cookie", -err);
+
+	free(self->admitted);
+	free(self->queued);
+	pthread_mutex_destroy(&self->in_mutex);
+	free(self);
+}
+
+
+int adec_pipeline_stop(struct adec_pipeline *self)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	/* Stop the decoding thread */
+	atomic_store(&self->should_stop, true);
+
+	return 0;
+}
+
+
+int adec_pipeline_flush(struct adec_pipeline *self, int discard)
+{
+	unsigned int w;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	if (atomic_load(&self->discard_pending)) {
+		ADEC_LOGW("discarding flush pending");
+		return -EBUSY;
+	}
+
+	if (!discard) {
+		/* Insert a barrier after the frames accepted so far; the input
+		 * queue keeps accepting frames during the drain */
+		w = atomic_load(&self->barrier_in_write);
+		if (w - self->barrier_out_read >= ADEC_PIPELINE_MAX_BARRIERS) {
+			ADEC_LOGW("too many pending flushes");
+			return -EBUSY;
+		}
+		self->barrier_in_marks[w % ADEC_PIPELINE_MAX_BARRIERS] =
+			atomic_load(&self->in_accepted);
+		atomic_store(&self->barrier_in_write, w + 1);
+		return 0;
+	}
+
+	atomic_store(&self->discard_pending, 1);
+	atomic_store(&self->flush_discard, discard);
+	atomic_store(&self->flush, 1);
+
+	return 0;
+}
+
+
+struct mbuf_audio_frame_queue *
+adec_pipeline_get_input_queue(struct adec_pipeline *self)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(self == NULL, EINVAL, NULL);
+
+	return self->in_queue;
+}
+
+
+int adec_pipeline_queue_output(struct adec_pipeline *self,
+			       struct mbuf_audio_frame *frame)
+{
+	int ret;
+
+	ret = mbuf_audio_frame_queue_push(self->out_queue, frame);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_push:output", -ret);
+		return ret;
+	}
+	atomic_fetch_add(&self->out_queued, 1);
+
+	return 0;
+}
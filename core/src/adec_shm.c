@@ -0,0 +1,308 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#ifndef _WIN32
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif /* !_WIN32 */
+
+#include <media-buffers/mbuf_mem_generic.h>
+
+
+struct adec_shm {
+	int fd;
+	uint64_t id;
+	uint8_t *base;
+	size_t size;
+	size_t slot_size;
+	unsigned int slot_count;
+	/* Per-slot reference count: one reference for the local memory
+	 * wrapping the slot, one per export until released */
+	atomic_uint *refs;
+};
+
+
+#ifndef _WIN32
+
+static int shm_create_fd(void)
+{
+	int fd;
+#	if defined(__linux__) && defined(MFD_CLOEXEC)
+	fd = memfd_create("adec_shm", MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+#	else
+	static atomic_uint counter;
+	char name[64];
+	snprintf(name,
+		 sizeof(name),
+		 "/adec_shm_%d_%u",
+		 (int)getpid(),
+		 atomic_fetch_add(&counter, 1));
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return -errno;
+	/* The descriptor is the only handle to the memory */
+	(void)shm_unlink(name);
+#	endif
+	return fd;
+}
+
+#endif /* !_WIN32 */
+
+
+int adec_shm_new(size_t slot_size,
+		 unsigned int slot_count,
+		 struct adec_shm **ret_obj)
+{
+#ifdef _WIN32
+	return -ENOSYS;
+#else /* !_WIN32 */
+	int ret;
+	struct adec_shm *shm;
+	struct stat st;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	ULOG_ERRNO_RETURN_ERR_IF(slot_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(slot_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	shm = calloc(1, sizeof(*shm));
+	if (shm == NULL)
+		return -ENOMEM;
+	shm->fd = -1;
+	shm->base = MAP_FAILED;
+
+	/* Page-aligned slots so that they can also be mapped one by one */
+	if (page_size <= 0)
+		page_size = 4096;
+	shm->slot_size = (slot_size + page_size - 1) & ~(size_t)(page_size - 1);
+	shm->slot_count = slot_count;
+	shm->size = shm->slot_size * slot_count;
+
+	shm->refs = calloc(slot_count, sizeof(*shm->refs));
+	if (shm->refs == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+	for (unsigned int i = 0; i < slot_count; i++)
+		atomic_init(&shm->refs[i], 0);
+
+	ret = shm_create_fd();
+	if (ret < 0) {
+		ULOG_ERRNO("shm_create_fd", -ret);
+		goto error;
+	}
+	shm->fd = ret;
+
+	if (ftruncate(shm->fd, shm->size) < 0) {
+		ret = -errno;
+		ULOG_ERRNO("ftruncate", -ret);
+		goto error;
+	}
+
+	shm->base = mmap(NULL,
+			 shm->size,
+			 PROT_READ | PROT_WRITE,
+			 MAP_SHARED,
+			 shm->fd,
+			 0);
+	if (shm->base == MAP_FAILED) {
+		ret = -errno;
+		ULOG_ERRNO("mmap", -ret);
+		goto error;
+	}
+
+	/* The inode number identifies the shared memory system-wide */
+	if (fstat(shm->fd, &st) == 0)
+		shm->id = (uint64_t)st.st_ino;
+
+	*ret_obj = shm;
+	return 0;
+
+error:
+	adec_shm_destroy(shm);
+	return ret;
+#endif /* !_WIN32 */
+}
+
+
+int adec_shm_destroy(struct adec_shm *shm)
+{
+	if (shm == NULL)
+		return 0;
+
+#ifndef _WIN32
+	for (unsigned int i = 0; shm->refs != NULL && i < shm->slot_count;
+	     i++) {
+		if (atomic_load(&shm->refs[i]) != 0) {
+			ULOGW("destroying shared memory with slot %u in use",
+			      i);
+		}
+	}
+	if (shm->base != MAP_FAILED)
+		munmap(shm->base, shm->size);
+	if (shm->fd >= 0)
+		close(shm->fd);
+#endif /* !_WIN32 */
+	free(shm->refs);
+	free(shm);
+
+	return 0;
+}
+
+
+int adec_shm_get_fd(struct adec_shm *shm)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(shm == NULL, EINVAL);
+
+	return shm->fd;
+}
+
+
+size_t adec_shm_get_size(struct adec_shm *shm)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(shm == NULL, EINVAL, 0);
+
+	return shm->size;
+}
+
+
+static int slot_unref(struct adec_shm *shm, unsigned int slot)
+{
+	unsigned int refs = atomic_load(&shm->refs[slot]);
+
+	do {
+		if (refs == 0) {
+			ULOGW("slot %u released too many times", slot);
+			return -EALREADY;
+		}
+	} while (!atomic_compare_exchange_weak(
+		&shm->refs[slot], &refs, refs - 1));
+
+	return 0;
+}
+
+
+static void mem_release_cb(void *data, size_t len, void *userdata)
+{
+	struct adec_shm *shm = userdata;
+
+	(void)slot_unref(shm, ((uint8_t *)data - shm->base) / shm->slot_size);
+}
+
+
+int adec_shm_get_mem(struct adec_shm *shm,
+		     size_t size,
+		     struct mbuf_mem **ret_obj)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(shm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	if (size > shm->slot_size)
+		return -ENOBUFS;
+
+	for (unsigned int i = 0; i < shm->slot_count; i++) {
+		unsigned int expected = 0;
+		if (!atomic_compare_exchange_strong(
+			    &shm->refs[i], &expected, 1))
+			continue;
+		ret = mbuf_mem_generic_wrap(shm->base + i * shm->slot_size,
+					    shm->slot_size,
+					    mem_release_cb,
+					    shm,
+					    ret_obj);
+		if (ret < 0) {
+			ULOG_ERRNO("mbuf_mem_generic_wrap", -ret);
+			atomic_store(&shm->refs[i], 0);
+		}
+		return ret;
+	}
+
+	/* All slots are in use, locally or by a consumer */
+	return -EAGAIN;
+}
+
+
+int adec_shm_export(struct adec_shm *shm,
+		    struct mbuf_audio_frame *frame,
+		    struct adec_shm_desc *desc)
+{
+	int ret;
+	const void *data;
+	size_t len;
+	size_t offset;
+	struct adef_frame info;
+
+	ULOG_ERRNO_RETURN_ERR_IF(shm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(desc == NULL, EINVAL);
+
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	if (ret < 0)
+		return ret;
+
+	ret = mbuf_audio_frame_get_buffer(frame, &data, &len);
+	if (ret < 0)
+		return ret;
+	mbuf_audio_frame_release_buffer(frame, data);
+
+	if ((const uint8_t *)data < shm->base ||
+	    (const uint8_t *)data + len > shm->base + shm->size) {
+		/* The frame memory does not belong to this shared memory
+		 * (e.g. fallback allocation) */
+		return -EXDEV;
+	}
+	offset = (const uint8_t *)data - shm->base;
+
+	memset(desc, 0, sizeof(*desc));
+	desc->pool_id = shm->id;
+	desc->slot = offset / shm->slot_size;
+	desc->offset = offset;
+	desc->length = len;
+	desc->timestamp = info.info.timestamp;
+	desc->timescale = info.info.timescale;
+
+	/* The slot stays in use until the consumer releases it */
+	atomic_fetch_add(&shm->refs[desc->slot], 1);
+
+	return 0;
+}
+
+
+int adec_shm_release(struct adec_shm *shm, uint32_t slot)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(shm == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(slot >= shm->slot_count, EINVAL);
+
+	return slot_unref(shm, slot);
+}
@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#include <limits.h>
+#include <sched.h>
+
+#ifdef __linux__
+#	include <sys/resource.h>
+#	include <sys/syscall.h>
+#endif /* __linux__ */
+
+
+int adec_thread_attr_init(struct adec_decoder *base, pthread_attr_t *attr)
+{
+	int ret;
+	struct adec_decoder *self = base;
+	size_t stack_size;
+
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(attr == NULL, EINVAL);
+
+	ret = pthread_attr_init(attr);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("pthread_attr_init", ret);
+		return -ret;
+	}
+
+	stack_size = base->config.thread.stack_size;
+	if (stack_size == 0)
+		return 0;
+
+#ifdef PTHREAD_STACK_MIN
+	if (stack_size < PTHREAD_STACK_MIN) {
+		ADEC_LOGW("stack size %zu is below the minimum, using %zu",
+			  stack_size,
+			  (size_t)PTHREAD_STACK_MIN);
+		stack_size = PTHREAD_STACK_MIN;
+	}
+#endif /* PTHREAD_STACK_MIN */
+
+	ret = pthread_attr_setstacksize(attr, stack_size);
+	if (ret != 0) {
+		/* Not fatal, the default stack size is used */
+		ADEC_LOGW_ERRNO(
+			"pthread_attr_setstacksize(%zu)", ret, stack_size);
+	}
+
+	return 0;
+}
+
+
+static int sched_policy_to_posix(enum adec_sched_policy policy)
+{
+	switch (policy) {
+	case ADEC_SCHED_POLICY_FIFO:
+		return SCHED_FIFO;
+	case ADEC_SCHED_POLICY_RR:
+		return SCHED_RR;
+	default:
+		return SCHED_OTHER;
+	}
+}
+
+
+static enum adec_sched_policy sched_policy_from_posix(int policy)
+{
+	switch (policy) {
+	case SCHED_FIFO:
+		return ADEC_SCHED_POLICY_FIFO;
+	case SCHED_RR:
+		return ADEC_SCHED_POLICY_RR;
+	default:
+		return ADEC_SCHED_POLICY_DEFAULT;
+	}
+}
+
+
+static void apply_affinity(struct adec_decoder *self, uint64_t mask)
+{
+#ifdef __linux__
+	int ret;
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	for (unsigned int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+		if (mask & (UINT64_C(1) << i))
+			CPU_SET(i, &cpuset);
+	}
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (ret != 0) {
+		ADEC_LOGW_ERRNO(
+			"pthread_setaffinity_np(0x%" PRIx64 ")", ret, mask);
+	}
+#else /* !__linux__ */
+	ADEC_LOGW("CPU affinity is not supported on this platform");
+#endif /* !__linux__ */
+}
+
+
+static void apply_sched(struct adec_decoder *self,
+			enum adec_sched_policy policy,
+			int priority)
+{
+	int ret, posix_policy, min, max;
+	struct sched_param param = {0};
+
+	posix_policy = sched_policy_to_posix(policy);
+	min = sched_get_priority_min(posix_policy);
+	max = sched_get_priority_max(posix_policy);
+	if (priority < min)
+		priority = min;
+	if (priority > max)
+		priority = max;
+	param.sched_priority = priority;
+
+	ret = pthread_setschedparam(pthread_self(), posix_policy, &param);
+	if (ret != 0) {
+		/* Typically EPERM without CAP_SYS_NICE or RLIMIT_RTPRIO */
+		ADEC_LOGW_ERRNO("pthread_setschedparam(%s, %d)",
+				ret,
+				adec_sched_policy_str(policy),
+				priority);
+	}
+}
+
+
+static void apply_nice(struct adec_decoder *self, int nice_val)
+{
+#ifdef __linux__
+	/* On Linux the nice value is a per-thread attribute */
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if (setpriority(PRIO_PROCESS, tid, nice_val) < 0) {
+		int err = errno;
+		ADEC_LOGW_ERRNO("setpriority(%d)", err, nice_val);
+	}
+#else /* !__linux__ */
+	ADEC_LOGW("per-thread nice value is not supported on this platform");
+#endif /* !__linux__ */
+}
+
+
+static void read_effective_settings(struct adec_decoder *self,
+				    struct adec_thread_stats *stats)
+{
+	int ret, posix_policy;
+	struct sched_param param = {0};
+
+	ret = pthread_getschedparam(pthread_self(), &posix_policy, &param);
+	if (ret == 0) {
+		stats->sched_policy = sched_policy_from_posix(posix_policy);
+		stats->sched_priority = param.sched_priority;
+	}
+
+#ifdef __linux__
+	cpu_set_t cpuset;
+	pthread_attr_t attr;
+	size_t stack_size;
+
+	CPU_ZERO(&cpuset);
+	ret = pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (ret == 0) {
+		for (unsigned int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &cpuset))
+				stats->cpu_affinity |= UINT64_C(1) << i;
+		}
+	}
+
+	errno = 0;
+	ret = getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid));
+	if (errno == 0)
+		stats->nice = ret;
+
+	if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+		if (pthread_attr_getstacksize(&attr, &stack_size) == 0)
+			stats->stack_size = stack_size;
+		pthread_attr_destroy(&attr);
+	}
+#endif /* __linux__ */
+}
+
+
+void adec_thread_apply_config(struct adec_decoder *base)
+{
+	struct adec_decoder *self = base;
+	const struct adec_thread_config *config;
+	struct adec_thread_stats stats = {0};
+
+	ULOG_ERRNO_RETURN_IF(base == NULL, EINVAL);
+
+	config = &base->config.thread;
+
+	if (config->cpu_affinity != 0)
+		apply_affinity(self, config->cpu_affinity);
+
+	if (config->sched_policy != ADEC_SCHED_POLICY_DEFAULT)
+		apply_sched(self, config->sched_policy, config->sched_priority);
+	else if (config->nice != 0)
+		apply_nice(self, config->nice);
+
+	read_effective_settings(self, &stats);
+	stats.valid = 1;
+
+	ADEC_LOGI("decoder thread: affinity=0x%" PRIx64
+		  " policy=%s priority=%d nice=%d stack=%zu",
+		  stats.cpu_affinity,
+		  adec_sched_policy_str(stats.sched_policy),
+		  stats.sched_priority,
+		  stats.nice,
+		  stats.stack_size);
+
+	base->thread_stats = stats;
+	atomic_store_explicit(
+		&base->thread_stats_valid, 1, memory_order_release);
+}
@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ULOG_TAG adec_core
+#include "adec_core_priv.h"
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#endif /* __linux__ */
+
+
+/* Slot sequence number while a writer owns the slot */
+#define ADEC_TRACE_SLOT_BUSY UINT64_MAX
+
+
+struct adec_trace_slot {
+	/* Sequence number: position + 1 once the slot is written, 0 if
+	 * never written, ADEC_TRACE_SLOT_BUSY while being written */
+	atomic_uint_least64_t seq;
+	uint64_t ts_us;
+	uint32_t index;
+	uint32_t thread_id;
+	enum adec_trace_event_type type;
+};
+
+
+struct adec_trace {
+	atomic_uint_least64_t head;
+	uint64_t mask;
+	struct adec_trace_slot *slots;
+};
+
+
+static uint32_t get_thread_id(void)
+{
+	/* Cached per thread: the trace is recorded on the decoding path */
+	static __thread uint32_t tid;
+
+	if (tid == 0) {
+#ifdef __linux__
+		tid = (uint32_t)syscall(SYS_gettid);
+#else /* !__linux__ */
+		tid = (uint32_t)(uintptr_t)pthread_self();
+#endif /* !__linux__ */
+	}
+	return tid;
+}
+
+
+int adec_trace_new(unsigned int event_count, struct adec_trace **ret_obj)
+{
+	struct adec_trace *trace;
+	uint64_t size = 1;
+
+	ULOG_ERRNO_RETURN_ERR_IF(event_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	while (size < event_count)
+		size <<= 1;
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return -ENOMEM;
+	trace->slots = calloc(size, sizeof(*trace->slots));
+	if (trace->slots == NULL) {
+		free(trace);
+		return -ENOMEM;
+	}
+	trace->mask = size - 1;
+	atomic_init(&trace->head, 0);
+	for (uint64_t i = 0; i < size; i++)
+		atomic_init(&trace->slots[i].seq, 0);
+
+	*ret_obj = trace;
+	return 0;
+}
+
+
+void adec_trace_destroy(struct adec_trace *trace)
+{
+	if (trace == NULL)
+		return;
+
+	free(trace->slots);
+	free(trace);
+}
+
+
+void adec_trace_record(struct adec_decoder *base,
+		       enum adec_trace_event_type type,
+		       uint32_t index)
+{
+	struct adec_trace *trace = base->trace;
+	struct adec_trace_slot *slot;
+	uint64_t ts_us;
+	uint64_t pos, seq;
+
+	if (trace == NULL)
+		return;
+
+	/* Tracing was explicitly requested: timestamp events even if the
+	 * timing mode is ADEC_TIMING_MODE_NONE */
+	ts_us = adec_get_time_us(
+		(base->config.timing_mode == ADEC_TIMING_MODE_COARSE)
+			? ADEC_TIMING_MODE_COARSE
+			: ADEC_TIMING_MODE_PRECISE);
+
+	pos = atomic_fetch_add_explicit(&trace->head, 1, memory_order_relaxed);
+	slot = &trace->slots[pos & trace->mask];
+
+	/* Own the slot while it is being written; when the ring wraps
+	 * around faster than a writer, the slot can be owned or already
+	 * rewritten by a writer a lap ahead: the older event is dropped */
+	seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	do {
+		if (seq == ADEC_TRACE_SLOT_BUSY || seq > pos)
+			return;
+	} while (!atomic_compare_exchange_weak_explicit(&slot->seq,
+							&seq,
+							ADEC_TRACE_SLOT_BUSY,
+							memory_order_acquire,
+							memory_order_relaxed));
+	atomic_thread_fence(memory_order_release);
+	slot->ts_us = ts_us;
+	slot->index = index;
+	slot->thread_id = get_thread_id();
+	slot->type = type;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+
+int adec_trace_read(struct adec_trace *trace,
+		    struct adec_trace_event *events,
+		    size_t max_count)
+{
+	uint64_t head, start, pos, seq;
+	struct adec_trace_slot *slot;
+	struct adec_trace_event evt;
+	size_t count = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(trace == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(events == NULL && max_count > 0, EINVAL);
+
+	head = atomic_load_explicit(&trace->head, memory_order_acquire);
+	start = (head > trace->mask + 1) ? head - (trace->mask + 1) : 0;
+	if (head - start > max_count)
+		start = head - max_count;
+
+	for (pos = start; pos < head; pos++) {
+		slot = &trace->slots[pos & trace->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq != pos + 1)
+			continue;
+		evt.ts_us = slot->ts_us;
+		evt.index = slot->index;
+		evt.thread_id = slot->thread_id;
+		evt.type = slot->type;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) !=
+		    seq)
+			continue;
+		events[count++] = evt;
+	}
+
+	return (int)count;
+}
+
+
+static void export_text(const struct adec_trace_event *events,
+			int count,
+			FILE *stream)
+{
+	for (int i = 0; i < count; i++) {
+		fprintf(stream,
+			"%" PRIu64 " %s %" PRIu32 " %" PRIu32 "\n",
+			events[i].ts_us,
+			adec_trace_event_type_str(events[i].type),
+			events[i].index,
+			events[i].thread_id);
+	}
+}
+
+
+static void export_chrome_json(const struct adec_trace_event *events,
+			       int count,
+			       int dec_id,
+			       FILE *stream)
+{
+	const char *name, *ph;
+
+	fprintf(stream, "{\"traceEvents\":[");
+	for (int i = 0; i < count; i++) {
+		switch (events[i].type) {
+		case ADEC_TRACE_EVENT_DECODE_START:
+			name = "decode";
+			ph = "B";
+			break;
+		case ADEC_TRACE_EVENT_DECODE_END:
+			name = "decode";
+			ph = "E";
+			break;
+		default:
+			name = adec_trace_event_type_str(events[i].type);
+			ph = "i";
+			break;
+		}
+		fprintf(stream,
+			"%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRIu64
+			",\"pid\":%d,\"tid\":%" PRIu32
+			"%s,\"args\":{\"index\":%" PRIu32 "}}",
+			(i > 0) ? "," : "",
+			name,
+			ph,
+			events[i].ts_us,
+			dec_id,
+			events[i].thread_id,
+			(ph[0] == 'i') ? ",\"s\":\"t\"" : "",
+			events[i].index);
+	}
+	fprintf(stream, "\n]}\n");
+}
+
+
+int adec_trace_export(struct adec_trace *trace,
+		      enum adec_trace_format format,
+		      int dec_id,
+		      FILE *stream)
+{
+	int ret;
+	struct adec_trace_event *events;
+
+	ULOG_ERRNO_RETURN_ERR_IF(trace == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stream == NULL, EINVAL);
+
+	events = calloc(trace->mask + 1, sizeof(*events));
+	if (events == NULL)
+		return -ENOMEM;
+
+	ret = adec_trace_read(trace, events, trace->mask + 1);
+	if (ret < 0)
+		goto out;
+
+	switch (format) {
+	case ADEC_TRACE_FORMAT_TEXT:
+		export_text(events, ret, stream);
+		break;
+	case ADEC_TRACE_FORMAT_CHROME_JSON:
+		export_chrome_json(events, ret, dec_id, stream);
+		break;
+	default:
+		ret = -EINVAL;
+		ULOG_ERRNO("unsupported trace format %d", -ret, format);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	free(events);
+	return ret;
+}
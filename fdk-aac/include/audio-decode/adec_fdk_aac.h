@@ -48,6 +48,25 @@ extern "C" {
 struct adec_fdk_aac;
 
 
+/* FDK AAC specific configuration (see adec_config.implem_cfg) */
+struct adec_fdk_aac_config {
+	/* Must be ADEC_DECODER_IMPLEM_FDK_AAC */
+	enum adec_decoder_implem implem;
+
+	/* Use the real-valued (low-power) QMF filter bank in the SBR
+	 * reconstruction of HE-AAC streams (AAC_QMF_LOWPOWER); lowers the CPU
+	 * load at the cost of some aliasing in the high band. The SBR
+	 * reconstruction still runs: the FDK AAC library has no option to
+	 * output the core signal only */
+	int qmf_low_power;
+
+	/* Downmix the output to a single channel (AAC_PCM_MAX_OUTPUT_CHANNELS
+	 * set to 1); this does not bypass the SBR reconstruction, the output
+	 * sample rate is unchanged */
+	int mono_downmix;
+};
+
+
 extern ADEC_API const struct adec_ops adec_fdk_aac_ops;
 
 
@@ -34,62 +34,51 @@ ULOG_DECLARE_TAG(ULOG_TAG);
 #include "adec_fdk_aac_priv.h"
 
 
-#define NB_SUPPORTED_FORMATS 48
+static const unsigned int sample_rates[] = {
+	8000,
+	11025,
+	12000,
+	16000,
+	22050,
+	24000,
+	32000,
+	44100,
+	48000,
+	64000,
+	88200,
+	96000,
+};
+
+
+static const enum adef_aac_data_format data_formats[] = {
+	ADEF_AAC_DATA_FORMAT_RAW,
+	ADEF_AAC_DATA_FORMAT_ADTS,
+};
+
+
+#define NB_SUPPORTED_FORMATS                                                   \
+	(SIZEOF_ARRAY(data_formats) * SIZEOF_ARRAY(sample_rates) *             \
+	 ADEC_MAX_CHANNEL_COUNT)
 static struct adef_format supported_formats[NB_SUPPORTED_FORMATS];
 static pthread_once_t supported_formats_is_init = PTHREAD_ONCE_INIT;
 static void initialize_supported_formats(void)
 {
 	/* Note: The FDK library is based on fixed-point math and only supports
-	 * 16-bit integer AAC input. */
-	int i = 0;
-	supported_formats[i++] = adef_aac_lc_16b_8000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_8000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_11025hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_11025hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_12000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_12000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_16000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_16000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_22050hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_22050hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_24000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_24000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_32000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_32000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_44100hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_44100hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_48000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_48000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_64000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_64000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_88200hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_88200hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_96000hz_mono_raw;
-	supported_formats[i++] = adef_aac_lc_16b_96000hz_stereo_raw;
-	supported_formats[i++] = adef_aac_lc_16b_8000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_8000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_11025hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_11025hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_12000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_12000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_16000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_16000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_22050hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_22050hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_24000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_24000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_32000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_32000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_44100hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_44100hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_48000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_48000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_64000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_64000hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_88200hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_88200hz_stereo_adts;
-	supported_formats[i++] = adef_aac_lc_16b_96000hz_mono_adts;
-	supported_formats[i++] = adef_aac_lc_16b_96000hz_stereo_adts;
+	 * 16-bit integer AAC input. All the sample rates, from mono to 7.1,
+	 * in raw and ADTS data formats. */
+	struct adef_format *fmt = supported_formats;
+	for (size_t i = 0; i < NB_SUPPORTED_FORMATS; i++, fmt++) {
+		size_t c = i % ADEC_MAX_CHANNEL_COUNT;
+		size_t r = (i / ADEC_MAX_CHANNEL_COUNT) %
+			   SIZEOF_ARRAY(sample_rates);
+		size_t f = i / (ADEC_MAX_CHANNEL_COUNT *
+				SIZEOF_ARRAY(sample_rates));
+		fmt->encoding = ADEF_ENCODING_AAC_LC;
+		fmt->channel_count = c + 1;
+		fmt->bit_depth = 16;
+		fmt->sample_rate = sample_rates[r];
+		fmt->aac.data_format = data_formats[f];
+	}
 }
 
 
@@ -169,120 +158,118 @@ static const char *aac_decoder_error_to_str(AAC_DECODER_ERROR err)
 }
 
 
-static void call_flush_done(void *userdata)
+static const char *aot_to_str(AUDIO_OBJECT_TYPE aot)
 {
-	struct adec_fdk_aac *self = userdata;
-
-	adec_call_flush_cb(self->base);
+	switch (aot) {
+	case AOT_AAC_LC:
+		return "AAC_LC";
+	case AOT_SBR:
+		return "SBR";
+	case AOT_ER_AAC_LD:
+		return "ER_AAC_LD";
+	case AOT_PS:
+		return "PS";
+	case AOT_ER_AAC_ELD:
+		return "ER_AAC_ELD";
+	default:
+		return "UNKNOWN";
+	}
 }
 
 
-static void call_stop_done(void *userdata)
+/* Read the audio object type from an AudioSpecificConfig
+ * (ISO/IEC 14496-3 1.6.2.1) */
+static int get_asc_aot(const uint8_t *asc,
+		       size_t asc_size,
+		       AUDIO_OBJECT_TYPE *aot)
 {
-	struct adec_fdk_aac *self = userdata;
+	unsigned int val;
 
-	adec_call_stop_cb(self->base);
-}
-
-
-static void mbox_cb(int fd, uint32_t revents, void *userdata)
-{
-	struct adec_fdk_aac *self = userdata;
-	int ret, err;
-	char message;
+	if (asc == NULL || asc_size < 1)
+		return -EINVAL;
 
-	do {
-		/* Read from the mailbox */
-		ret = mbox_peek(self->mbox, &message);
-		if (ret < 0) {
-			if (ret != -EAGAIN)
-				ADEC_LOG_ERRNO("mbox_peek", -ret);
-			break;
-		}
+	val = asc[0] >> 3;
+	if (val == 31) {
+		/* Escape value: 6 more bits */
+		if (asc_size < 2)
+			return -EINVAL;
+		val = 32 + (((asc[0] & 0x07) << 3) | (asc[1] >> 5));
+	}
 
-		switch (message) {
-		case ADEC_MSG_FLUSH:
-			err = pomp_loop_idle_add_with_cookie(
-				self->base->loop, call_flush_done, self, self);
-			if (err < 0)
-				ADEC_LOG_ERRNO("pomp_loop_idle_add_with_cookie",
-					       -err);
-			break;
-		case ADEC_MSG_STOP:
-			err = pomp_loop_idle_add_with_cookie(
-				self->base->loop, call_stop_done, self, self);
-			if (err < 0)
-				ADEC_LOG_ERRNO("pomp_loop_idle_add_with_cookie",
-					       -err);
-			break;
-		default:
-			ADEC_LOGE("unknown message: %c", message);
-			break;
-		}
-	} while (ret == 0);
+	*aot = (AUDIO_OBJECT_TYPE)val;
+	return 0;
 }
 
 
-static void out_queue_evt_cb(struct pomp_evt *evt, void *userdata)
+/* Channels of a given type are numbered from the center outwards (front
+ * and height channels, center first for an odd count) or as left/right
+ * pairs (side and back channels, center last for an odd count) */
+static enum adec_channel
+channel_position(AUDIO_CHANNEL_TYPE type, unsigned int idx, unsigned int count)
 {
-	struct adec_fdk_aac *self = userdata;
-	struct mbuf_audio_frame *out_frame;
-	int err;
-
-	do {
-		err = mbuf_audio_frame_queue_pop(self->out_queue, &out_frame);
-		if (err == -EAGAIN) {
-			return;
-		} else if (err < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_pop:out_queue",
-				       -err);
-			return;
+	switch (type) {
+	case ACT_FRONT:
+		if (count % 2) {
+			if (idx == 0)
+				return ADEC_CHANNEL_FRONT_CENTER;
+			idx--;
 		}
-		struct adef_frame out_info = {};
-		err = mbuf_audio_frame_get_frame_info(out_frame, &out_info);
-		if (err < 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_get_frame_info", -err);
-
-		if (!atomic_load(&self->flush_discard))
-			adec_call_frame_output_cb(self->base, 0, out_frame);
-		else
-			ADEC_LOGD("discarding frame %d", out_info.info.index);
-		mbuf_audio_frame_unref(out_frame);
-	} while (err == 0);
+		return (idx % 2) ? ADEC_CHANNEL_FRONT_RIGHT
+				 : ADEC_CHANNEL_FRONT_LEFT;
+	case ACT_SIDE:
+		return (idx % 2) ? ADEC_CHANNEL_SIDE_RIGHT
+				 : ADEC_CHANNEL_SIDE_LEFT;
+	case ACT_BACK:
+		if ((count % 2) && (idx == count - 1))
+			return ADEC_CHANNEL_BACK_CENTER;
+		return (idx % 2) ? ADEC_CHANNEL_BACK_RIGHT
+				 : ADEC_CHANNEL_BACK_LEFT;
+	case ACT_LFE:
+		return ADEC_CHANNEL_LFE;
+	case ACT_FRONT_TOP:
+	case ACT_SIDE_TOP:
+	case ACT_BACK_TOP:
+	case ACT_TOP:
+		if (count % 2) {
+			if (idx == 0)
+				return ADEC_CHANNEL_TOP_CENTER;
+			idx--;
+		}
+		return (idx % 2) ? ADEC_CHANNEL_TOP_RIGHT
+				 : ADEC_CHANNEL_TOP_LEFT;
+	default:
+		return ADEC_CHANNEL_UNKNOWN;
+	}
 }
 
 
-static int complete_flush(struct adec_fdk_aac *self)
+static void build_channel_map(struct adec_fdk_aac *self)
 {
-	int ret;
+	const CStreamInfo *info = self->info;
+	unsigned int count = info->numChannels;
 
-	if (atomic_load(&self->flush_discard)) {
-		/* Flush the decoder input queue */
-		ret = mbuf_audio_frame_queue_flush(self->in_queue);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_flush:input",
-				       -ret);
-			return ret;
+	if (count > ADEC_MAX_CHANNEL_COUNT)
+		count = ADEC_MAX_CHANNEL_COUNT;
+
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int type_count = 0;
+		if (info->pChannelType == NULL ||
+		    info->pChannelIndices == NULL) {
+			self->channel_map[i] = ADEC_CHANNEL_UNKNOWN;
+			continue;
 		}
-		/* Flush the decoder output queue */
-		ret = mbuf_audio_frame_queue_flush(self->out_queue);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_flush:out_queue",
-				       -ret);
-			return ret;
+		for (unsigned int j = 0; j < count; j++) {
+			if (info->pChannelType[j] == info->pChannelType[i])
+				type_count++;
 		}
+		self->channel_map[i] =
+			channel_position(info->pChannelType[i],
+					 info->pChannelIndices[i],
+					 type_count);
 	}
 
-	atomic_store(&self->flushing, 0);
-	atomic_store(&self->flush_discard, 0);
-
-	/* Call the flush callback on the loop */
-	char message = ADEC_MSG_FLUSH;
-	ret = mbox_push(self->mbox, &message);
-	if (ret < 0)
-		ADEC_LOG_ERRNO("mbox_push", -ret);
-
-	return ret;
+	atomic_store_explicit(
+		&self->channel_count, count, memory_order_release);
 }
 
 
@@ -313,6 +300,20 @@ static int get_stream_info(struct adec_fdk_aac *self)
 	self->output_size = self->output_format.channel_count *
 			    self->output_format.bit_depth / 8 *
 			    self->info->frameSize;
+	/* Room for the samples added by the drift compensation */
+	self->output_max_size = self->output_size;
+	if (self->base->drift != NULL) {
+		self->output_max_size += self->output_format.channel_count *
+					 self->output_format.bit_depth / 8 *
+					 ADEC_DRIFT_MAX_EXTRA_SAMPLES;
+	}
+
+	ADEC_LOGI("stream info: aot=%s frame_size=%d output_delay=%u",
+		  aot_to_str(self->info->aot),
+		  self->info->frameSize,
+		  self->info->outputDelay);
+
+	build_channel_map(self);
 
 	self->output_format_valid = true;
 
@@ -320,92 +321,77 @@ static int get_stream_info(struct adec_fdk_aac *self)
 }
 
 
-static int decode_frame(struct adec_fdk_aac *self,
-			struct mbuf_audio_frame *in_frame)
+static int get_output_mem(struct adec_fdk_aac *self, struct mbuf_mem **mem)
 {
-	int ret = 0;
-	AAC_DECODER_ERROR err;
-	struct adef_frame in_info;
-	struct timespec cur_ts = {0, 0};
-	uint64_t ts_us;
-	const void *frame_data = NULL;
-	size_t frame_len = 0;
-	unsigned char *in_buffer[1] = {0};
-	unsigned int in_buffer_length[1] = {0};
-	unsigned int valid[1] = {0};
-	struct mbuf_mem *mem = NULL;
-	size_t mem_size;
-	uint8_t *data;
-	struct mbuf_audio_frame *out_frame = NULL;
-	struct adef_frame out_info;
-	bool has_decoded = false;
+	/* Decoder is not configured (yet), output buffer size is
+	 * unknown: a large-enough buffer is needed. */
+	return adec_output_get_mem(self->base,
+				   (self->output_size == 0)
+					   ? ADEC_MAX_OUTPUT_FRAME_SIZE
+					   : self->output_max_size,
+				   mem);
+}
 
-	if (in_frame == NULL)
-		return 0;
 
-	ret = mbuf_audio_frame_get_frame_info(in_frame, &in_info);
-	if (ret < 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_get_frame_info", -ret);
-		goto out;
-	}
-
-	if (!adef_format_intersect(
-		    &in_info.format, supported_formats, NB_SUPPORTED_FORMATS)) {
-		ret = -ENOSYS;
-		char *fmt = adef_format_to_str(&in_info.format);
-		ADEC_LOG_ERRNO("unsupported format: %s", -ret, fmt);
-		free(fmt);
-		goto out;
+/* Stream input: the output timestamps are derived from the number of samples
+ * output since the first input chunk */
+static void stream_output_info(struct adec_fdk_aac *self,
+			       struct adef_frame_info *info)
+{
+	info->timescale = self->stream_timescale;
+	info->timestamp = self->stream_ts_base;
+	if (self->info->sampleRate > 0) {
+		info->timestamp += self->stream_samples *
+				   self->stream_timescale /
+				   self->info->sampleRate;
 	}
+	info->index = self->stream_index++;
+	self->stream_samples += self->info->frameSize;
+}
 
-	ret = mbuf_audio_frame_get_buffer(in_frame, &frame_data, &frame_len);
-	if (ret != 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_get_buffer", -ret);
-		goto out;
-	}
 
-	time_get_monotonic(&cur_ts);
-	time_timespec_to_us(&cur_ts, &ts_us);
+/* Input buffers can carry several access units: the timestamp of the
+ * n-th output frame decoded from an input buffer is advanced by n frame
+ * durations */
+static void multi_au_output_info(struct adec_fdk_aac *self,
+				 struct adef_frame_info *info,
+				 unsigned int n)
+{
+	if (n == 0 || info->timescale == 0 || self->info->sampleRate <= 0)
+		return;
 
-	in_buffer[0] = (unsigned char *)frame_data;
-	in_buffer_length[0] = frame_len;
-	valid[0] = frame_len;
-	/* Loop until the whole frame has been digested. */
-	while (valid[0] > 0) {
-		/* Push the frame */
-		err = aacDecoder_Fill(
-			self->handle, in_buffer, in_buffer_length, valid);
-		if (err != AAC_DEC_OK) {
-			ret = -EPROTO;
-			ADEC_LOGE("aacDecoder_Fill: %s",
-				  aac_decoder_error_to_str(err));
-			goto out;
-		}
-	}
+	info->timestamp += (uint64_t)n * self->info->frameSize *
+			   info->timescale / self->info->sampleRate;
+}
 
-	err = mbuf_audio_frame_add_ancillary_buffer(
-		in_frame,
-		ADEC_ANCILLARY_KEY_DEQUEUE_TIME,
-		&ts_us,
-		sizeof(ts_us));
-	if (err != 0)
-		ADEC_LOG_ERRNO("mbuf_audio_frame_add_ancillary_buffer", -err);
 
-	self->base->counters.pushed++;
+/* Decode all the frames available in the decoder internal buffer; returns
+ * the number of decoded frames or a negative errno value; first is the
+ * number of frames already decoded from this input buffer, flags are passed
+ * to the first aacDecoder_DecodeFrame() call (with AACDEC_CONCEAL a single
+ * concealment frame is output) */
+static int decode_available(struct adec_fdk_aac *self,
+			    struct mbuf_audio_frame *in_frame,
+			    const struct adef_frame *in_info,
+			    unsigned int first,
+			    struct adec_timings *timings,
+			    UINT flags)
+{
+	int ret = 0, count = 0;
+	bool conceal = (flags & AACDEC_CONCEAL) != 0;
+	AAC_DECODER_ERROR err;
+	bool stream_input = self->base->config.stream_input;
+	struct mbuf_mem *mem = NULL;
+	size_t mem_size;
+	uint8_t *data;
+	struct adef_frame out_info;
+	uint64_t cpu_start;
 
 	/* Loop as long as the decoder outputs frames */
-	while (true) {
-		/* Decoder is not configured (yet), output buffer size is
-		 * unknown: allocate a large-enough buffer. */
-		if (self->output_size == 0)
-			mem_size = ADEC_DEFAULT_OUTPUT_SIZE;
-		else
-			mem_size = self->output_size;
-		ret = mbuf_mem_generic_new(mem_size, &mem);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_mem_generic_new", -ret);
+	while (!conceal || count == 0) {
+		ret = get_output_mem(self, &mem);
+		if (ret < 0)
 			goto out;
-		}
 		ret = mbuf_mem_get_data(mem, (void **)&data, &mem_size);
 		if (ret < 0) {
 			ADEC_LOG_ERRNO("mbuf_mem_get_data", -ret);
@@ -413,25 +399,46 @@ static int decode_frame(struct adec_fdk_aac *self,
 		}
 
 		/* Decode frame */
+		adec_trace_record(self->base,
+				  ADEC_TRACE_EVENT_DECODE_START,
+				  in_info->info.index);
+		cpu_start = adec_cpu_acct_start(self->base);
 		err = aacDecoder_DecodeFrame(
-			self->handle, (INT_PCM *)data, (mem_size / 2), 0);
+			self->handle, (INT_PCM *)data, (mem_size / 2), flags);
+		self->cpu_pending_ns +=
+			adec_cpu_acct_elapsed(self->base, cpu_start);
+		flags = 0;
+		adec_trace_record(self->base,
+				  ADEC_TRACE_EVENT_DECODE_END,
+				  in_info->info.index);
 		switch (err) {
 		case AAC_DEC_OK:
 			/* OK */
 			break;
 		case AAC_DEC_NOT_ENOUGH_BITS:
-			ret = has_decoded ? 0 : -ENOSPC;
+			ret = count;
 			goto out;
-			break;
 		default:
+			if (stream_input) {
+				/* The transport layer resynchronizes on the
+				 * next data by itself */
+				ADEC_LOGW("aacDecoder_DecodeFrame: %s",
+					  aac_decoder_error_to_str(err));
+				ret = count;
+				goto out;
+			}
 			ret = -EPROTO;
 			ADEC_LOGE("aacDecoder_DecodeFrame: %s",
 				  aac_decoder_error_to_str(err));
 			goto out;
 		}
 
-		has_decoded = true;
+		count++;
 		self->base->counters.pulled++;
+		/* The frame cost includes the calls that did not output any
+		 * frame since the previous one */
+		adec_cpu_acct_record(self->base, self->cpu_pending_ns);
+		self->cpu_pending_ns = 0;
 
 		if (!self->output_format_valid) {
 			/* Read stream info once one frame was decoded */
@@ -440,74 +447,34 @@ static int decode_frame(struct adec_fdk_aac *self,
 				ADEC_LOG_ERRNO("get_stream_info", -ret);
 				goto out;
 			}
-
-			mem_size = self->output_size;
 		}
 
 		/* Fill PCM frame info */
-		out_info.info = in_info.info;
+		out_info.info = in_info->info;
 		out_info.format = self->output_format;
-
-		ret = mbuf_audio_frame_new(&out_info, &out_frame);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_new", -ret);
-			goto out;
-		}
-
-		ret = mbuf_audio_frame_foreach_ancillary_data(
-			in_frame,
-			mbuf_audio_frame_ancillary_data_copier,
-			out_frame);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO(
-				"mbuf_audio_frame_foreach_ancillary_data",
-				-ret);
-			goto out;
-		}
-
-		ret = mbuf_audio_frame_set_buffer(
-			out_frame, mem, 0, self->output_size);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_set_buffer", -ret);
-			goto out;
-		}
-
-		time_get_monotonic(&cur_ts);
-		time_timespec_to_us(&cur_ts, &ts_us);
-
-		ret = mbuf_audio_frame_add_ancillary_buffer(
-			out_frame,
-			ADEC_ANCILLARY_KEY_OUTPUT_TIME,
-			&ts_us,
-			sizeof(ts_us));
-		if (ret < 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_add_ancillary_buffer",
-				       -ret);
-
-		ret = mbuf_audio_frame_finalize(out_frame);
-		if (ret < 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_finalize", -ret);
-
-		ret = mbuf_audio_frame_queue_push(self->out_queue, out_frame);
+		if (stream_input)
+			stream_output_info(self, &out_info.info);
+		else
+			multi_au_output_info(
+				self, &out_info.info, first + count - 1);
+
+		ret = adec_output_push(self->base,
+				       in_frame,
+				       &out_info,
+				       mem,
+				       self->info->frameSize,
+				       timings);
 		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_push:decoder",
-				       -ret);
+			ADEC_LOG_ERRNO("adec_output_push", -ret);
 			goto out;
 		}
 
-		if (mem != NULL) {
-			err = mbuf_mem_unref(mem);
-			if (err != 0)
-				ADEC_LOG_ERRNO("mbuf_mem_unref", -err);
-			mem = NULL;
-		}
-		if (out_frame != NULL) {
-			err = mbuf_audio_frame_unref(out_frame);
-			if (err != 0)
-				ADEC_LOG_ERRNO("mbuf_audio_frame_unref", -err);
-			out_frame = NULL;
-		}
+		err = mbuf_mem_unref(mem);
+		if (err != 0)
+			ADEC_LOG_ERRNO("mbuf_mem_unref", -err);
+		mem = NULL;
 	}
+	ret = count;
 
 out:
 	if (mem) {
@@ -515,189 +482,193 @@ out:
 		if (err != 0)
 			ADEC_LOG_ERRNO("mbuf_mem_unref", -err);
 	}
-	if (out_frame) {
-		err = mbuf_audio_frame_unref(out_frame);
-		if (err != 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_unref", -err);
-	}
-	if (frame_data)
-		mbuf_audio_frame_release_buffer(in_frame, frame_data);
 	return ret;
 }
 
 
-static int start_flush(struct adec_fdk_aac *self)
+/* Output a concealment frame in place of the input frames skipped before
+ * in_frame (skip-to-latest drop policy) */
+static int conceal_gap(struct adec_fdk_aac *self,
+		       struct mbuf_audio_frame *in_frame,
+		       const struct adef_frame *in_info,
+		       struct adec_timings *timings)
 {
-	int ret = 0;
+	struct adef_frame info = *in_info;
+	uint64_t duration = 0;
 
-	if (atomic_load(&self->flush_discard)) {
-		/* Flush the input queue */
-		ret = mbuf_audio_frame_queue_flush(self->in_queue);
-		if (ret < 0) {
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_flush:input",
-				       -ret);
-			return ret;
-		}
-		ret = aacDecoder_SetParam(
-			self->handle, AAC_TPDEC_CLEAR_BUFFER, 1);
-		if (ret != AAC_DEC_OK) {
-			ret = -EPROTO;
-			ADEC_LOGE("aacDecoder_SetParam: %s",
-				  aac_decoder_error_to_str(ret));
-			return -ret;
-		}
+	if (self->info->sampleRate > 0) {
+		duration = (uint64_t)self->info->frameSize *
+			   info.info.timescale / self->info->sampleRate;
 	}
+	if (info.info.timestamp >= duration)
+		info.info.timestamp -= duration;
+	if (info.info.index > 0)
+		info.info.index--;
 
-	atomic_store(&self->flush, 0);
-	atomic_store(&self->flushing, 1);
-
-	return ret;
+	return decode_available(
+		self, in_frame, &info, 0, timings, AACDEC_CONCEAL);
 }
 
 
-static void check_input_queue(struct adec_fdk_aac *self)
+static int decode_frame(struct adec_decoder *base,
+			struct mbuf_audio_frame *in_frame,
+			struct adec_timings *timings)
 {
-	int ret, err = 0;
-	struct mbuf_audio_frame *in_frame;
-
-	ret = mbuf_audio_frame_queue_peek(self->in_queue, &in_frame);
-	while (ret == 0) {
-		/* Push the input frame */
-		ret = decode_frame(self, in_frame);
-		if (ret < 0 && ret != -ENOSPC) {
-
-			if (ret != -EAGAIN)
-				ADEC_LOG_ERRNO("decode_frame", -ret);
-			err = -ENOSPC;
+	struct adec_fdk_aac *self = base->derived;
+	int ret = 0, count = 0;
+	AAC_DECODER_ERROR err;
+	struct adef_frame in_info;
+	bool stream_input = self->base->config.stream_input;
+	const void *frame_data = NULL;
+	size_t frame_len = 0;
+	unsigned char *in_buffer[1] = {0};
+	unsigned int in_buffer_length[1] = {0};
+	unsigned int valid[1] = {0};
+	unsigned int prev_valid;
+	UINT flags = 0;
+	uint64_t cpu_start;
+
+	ret = mbuf_audio_frame_get_frame_info(in_frame, &in_info);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_get_frame_info", -ret);
+		goto out;
+	}
+
+	/* In stream input mode the chunks format is not known */
+	if (!stream_input &&
+	    !adef_format_intersect(
+		    &in_info.format, supported_formats, NB_SUPPORTED_FORMATS)) {
+		ret = -ENOSYS;
+		ADEC_LOG_ERRNO("unsupported format: " ADEF_FORMAT_TO_STR_FMT,
+			       -ret,
+			       ADEF_FORMAT_TO_STR_ARG(&in_info.format));
+		goto out;
+	}
+
+	/* Audio frames hold a single memory: the data is accessed in place
+	 * and fed to the decoder without any copy */
+	ret = mbuf_audio_frame_get_buffer(in_frame, &frame_data, &frame_len);
+	if (ret != 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_get_buffer", -ret);
+		goto out;
+	}
+
+	adec_trace_record(
+		self->base, ADEC_TRACE_EVENT_DEQUEUE, in_info.info.index);
+
+	if (stream_input && !self->stream_started) {
+		/* Only the first chunk timestamp is used */
+		self->stream_ts_base = in_info.info.timestamp;
+		self->stream_timescale = in_info.info.timescale;
+		if (self->stream_timescale == 0)
+			self->stream_timescale = ADEC_FDK_AAC_STREAM_TIMESCALE;
+		self->stream_samples = 0;
+		self->stream_index = 0;
+		self->stream_started = true;
+	}
+
+	self->base->counters.pushed++;
+
+	if (self->conceal_pending) {
+		/* Input frames were skipped: conceal the gap, then have the
+		 * decoder resynchronize on the new data */
+		self->conceal_pending = false;
+		if (self->output_format_valid && !stream_input) {
+			ret = conceal_gap(self, in_frame, &in_info, timings);
+			if (ret < 0)
+				ADEC_LOG_ERRNO("conceal_gap", -ret);
 		}
-		if (in_frame != NULL) {
-			mbuf_audio_frame_unref(in_frame);
-			/* Pop the frame for real */
-			if (err == 0) {
-				ret = mbuf_audio_frame_queue_pop(self->in_queue,
-								 &in_frame);
-				if (ret < 0) {
-					ADEC_LOG_ERRNO(
-						"mbuf_audio_frame_queue_pop",
-						-ret);
-					break;
-				}
-				mbuf_audio_frame_unref(in_frame);
+		flags = AACDEC_INTR;
+	}
+
+	in_buffer[0] = (unsigned char *)frame_data;
+	in_buffer_length[0] = frame_len;
+	valid[0] = frame_len;
+	/* Interleave pushing and decoding until the whole input has been
+	 * digested: the decoder internal buffer might not be able to take it
+	 * at once (e.g. large chunks in stream input mode) */
+	do {
+		prev_valid = valid[0];
+		if (valid[0] > 0) {
+			cpu_start = adec_cpu_acct_start(self->base);
+			err = aacDecoder_Fill(self->handle,
+					      in_buffer,
+					      in_buffer_length,
+					      valid);
+			self->cpu_pending_ns +=
+				adec_cpu_acct_elapsed(self->base, cpu_start);
+			if (err != AAC_DEC_OK) {
+				ret = -EPROTO;
+				ADEC_LOGE("aacDecoder_Fill: %s",
+					  aac_decoder_error_to_str(err));
+				goto out;
 			}
 		}
-		if (err)
+
+		ret = decode_available(
+			self, in_frame, &in_info, count, timings, flags);
+		if (ret < 0)
+			goto out;
+		count += ret;
+		flags = 0;
+
+		if (valid[0] > 0 && valid[0] == prev_valid && ret == 0) {
+			/* No progress at all: retrying the frame would stall
+			 * the queue, drop it and clear the decoder internal
+			 * buffer instead */
+			ADEC_LOGW("decoder stalled, frame %u dropped",
+				  in_info.info.index);
+			err = aacDecoder_SetParam(
+				self->handle, AAC_TPDEC_CLEAR_BUFFER, 1);
+			if (err != AAC_DEC_OK) {
+				ADEC_LOGE("aacDecoder_SetParam: %s",
+					  aac_decoder_error_to_str(err));
+			}
+			atomic_fetch_add(&self->base->counters.in_dropped, 1);
+			if (stream_input)
+				self->stream_started = false;
+			else
+				self->conceal_pending = true;
 			break;
-		if (atomic_load(&self->flush)) {
-			ret = start_flush(self);
-			if (ret < 0)
-				ADEC_LOG_ERRNO("start_flush", -ret);
 		}
-		/* Peek the next frame */
-		ret = mbuf_audio_frame_queue_peek(self->in_queue, &in_frame);
-		if (ret < 0 && ret != -EAGAIN && ret != -ENOSPC)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_peek", -ret);
-	}
-	if (ret != -EAGAIN && ret != -ENOSPC)
-		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_peek", -ret);
-	if (atomic_load(&self->flush)) {
-		ret = start_flush(self);
-		if (ret < 0)
-			ADEC_LOG_ERRNO("start_flush", -ret);
-	}
-}
+	} while (valid[0] > 0);
 
+	/* Not all input frames output a frame (e.g. stream input chunks) */
+	ret = 0;
 
-static void input_event_cb(struct pomp_evt *evt, void *userdata)
-{
-	struct adec_fdk_aac *self = userdata;
-	check_input_queue(self);
+out:
+	if (frame_data)
+		mbuf_audio_frame_release_buffer(in_frame, frame_data);
+	return ret;
 }
 
 
-static void *adec_fdk_aac_decoder_thread(void *ptr)
+static void input_dropped(struct adec_decoder *base, bool skip)
 {
-	int ret;
-	struct adec_fdk_aac *self = ptr;
-	struct pomp_loop *loop = NULL;
-	struct pomp_evt *in_queue_evt = NULL;
-	int timeout;
-	char message;
-
-#if defined(__APPLE__)
-#	if !TARGET_OS_IPHONE
-	ret = pthread_setname_np("adec_fdkaac");
-	if (ret != 0)
-		ADEC_LOG_ERRNO("pthread_setname_np", ret);
-#	endif
-#else
-	ret = pthread_setname_np(pthread_self(), "adec_fdkaac");
-	if (ret != 0)
-		ADEC_LOG_ERRNO("pthread_setname_np", ret);
-#endif
-
-	loop = pomp_loop_new();
-	if (!loop) {
-		ADEC_LOG_ERRNO("pomp_loop_new", ENOMEM);
-		goto exit;
-	}
-	ret = mbuf_audio_frame_queue_get_event(self->in_queue, &in_queue_evt);
-	if (ret != 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_get_event", -ret);
-		goto exit;
-	}
-	ret = pomp_evt_attach_to_loop(in_queue_evt, loop, input_event_cb, self);
-	if (ret != 0) {
-		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop", -ret);
-		goto exit;
-	}
+	struct adec_fdk_aac *self = base->derived;
 
-	while (!atomic_load(&self->should_stop) ||
-	       atomic_load(&self->flushing)) {
-		/* Start flush, discarding all frames */
-		if ((atomic_load(&self->flushing))) {
-			ret = complete_flush(self);
-			if (ret < 0)
-				ADEC_LOG_ERRNO("complete_flush", -ret);
-			continue;
-		}
+	if (skip)
+		self->conceal_pending = true;
+	/* The next chunk starts a new stream */
+	self->stream_started = false;
+}
 
-		timeout = (atomic_load(&self->flushing) &&
-			   !atomic_load(&self->flush_discard))
-				  ? 0
-				  : 5;
-
-		ret = pomp_loop_wait_and_process(loop, timeout);
-		if (ret < 0 && ret != -ETIMEDOUT) {
-			ADEC_LOG_ERRNO("pomp_loop_wait_and_process", -ret);
-			if (!atomic_load(&self->should_stop)) {
-				/* Avoid looping on errors */
-				usleep(5000);
-			}
-			continue;
-		} else if (ret == -ETIMEDOUT) {
-			check_input_queue(self);
-		}
-	}
 
-	/* Call the stop callback on the loop */
-	message = ADEC_MSG_STOP;
-	ret = mbox_push(self->mbox, &message);
-	if (ret < 0)
-		ADEC_LOG_ERRNO("mbox_push", -ret);
+static void reset(struct adec_decoder *base)
+{
+	struct adec_fdk_aac *self = base->derived;
+	AAC_DECODER_ERROR err;
 
-exit:
-	if (in_queue_evt != NULL) {
-		ret = pomp_evt_detach_from_loop(in_queue_evt, loop);
-		if (ret != 0)
-			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop", -ret);
-	}
-	if (loop != NULL) {
-		ret = pomp_loop_destroy(loop);
-		if (ret != 0)
-			ADEC_LOG_ERRNO("pomp_loop_destroy", -ret);
+	/* The next chunk starts a new stream */
+	self->stream_started = false;
+	self->conceal_pending = false;
+	if (self->handle == NULL)
+		return;
+	err = aacDecoder_SetParam(self->handle, AAC_TPDEC_CLEAR_BUFFER, 1);
+	if (err != AAC_DEC_OK) {
+		ADEC_LOGE("aacDecoder_SetParam: %s",
+			  aac_decoder_error_to_str(err));
 	}
-
-	return NULL;
 }
 
 
@@ -712,15 +683,15 @@ static int get_supported_input_formats(const struct adef_format **formats)
 
 static int stop(struct adec_decoder *base)
 {
-	struct adec_fdk_aac *self = NULL;
-
-	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+	int ret;
 
-	self = base->derived;
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
 
 	/* Stop the decoding thread */
-	atomic_store(&self->should_stop, true);
-	self->base->configured = 0;
+	ret = adec_pipeline_stop(base->pipeline);
+	if (ret < 0)
+		return ret;
+	base->configured = 0;
 
 	return 0;
 }
@@ -737,49 +708,28 @@ static int destroy(struct adec_decoder *base)
 	if (self == NULL)
 		return 0;
 
-	/* Stop and join the decoding thread */
-	err = stop(base);
-	if (err < 0)
-		ADEC_LOG_ERRNO("adec_fdk_aac_stop", -err);
-	if (atomic_load(&self->thread_launched)) {
-		err = pthread_join(self->thread, NULL);
-		if (err != 0)
-			ADEC_LOG_ERRNO("pthread_join", err);
-	}
+	/* Stop and join the decoding thread, free the queues */
+	adec_pipeline_destroy(base->pipeline);
+	base->pipeline = NULL;
+	adec_output_destroy(base->output);
+	base->output = NULL;
 
 	/* Free the resources */
-	if (self->out_queue_evt != NULL) {
-		err = pomp_evt_detach_from_loop(self->out_queue_evt,
-						base->loop);
-		if (err < 0)
-			ADEC_LOG_ERRNO("pomp_evt_detach_from_loop", -err);
-	}
-	if (self->out_queue != NULL) {
-		err = mbuf_audio_frame_queue_destroy(self->out_queue);
+	if (self->in_pool != NULL) {
+		err = mbuf_pool_destroy(self->in_pool);
 		if (err < 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_destroy", -err);
-	}
-	if (self->in_queue != NULL) {
-		err = mbuf_audio_frame_queue_destroy(self->in_queue);
-		if (err < 0)
-			ADEC_LOG_ERRNO("mbuf_audio_frame_queue_destroy", -err);
-	}
-	if (self->mbox != NULL) {
-		err = pomp_loop_remove(base->loop,
-				       mbox_get_read_fd(self->mbox));
-		if (err < 0)
-			ADEC_LOG_ERRNO("pomp_loop_remove", -err);
-		mbox_destroy(self->mbox);
+			ADEC_LOG_ERRNO("mbuf_pool_destroy:input", -err);
+		adec_mem_release(base,
+				 ADEC_MEM_POOL,
+				 self->in_pool_mem_size * self->in_pool_count);
 	}
+	free(self->in_pool_data);
 
 	/* Close instance */
 	if (self->handle != NULL)
 		aacDecoder_Close(self->handle);
 
-	err = pomp_loop_idle_remove_by_cookie(base->loop, self);
-	if (err < 0)
-		ADEC_LOG_ERRNO("pomp_loop_idle_remove_by_cookie", -err);
-
+	pthread_mutex_destroy(&self->in_pool_mutex);
 	free(self);
 	base->derived = NULL;
 
@@ -787,52 +737,72 @@ static int destroy(struct adec_decoder *base)
 }
 
 
-static bool input_filter(struct mbuf_audio_frame *frame, void *userdata)
+static bool input_filter(struct adec_decoder *base,
+			 struct mbuf_audio_frame *frame,
+			 struct adef_frame *info)
 {
-	const void *tmp;
-	size_t tmplen;
-	struct adef_frame info;
-	int ret;
-	struct adec_fdk_aac *self = userdata;
+	if (base->config.stream_input) {
+		/* Arbitrary chunks of a byte stream: only the encoding and data
+		 * format are known, and timestamps are not used past the first
+		 * chunk */
+		return info->format.encoding == ADEF_ENCODING_AAC_LC &&
+		       info->format.aac.data_format ==
+			       ADEF_AAC_DATA_FORMAT_ADTS;
+	}
 
-	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, false);
+	/* Pass default filters first */
+	return adec_default_input_filter_internal(base,
+						  frame,
+						  info,
+						  supported_formats,
+						  NB_SUPPORTED_FORMATS);
+}
 
-	if (atomic_load(&self->flushing) || atomic_load(&self->should_stop))
-		return false;
 
-	ret = mbuf_audio_frame_get_frame_info(frame, &info);
-	if (ret != 0)
-		return false;
+/* Whether the input frame memory is one of the input pool initial
+ * memories, already accounted in the memory budget */
+static bool input_pooled(struct adec_decoder *base,
+			 struct mbuf_audio_frame *frame)
+{
+	int ret;
+	struct adec_fdk_aac *self = base->derived;
+	const void *data;
+	size_t len;
+	uintptr_t addr, start;
+	bool pooled = false;
 
-	/* Pass default filters first */
-	if (!adec_default_input_filter_internal(self->base,
-						frame,
-						&info,
-						supported_formats,
-						NB_SUPPORTED_FORMATS))
+	ret = mbuf_audio_frame_get_buffer(frame, &data, &len);
+	if (ret < 0)
 		return false;
+	addr = (uintptr_t)data;
 
-	/* Input frame must be packed */
-	ret = mbuf_audio_frame_get_buffer(frame, &tmp, &tmplen);
-	if (ret != 0)
-		return false;
+	pthread_mutex_lock(&self->in_pool_mutex);
+	for (unsigned int i = 0; i < self->in_pool_count && !pooled; i++) {
+		start = (uintptr_t)self->in_pool_data[i];
+		pooled = addr >= start &&
+			 addr < start + self->in_pool_mem_size;
+	}
+	pthread_mutex_unlock(&self->in_pool_mutex);
 
-	mbuf_audio_frame_release_buffer(frame, tmp);
+	mbuf_audio_frame_release_buffer(frame, data);
+	return pooled;
+}
 
-	adec_default_input_filter_internal_confirm_frame(
-		self->base, frame, &info);
 
-	return true;
-}
+static const struct adec_pipeline_cbs pipeline_cbs = {
+	.accept = input_filter,
+	.decode = decode_frame,
+	.dropped = input_dropped,
+	.reset = reset,
+	.pooled = input_pooled,
+};
 
 
 static int create(struct adec_decoder *base)
 {
 	int ret = 0;
 	struct adec_fdk_aac *self = NULL;
-	struct mbuf_audio_frame_queue_args queue_args = {
-		.filter = input_filter,
-	};
+	struct adec_config_impl *specific;
 
 	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
 
@@ -853,64 +823,31 @@ static int create(struct adec_decoder *base)
 		return -ENOMEM;
 	self->base = base;
 	base->derived = self;
-	queue_args.filter_userdata = self;
+	pthread_mutex_init(&self->in_pool_mutex, NULL);
 
-	/* Initialize the mailbox for inter-thread messages  */
-	self->mbox = mbox_new(1);
-	if (self->mbox == NULL) {
-		ret = -ENOMEM;
-		ADEC_LOG_ERRNO("mbox_new", -ret);
-		goto error;
-	}
-	ret = pomp_loop_add(base->loop,
-			    mbox_get_read_fd(self->mbox),
-			    POMP_FD_EVENT_IN,
-			    &mbox_cb,
-			    self);
-	if (ret < 0) {
-		ADEC_LOG_ERRNO("pomp_loop_add", -ret);
-		goto error;
-	}
+	/* The specific configuration is only valid during adec_new() */
+	specific = adec_config_get_specific(&base->config,
+					    ADEC_DECODER_IMPLEM_FDK_AAC);
+	if (specific != NULL)
+		self->config = *(struct adec_fdk_aac_config *)specific;
+	self->config.implem = ADEC_DECODER_IMPLEM_FDK_AAC;
+	base->config.implem_cfg = NULL;
 
 	ADEC_LOGI("FDK_AAC implementation");
 
-	/* Create the ouput buffers queue */
-	ret = mbuf_audio_frame_queue_new(&self->out_queue);
-	if (ret < 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_new:output", -ret);
-		goto error;
-	}
-	ret = mbuf_audio_frame_queue_get_event(self->out_queue,
-					       &self->out_queue_evt);
-	if (ret != 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_get_event", -ret);
-		goto error;
-	}
-	ret = pomp_evt_attach_to_loop(
-		self->out_queue_evt, base->loop, &out_queue_evt_cb, self);
+	ret = adec_output_new(base, ADEC_DEFAULT_OUTPUT_SIZE, &base->output);
 	if (ret < 0) {
-		ADEC_LOG_ERRNO("pomp_evt_attach_to_loop", -ret);
+		ADEC_LOG_ERRNO("adec_output_new", -ret);
 		goto error;
 	}
 
-	/* Create the input buffers queue */
-	ret = mbuf_audio_frame_queue_new_with_args(&queue_args,
-						   &self->in_queue);
+	ret = adec_pipeline_new(
+		base, &pipeline_cbs, "adec_fdkaac", &base->pipeline);
 	if (ret < 0) {
-		ADEC_LOG_ERRNO("mbuf_audio_frame_queue_new_with_args", -ret);
-		goto error;
-	}
-
-	ret = pthread_create(
-		&self->thread, NULL, adec_fdk_aac_decoder_thread, self);
-	if (ret != 0) {
-		ret = -ret;
-		ADEC_LOG_ERRNO("pthread_create", -ret);
+		ADEC_LOG_ERRNO("adec_pipeline_new", -ret);
 		goto error;
 	}
 
-	atomic_store(&self->thread_launched, true);
-
 	return 0;
 
 error:
@@ -923,16 +860,9 @@ error:
 
 static int flush(struct adec_decoder *base, int discard)
 {
-	struct adec_fdk_aac *self = NULL;
-
-	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
-
-	self = base->derived;
-
-	atomic_store(&self->flush, 1);
-	atomic_store(&self->flush_discard, discard);
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
 
-	return 0;
+	return adec_pipeline_flush(base->pipeline, discard);
 }
 
 
@@ -964,6 +894,13 @@ static int set_aac_asc(struct adec_decoder *base,
 		return ret;
 	}
 
+	if (base->config.stream_input && tt != TT_MP4_ADTS) {
+		ret = -ENOSYS;
+		ADEC_LOG_ERRNO("stream input requires the ADTS data format",
+			       -ret);
+		return ret;
+	}
+
 	/* Initialize the decoder */
 	self->handle = aacDecoder_Open(tt, 1);
 	if (self->handle == NULL) {
@@ -972,6 +909,34 @@ static int set_aac_asc(struct adec_decoder *base,
 		return ret;
 	}
 
+	self->aot = AOT_NONE;
+	if (tt == TT_MP4_RAW) {
+		/* The encoding is always AAC_LC in the audio format; the actual
+		 * audio object type is only known from the ASC */
+		ret = get_asc_aot(asc, asc_size, &self->aot);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("get_asc_aot", -ret);
+			return ret;
+		}
+		switch (self->aot) {
+		case AOT_AAC_LC:
+		case AOT_SBR:
+		case AOT_PS:
+			break;
+		case AOT_ER_AAC_LD:
+		case AOT_ER_AAC_ELD:
+			self->low_delay = true;
+			break;
+		default:
+			ret = -ENOSYS;
+			ADEC_LOG_ERRNO("unsupported audio object type %d",
+				       -ret,
+				       self->aot);
+			return ret;
+		}
+		ADEC_LOGI("audio object type: %s", aot_to_str(self->aot));
+	}
+
 	if (tt == TT_MP4_RAW) {
 		unsigned char *conf[] = {(uint8_t *)asc};
 		unsigned int conf_len[] = {asc_size};
@@ -994,31 +959,199 @@ static int set_aac_asc(struct adec_decoder *base,
 		return ret;
 	}
 
+	if (self->config.qmf_low_power) {
+		err = aacDecoder_SetParam(self->handle, AAC_QMF_LOWPOWER, 1);
+		if (err != AAC_DEC_OK) {
+			ret = -EPROTO;
+			ADEC_LOGE("aacDecoder_SetParam:AAC_QMF_LOWPOWER: %s",
+				  aac_decoder_error_to_str(err));
+			return ret;
+		}
+	}
+
+	if (self->config.mono_downmix) {
+		err = aacDecoder_SetParam(
+			self->handle, AAC_PCM_MAX_OUTPUT_CHANNELS, 1);
+		if (err != AAC_DEC_OK) {
+			ret = -EPROTO;
+			ADEC_LOGE("aacDecoder_SetParam:"
+				  "AAC_PCM_MAX_OUTPUT_CHANNELS: %s",
+				  aac_decoder_error_to_str(err));
+			return ret;
+		}
+	}
+
+	/* The decoder interleaves the output samples directly in the
+	 * requested order */
+	err = aacDecoder_SetParam(
+		self->handle,
+		AAC_PCM_OUTPUT_CHANNEL_MAPPING,
+		(base->config.output_channel_order == ADEC_CHANNEL_ORDER_MPEG)
+			? 0
+			: 1);
+	if (err != AAC_DEC_OK) {
+		ret = -EPROTO;
+		ADEC_LOGE("aacDecoder_SetParam:"
+			  "AAC_PCM_OUTPUT_CHANNEL_MAPPING: %s",
+			  aac_decoder_error_to_str(err));
+		return ret;
+	}
+
+	if (self->low_delay) {
+		/* The PCM limiter adds its own lookahead delay */
+		err = aacDecoder_SetParam(
+			self->handle, AAC_PCM_LIMITER_ENABLE, 0);
+		if (err != AAC_DEC_OK) {
+			ret = -EPROTO;
+			ADEC_LOGE("aacDecoder_SetParam:"
+				  "AAC_PCM_LIMITER_ENABLE: %s",
+				  aac_decoder_error_to_str(err));
+			return ret;
+		}
+	}
+
 	return 0;
 }
 
 
+/* Record the data of the input pool memories (called with in_pool_mutex
+ * held, before the pool is returned) */
+static int record_in_pool(struct adec_fdk_aac *self, unsigned int count)
+{
+	int ret = 0;
+	struct mbuf_mem **mems;
+	size_t capacity;
+	unsigned int i;
+
+	self->in_pool_data = calloc(count, sizeof(*self->in_pool_data));
+	mems = calloc(count, sizeof(*mems));
+	if (self->in_pool_data == NULL || mems == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		ret = mbuf_pool_get(self->in_pool, &mems[i]);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_pool_get:input", -ret);
+			goto out;
+		}
+		ret = mbuf_mem_get_data(
+			mems[i], &self->in_pool_data[i], &capacity);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("mbuf_mem_get_data", -ret);
+			goto out;
+		}
+	}
+
+out:
+	for (i = 0; mems != NULL && i < count && mems[i] != NULL; i++)
+		mbuf_mem_unref(mems[i]);
+	free(mems);
+	return ret;
+}
+
+
 static struct mbuf_pool *get_input_buffer_pool(struct adec_decoder *base)
 {
+	int ret;
 	struct adec_fdk_aac *self = NULL;
+	struct adec_memory_usage usage;
+	enum mbuf_pool_grow_policy grow;
+	unsigned int channels, count;
+	size_t size;
 
 	ADEC_LOG_ERRNO_RETURN_VAL_IF(base == NULL, EINVAL, NULL);
 	self = base->derived;
 
-	/* No input buffer pool allocated: use the application's */
-	return NULL;
+	/* NULL in stream input mode: use the application's */
+	if (base->config.stream_input)
+		return NULL;
+
+	/* Created on first use: one memory holds an access unit of the
+	 * maximum size for the expected channel count. The pool is accounted
+	 * in the memory budget; it only grows if the application holds more
+	 * memories than the preferred count and the memory budget group has
+	 * no budget (the grown memories are then accounted as queued input
+	 * frames) */
+	pthread_mutex_lock(&self->in_pool_mutex);
+	if (self->in_pool != NULL)
+		goto out;
+	channels = base->config.preferred_output_format.channel_count;
+	if (channels == 0 || channels > ADEC_MAX_CHANNEL_COUNT)
+		channels = ADEC_MAX_CHANNEL_COUNT;
+	count = base->config.preferred_min_in_buf_count;
+	if (count == 0)
+		count = ADEC_FDK_AAC_DEFAULT_IN_BUF_COUNT;
+	size = channels * ADEC_FDK_AAC_MAX_AU_SIZE_PER_CHANNEL +
+	       ADEC_FDK_AAC_ADTS_HEADER_SIZE;
+	ret = adec_mem_charge(base, ADEC_MEM_POOL, size * count, 0);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_mem_charge:input", -ret);
+		goto out;
+	}
+	(void)adec_mem_get_usage(base, &usage);
+	grow = (usage.group_budget_bytes == 0) ? MBUF_POOL_SMART_GROW
+					       : MBUF_POOL_NO_GROW;
+	ret = mbuf_pool_new(mbuf_mem_generic_impl,
+			    size,
+			    count,
+			    grow,
+			    (grow == MBUF_POOL_NO_GROW) ? count : 0,
+			    "adec_fdk_aac_in_pool",
+			    &self->in_pool);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_pool_new:input", -ret);
+		self->in_pool = NULL;
+		adec_mem_release(base, ADEC_MEM_POOL, size * count);
+		goto out;
+	}
+	ret = record_in_pool(self, count);
+	if (ret < 0) {
+		(void)mbuf_pool_destroy(self->in_pool);
+		self->in_pool = NULL;
+		free(self->in_pool_data);
+		self->in_pool_data = NULL;
+		adec_mem_release(base, ADEC_MEM_POOL, size * count);
+		goto out;
+	}
+	self->in_pool_mem_size = size;
+	self->in_pool_count = count;
+
+out:
+	pthread_mutex_unlock(&self->in_pool_mutex);
+	return self->in_pool;
 }
 
 
 static struct mbuf_audio_frame_queue *
 get_input_buffer_queue(struct adec_decoder *base)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(base == NULL, EINVAL, NULL);
+
+	return adec_pipeline_get_input_queue(base->pipeline);
+}
+
+
+static int get_output_channel_map(struct adec_decoder *base,
+				  enum adec_channel *map,
+				  size_t max_count)
 {
 	struct adec_fdk_aac *self = NULL;
+	unsigned int count;
 
-	ADEC_LOG_ERRNO_RETURN_VAL_IF(base == NULL, EINVAL, NULL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
 	self = base->derived;
 
-	return self->in_queue;
+	count = atomic_load_explicit(&self->channel_count,
+				     memory_order_acquire);
+	if (count == 0)
+		return -EAGAIN;
+	if (max_count < count)
+		return -ENOBUFS;
+
+	memcpy(map, self->channel_map, count * sizeof(*map));
+
+	return count;
 }
 
 
@@ -1031,4 +1164,5 @@ const struct adec_ops adec_fdk_aac_ops = {
 	.set_aac_asc = set_aac_asc,
 	.get_input_buffer_pool = get_input_buffer_pool,
 	.get_input_buffer_queue = get_input_buffer_queue,
+	.get_output_channel_map = get_output_channel_map,
 };
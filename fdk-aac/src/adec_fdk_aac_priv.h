@@ -36,6 +36,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
 
 #if defined(__APPLE__)
 #	include <TargetConditionals.h>
@@ -44,39 +46,65 @@
 #include <audio-decode/adec_fdk_aac.h>
 #include <audio-decode/adec_internal.h>
 #include <fdk-aac/aacdecoder_lib.h>
-#include <futils/mbox.h>
+#include <futils/futils.h>
 #include <futils/timetools.h>
 #include <media-buffers/mbuf_audio_frame.h>
 #include <media-buffers/mbuf_mem.h>
 #include <media-buffers/mbuf_mem_generic.h>
 
 #define ADEC_DEFAULT_OUTPUT_SIZE (50 * 1024)
-
-#define ADEC_MSG_FLUSH 'f'
-#define ADEC_MSG_STOP 's'
+#define ADEC_FDK_AAC_DEFAULT_IN_BUF_COUNT 10
+/* Maximum AAC access unit size per channel (6144 bits, ISO/IEC 14496-3
+ * 4.5.3.1) and ADTS header size (with CRC) */
+#define ADEC_FDK_AAC_MAX_AU_SIZE_PER_CHANNEL (6144 / 8)
+#define ADEC_FDK_AAC_ADTS_HEADER_SIZE 9
+/* Timescale used in stream input mode if the first chunk has none */
+#define ADEC_FDK_AAC_STREAM_TIMESCALE 1000000
 
 
 struct adec_fdk_aac {
 	struct adec_decoder *base;
-	struct mbuf_audio_frame_queue *in_queue;
-	struct mbuf_audio_frame_queue *decoder_queue;
-	struct mbuf_audio_frame_queue *out_queue;
-	struct pomp_evt *out_queue_evt;
+	/* Input memories pool, sized for the largest access unit, created
+	 * on the first get_input_buffer_pool() call and accounted in the
+	 * memory budget; the data of its initial memories is recorded so
+	 * that the input frames using them are not accounted again */
+	struct mbuf_pool *in_pool;
+	size_t in_pool_mem_size;
+	unsigned int in_pool_count;
+	void **in_pool_data;
+	pthread_mutex_t in_pool_mutex;
 
-	pthread_t thread;
-	atomic_int thread_launched;
-	atomic_int should_stop;
-	atomic_int flush;
-	atomic_int flushing;
-	atomic_int flush_discard;
-	struct mbox *mbox;
+	/* Input frames were skipped, conceal the gap (decoder thread only) */
+	bool conceal_pending;
+	/* CPU time spent in the decoder library since the last decoded
+	 * frame, in nanoseconds (decoder thread only) */
+	uint64_t cpu_pending_ns;
+	struct adec_fdk_aac_config config;
 
 	HANDLE_AACDECODER handle;
+	/* Audio object type from the ASC (AOT_NONE if unknown) */
+	AUDIO_OBJECT_TYPE aot;
+	/* Low-delay profile (AAC-LD or AAC-ELD) */
+	bool low_delay;
 	CHANNEL_MODE mode;
 	CStreamInfo *info;
 	struct adef_format output_format;
 	unsigned int output_size;
+	/* Output memory size, larger than output_size with drift
+	 * compensation */
+	unsigned int output_max_size;
 	bool output_format_valid;
+	/* Output channel map, written by the decoder thread before setting
+	 * channel_count (0 means unknown) */
+	enum adec_channel channel_map[ADEC_MAX_CHANNEL_COUNT];
+	atomic_uint channel_count;
+
+	/* Stream input mode state (decoder thread only) */
+	bool stream_started;
+	uint64_t stream_ts_base;
+	unsigned int stream_timescale;
+	uint64_t stream_samples;
+	unsigned int stream_index;
 };
 
 #endif /* _ADEC_FDK_AAC_PRIV_H_ */
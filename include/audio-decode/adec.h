@@ -28,6 +28,7 @@
 #define _ADEC_H_
 
 #include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 
 #include <audio-decode/adec_core.h>
@@ -112,8 +113,18 @@ ADEC_API int adec_new(struct pomp_loop *loop,
  * retained by the decoder. If the buffers are not discarded the frame
  * output callback is called for each frame when the decoding is complete.
  * The function is asynchronous and returns immediately. When flushing is
- * complete the flush callback function is called if defined. After flushing
- * the decoder new input buffers can still be queued but should start with a
+ * complete the flush callback function is called if defined.
+ * A non-discarding flush acts as a barrier: input buffers can still be
+ * queued while it is in progress; they are decoded after the buffers queued
+ * before the flush, and their output frames are delivered after the flush
+ * callback. Each non-discarding flush is reported by its own flush callback,
+ * in order, called from an idle function of the loop; up to 8 of them can
+ * be pending (-EBUSY is returned beyond). A discarding flush rejects input
+ * buffers until it is complete, and also completes the pending
+ * non-discarding flushes: their flush callbacks are called, in order,
+ * before its own. Only one discarding flush can be pending, and no flush
+ * can be requested while it is (-EBUSY is returned). After flushing the
+ * decoder new input buffers can still be queued but should start with a
  * synchronization frame (e.g. IDR frame or start of refresh).
  * @param self: decoder instance handle
  * @param discard: if null, all pending buffers are output, otherwise they
@@ -148,6 +159,37 @@ ADEC_API int adec_stop(struct adec_decoder *self);
 ADEC_API int adec_destroy(struct adec_decoder *self);
 
 
+/**
+ * Get the trace events recorded by the decoder.
+ * Tracing must have been enabled by setting a non-null trace_event_count in
+ * the decoder configuration. The most recent events (at most max_count) are
+ * copied, oldest first. This function can be called at any time.
+ * @param self: decoder instance handle
+ * @param events: trace events array (output)
+ * @param max_count: size of the events array
+ * @return the number of events copied, or a negative errno value in case
+ * of error
+ */
+ADEC_API int adec_get_trace_events(struct adec_decoder *self,
+				   struct adec_trace_event *events,
+				   size_t max_count);
+
+
+/**
+ * Export the trace events recorded by the decoder.
+ * Tracing must have been enabled by setting a non-null trace_event_count in
+ * the decoder configuration. The ADEC_TRACE_FORMAT_CHROME_JSON format can be
+ * loaded in chrome://tracing or in the Perfetto UI.
+ * @param self: decoder instance handle
+ * @param format: export format
+ * @param stream: output stream
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_export_trace(struct adec_decoder *self,
+			       enum adec_trace_format format,
+			       FILE *stream);
+
+
 /**
  * Set the AAC audio specific config for decoding.
  * This function must be called prior to decoding (i.e. pushing buffer into
@@ -194,6 +236,112 @@ ADEC_API struct mbuf_audio_frame_queue *
 adec_get_input_buffer_queue(struct adec_decoder *self);
 
 
+/**
+ * Get the decoder statistics.
+ * The statistics include the frame counters and the effective settings of
+ * the decoder thread (see struct adec_thread_config); the latter are only
+ * valid once the decoder thread has started (stats->thread.valid).
+ * @param self: decoder instance handle
+ * @param stats: decoder statistics (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_get_stats(struct adec_decoder *self,
+			    struct adec_stats *stats);
+
+
+/**
+ * Get the decoder timings of an output frame (input, dequeue and output
+ * times), from the ADEC_ANCILLARY_KEY_TIMINGS record attached to the frame
+ * (see adec_frame_get_timings()). They can be read from any thread, e.g.
+ * from the frame output callback, for as long as the frame is held.
+ * @param self: decoder instance handle
+ * @param frame: output frame
+ * @param timings: decoder timings (output)
+ * @return 0 on success, -ENOENT if the frame has no timings (timing mode
+ *         ADEC_TIMING_MODE_NONE), negative errno value in case of error
+ */
+ADEC_API int adec_get_frame_timings(struct adec_decoder *self,
+				    struct mbuf_audio_frame *frame,
+				    struct adec_timings *timings);
+
+
+/**
+ * Get the decoder CPU accounting statistics.
+ * CPU accounting must have been enabled by setting cpu_accounting in the
+ * decoder configuration. The CPU time is measured on the decoding thread
+ * clock around each decoder library call, so that it is attributed to this
+ * instance even when several instances share a thread. This function can be
+ * called at any time.
+ * @param self: decoder instance handle
+ * @param stats: CPU statistics (output)
+ * @return 0 on success, -ENOSYS if CPU accounting is disabled, negative
+ *         errno value in case of error
+ */
+ADEC_API int adec_get_cpu_stats(struct adec_decoder *self,
+				struct adec_cpu_stats *stats);
+
+
+/**
+ * Get the decoder memory usage.
+ * The memory accounted in the decoder memory budget group (see the
+ * mem_group configuration field) is reported per category, along with the
+ * group usage and budget. This function can be called at any time.
+ * @param self: decoder instance handle
+ * @param usage: memory usage (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ADEC_API int adec_get_memory_usage(struct adec_decoder *self,
+				   struct adec_memory_usage *usage);
+
+
+/**
+ * Report the playout position for the drift compensation.
+ * Drift compensation must have been enabled by setting drift_compensation
+ * in the decoder configuration. The application reports the timestamp of
+ * the output sample currently being played by the audio device, in
+ * microseconds in the output frames time base (adef_frame timestamp and
+ * timescale). The latency controlled by the drift compensation is the
+ * difference between the end of the newest output frame and this
+ * timestamp, extrapolated to the time of the measure; reporting a few times
+ * per second is enough. This function can be called from any thread.
+ * @param self: decoder instance handle
+ * @param timestamp_us: timestamp of the sample being played in microseconds
+ * @return 0 on success, -ENOSYS if drift compensation is disabled, negative
+ *         errno value in case of error
+ */
+ADEC_API int adec_set_playout_time(struct adec_decoder *self,
+				   uint64_t timestamp_us);
+
+
+/**
+ * Get the drift compensation status.
+ * This function can be called at any time.
+ * @param self: decoder instance handle
+ * @param stats: drift compensation status (output)
+ * @return 0 on success, -ENOSYS if drift compensation is disabled, negative
+ *         errno value in case of error
+ */
+ADEC_API int adec_get_drift_stats(struct adec_decoder *self,
+				  struct adec_drift_stats *stats);
+
+
+/**
+ * Get the output channel map.
+ * The channel map gives the position of each channel in the interleaved
+ * output frames (see the output_channel_order configuration field). It is
+ * only known once the first frame has been decoded.
+ * @param self: decoder instance handle
+ * @param map: channel positions array (output)
+ * @param max_count: size of the map array
+ * @return the output channel count on success, -EAGAIN if the output format
+ *         is not known yet, -ENOSYS if the implementation does not provide
+ *         a channel map, negative errno value in case of error
+ */
+ADEC_API int adec_get_output_channel_map(struct adec_decoder *self,
+					enum adec_channel *map,
+					size_t max_count);
+
+
 /**
  * Get the decoder implementation used.
  * @param self: decoder instance handle
@@ -0,0 +1,327 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define ULOG_TAG adec_null
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+
+#include "adec_null_priv.h"
+
+
+static const unsigned int sample_rates[] = {
+	8000,
+	11025,
+	12000,
+	16000,
+	22050,
+	24000,
+	32000,
+	44100,
+	48000,
+	64000,
+	88200,
+	96000,
+};
+
+
+static const enum adef_aac_data_format data_formats[] = {
+	ADEF_AAC_DATA_FORMAT_RAW,
+	ADEF_AAC_DATA_FORMAT_ADTS,
+};
+
+
+#define NB_SUPPORTED_FORMATS                                                   \
+	(SIZEOF_ARRAY(data_formats) * SIZEOF_ARRAY(sample_rates) *             \
+	 ADEC_MAX_CHANNEL_COUNT)
+static struct adef_format supported_formats[NB_SUPPORTED_FORMATS];
+static pthread_once_t supported_formats_is_init = PTHREAD_ONCE_INIT;
+static void initialize_supported_formats(void)
+{
+	/* Accept the same AAC-LC formats as the FDK AAC implementation so that
+	 * both can be compared on the same streams */
+	struct adef_format *fmt = supported_formats;
+	for (size_t i = 0; i < NB_SUPPORTED_FORMATS; i++, fmt++) {
+		size_t c = i % ADEC_MAX_CHANNEL_COUNT;
+		size_t r = (i / ADEC_MAX_CHANNEL_COUNT) %
+			   SIZEOF_ARRAY(sample_rates);
+		size_t f = i / (ADEC_MAX_CHANNEL_COUNT *
+				SIZEOF_ARRAY(sample_rates));
+		fmt->encoding = ADEF_ENCODING_AAC_LC;
+		fmt->channel_count = c + 1;
+		fmt->bit_depth = 16;
+		fmt->sample_rate = sample_rates[r];
+		fmt->aac.data_format = data_formats[f];
+	}
+}
+
+
+static int decode_frame(struct adec_decoder *base,
+			struct mbuf_audio_frame *in_frame,
+			struct adec_timings *timings)
+{
+	int ret, err;
+	struct adec_decoder *self = base;
+	struct adef_frame in_info;
+	struct mbuf_mem *mem = NULL;
+	size_t mem_size, out_size;
+	void *data;
+	struct adef_frame out_info = {0};
+
+	ret = mbuf_audio_frame_get_frame_info(in_frame, &in_info);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_audio_frame_get_frame_info", -ret);
+		return ret;
+	}
+
+	adec_trace_record(base, ADEC_TRACE_EVENT_DEQUEUE, in_info.info.index);
+	base->counters.pushed++;
+
+	out_info.info = in_info.info;
+	out_info.format.encoding = ADEF_ENCODING_PCM;
+	out_info.format.sample_rate = in_info.format.sample_rate;
+	out_info.format.channel_count = in_info.format.channel_count;
+	out_info.format.bit_depth = ADEC_NULL_OUTPUT_BIT_DEPTH;
+	out_info.format.pcm.interleaved = true;
+	out_info.format.pcm.signed_val = true;
+	out_info.format.pcm.little_endian = true;
+	out_info.format.aac.data_format = ADEF_AAC_DATA_FORMAT_UNKNOWN;
+	out_size = ADEC_NULL_FRAME_SIZE * out_info.format.channel_count *
+		   ADEC_NULL_OUTPUT_BIT_DEPTH / 8;
+
+	/* Room for the samples added by the drift compensation */
+	mem_size = out_size;
+	if (base->drift != NULL) {
+		mem_size += ADEC_DRIFT_MAX_EXTRA_SAMPLES *
+			    out_info.format.channel_count *
+			    ADEC_NULL_OUTPUT_BIT_DEPTH / 8;
+	}
+	ret = adec_output_get_mem(base, mem_size, &mem);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_mem_get_data(mem, &data, &mem_size);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("mbuf_mem_get_data", -ret);
+		goto out;
+	}
+
+	/* "Decode" the frame */
+	adec_trace_record(
+		base, ADEC_TRACE_EVENT_DECODE_START, in_info.info.index);
+	memset(data, 0, out_size);
+	adec_trace_record(
+		base, ADEC_TRACE_EVENT_DECODE_END, in_info.info.index);
+	base->counters.pulled++;
+
+	/* Same post-processing and output path as the actual decoders */
+	ret = adec_output_push(base,
+			       in_frame,
+			       &out_info,
+			       mem,
+			       ADEC_NULL_FRAME_SIZE,
+			       timings);
+	if (ret < 0)
+		ADEC_LOG_ERRNO("adec_output_push", -ret);
+
+out:
+	if (mem != NULL) {
+		err = mbuf_mem_unref(mem);
+		if (err != 0)
+			ADEC_LOG_ERRNO("mbuf_mem_unref", -err);
+	}
+	return ret;
+}
+
+
+static bool input_filter(struct adec_decoder *base,
+			 struct mbuf_audio_frame *frame,
+			 struct adef_frame *info)
+{
+	return adec_default_input_filter_internal(
+		base, frame, info, supported_formats, NB_SUPPORTED_FORMATS);
+}
+
+
+static const struct adec_pipeline_cbs pipeline_cbs = {
+	.accept = input_filter,
+	.decode = decode_frame,
+};
+
+
+static int get_supported_input_formats(const struct adef_format **formats)
+{
+	(void)pthread_once(&supported_formats_is_init,
+			   initialize_supported_formats);
+	*formats = supported_formats;
+	return NB_SUPPORTED_FORMATS;
+}
+
+
+static int stop(struct adec_decoder *base)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+
+	/* Stop the decoding thread */
+	ret = adec_pipeline_stop(base->pipeline);
+	if (ret < 0)
+		return ret;
+	base->configured = 0;
+
+	return 0;
+}
+
+
+static int destroy(struct adec_decoder *base)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+
+	/* Stop and join the decoding thread, free the queues */
+	adec_pipeline_destroy(base->pipeline);
+	base->pipeline = NULL;
+	adec_output_destroy(base->output);
+	base->output = NULL;
+
+	return 0;
+}
+
+
+static int create(struct adec_decoder *base)
+{
+	int ret = 0;
+	struct adec_decoder *self = base;
+
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+
+	(void)pthread_once(&supported_formats_is_init,
+			   initialize_supported_formats);
+
+	/* Check the configuration */
+	if (base->config.encoding != ADEF_ENCODING_AAC_LC) {
+		ret = -EINVAL;
+		ADEC_LOG_ERRNO("invalid encoding: %s",
+			       -ret,
+			       adef_encoding_to_str(base->config.encoding));
+		return ret;
+	}
+	if (base->config.stream_input) {
+		ret = -ENOSYS;
+		ADEC_LOG_ERRNO("stream input is not supported", -ret);
+		return ret;
+	}
+
+	ADEC_LOGI("null implementation");
+
+	ret = adec_output_new(base,
+			      (ADEC_NULL_FRAME_SIZE +
+			       ADEC_DRIFT_MAX_EXTRA_SAMPLES) *
+				      ADEC_MAX_CHANNEL_COUNT *
+				      ADEC_NULL_OUTPUT_BIT_DEPTH / 8,
+			      &base->output);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_output_new", -ret);
+		goto error;
+	}
+
+	ret = adec_pipeline_new(
+		base, &pipeline_cbs, "adec_null", &base->pipeline);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_pipeline_new", -ret);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	/* Cleanup on error */
+	destroy(base);
+	return ret;
+}
+
+
+static int flush(struct adec_decoder *base, int discard)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+
+	return adec_pipeline_flush(base->pipeline, discard);
+}
+
+
+static int set_aac_asc(struct adec_decoder *base,
+		       const uint8_t *asc,
+		       size_t asc_size,
+		       enum adef_aac_data_format data_format)
+{
+	int ret;
+	struct adec_decoder *self = base;
+
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(base == NULL, EINVAL);
+
+	switch (data_format) {
+	case ADEF_AAC_DATA_FORMAT_RAW:
+	case ADEF_AAC_DATA_FORMAT_ADTS:
+		break;
+	default:
+		ret = -ENOSYS;
+		ADEC_LOG_ERRNO("unsupported data format", -ret);
+		return ret;
+	}
+
+	/* Nothing to configure: the output format is derived from the
+	 * input frames format */
+	return 0;
+}
+
+
+static struct mbuf_pool *get_input_buffer_pool(struct adec_decoder *base)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(base == NULL, EINVAL, NULL);
+
+	/* No input buffer pool allocated: use the application's */
+	return NULL;
+}
+
+
+static struct mbuf_audio_frame_queue *
+get_input_buffer_queue(struct adec_decoder *base)
+{
+	ULOG_ERRNO_RETURN_VAL_IF(base == NULL, EINVAL, NULL);
+
+	return adec_pipeline_get_input_queue(base->pipeline);
+}
+
+
+const struct adec_ops adec_null_ops = {
+	.get_supported_input_formats = get_supported_input_formats,
+	.create = create,
+	.flush = flush,
+	.stop = stop,
+	.destroy = destroy,
+	.set_aac_asc = set_aac_asc,
+	.get_input_buffer_pool = get_input_buffer_pool,
+	.get_input_buffer_queue = get_input_buffer_queue,
+};
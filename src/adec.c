@@ -37,16 +37,78 @@ static void initialize_instance_counter(void)
 }
 
 
-static const struct adec_ops *implem_ops(enum adec_decoder_implem implem)
-{
-	switch (implem) {
+/* Compiled-in implementations, in order of preference for AUTO; adding a
+ * backend takes an ADEC_DECODER_IMPLEM_* value, its own Alchemy module
+ * (like libaudio-decode-fdk-aac) and an entry here */
+struct adec_implem_desc {
+	enum adec_decoder_implem implem;
+	const struct adec_ops *ops;
+	/* Only used when explicitly requested (never picked for AUTO) */
+	bool explicit_only;
+};
+
+
+static const struct adec_implem_desc s_implems[] = {
 #ifdef BUILD_LIBAUDIO_DECODE_FDK_AAC
-	case ADEC_DECODER_IMPLEM_FDK_AAC:
-		return &adec_fdk_aac_ops;
+	{ADEC_DECODER_IMPLEM_FDK_AAC, &adec_fdk_aac_ops, false},
 #endif
-	default:
-		return NULL;
+#ifdef BUILD_LIBAUDIO_DECODE_NULL
+	/* The null implementation does not actually decode */
+	{ADEC_DECODER_IMPLEM_NULL, &adec_null_ops, true},
+#endif
+	/* Sentinel */
+	{ADEC_DECODER_IMPLEM_AUTO, NULL, true},
+};
+
+
+static const struct adec_implem_desc *
+implem_desc(enum adec_decoder_implem implem)
+{
+	for (const struct adec_implem_desc *d = s_implems; d->ops; d++) {
+		if (d->implem == implem)
+			return d;
+	}
+	return NULL;
+}
+
+
+static const struct adec_ops *implem_ops(enum adec_decoder_implem implem)
+{
+	const struct adec_implem_desc *desc = implem_desc(implem);
+
+	return (desc != NULL) ? desc->ops : NULL;
+}
+
+
+static bool implem_supports(const struct adec_implem_desc *desc,
+			     const struct adef_format *format)
+{
+	int count;
+	const struct adef_format *supported_input_formats;
+
+	if (format == NULL)
+		return true;
+
+	count = desc->ops->get_supported_input_formats(
+		&supported_input_formats);
+	if (count < 0)
+		return false;
+
+	return adef_format_intersect(format, supported_input_formats, count);
+}
+
+
+/* Resolve ADEC_DECODER_IMPLEM_AUTO: the first implementation, in order of
+ * preference, that supports the format */
+static enum adec_decoder_implem
+pick_auto_implem(const struct adef_format *format)
+{
+	for (const struct adec_implem_desc *d = s_implems; d->ops; d++) {
+		if (d->explicit_only || !implem_supports(d, format))
+			continue;
+		return d->implem;
 	}
+	return ADEC_DECODER_IMPLEM_AUTO;
 }
 
 
@@ -54,15 +116,11 @@ static int adec_get_implem(enum adec_decoder_implem *implem)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(implem == NULL, EINVAL);
 
-#ifdef BUILD_LIBAUDIO_DECODE_FDK_AAC
-	if ((*implem == ADEC_DECODER_IMPLEM_AUTO) ||
-	    (*implem == ADEC_DECODER_IMPLEM_FDK_AAC)) {
-		*implem = ADEC_DECODER_IMPLEM_FDK_AAC;
-		return 0;
-	}
-#endif /* BUILD_LIBAUDIO_DECODE_FDK_AAC */
+	if (*implem != ADEC_DECODER_IMPLEM_AUTO)
+		return (implem_desc(*implem) != NULL) ? 0 : -ENOSYS;
 
-	return -ENOSYS;
+	*implem = pick_auto_implem(NULL);
+	return (*implem != ADEC_DECODER_IMPLEM_AUTO) ? 0 : -ENOSYS;
 }
 
 
@@ -97,33 +155,10 @@ enum adec_decoder_implem adec_get_auto_implem(void)
 enum adec_decoder_implem
 adec_get_auto_implem_by_coded_format(struct adef_format *format)
 {
-	int res = 0, count;
-	const struct adef_format *supported_input_formats;
-
 	ULOG_ERRNO_RETURN_VAL_IF(
 		format == NULL, EINVAL, ADEC_DECODER_IMPLEM_AUTO);
 
-	for (enum adec_decoder_implem implem = ADEC_DECODER_IMPLEM_AUTO + 1;
-	     implem < ADEC_DECODER_IMPLEM_MAX;
-	     implem++) {
-
-		res = adec_get_implem(&implem);
-		if (res < 0)
-			continue;
-
-		count = implem_ops(implem)->get_supported_input_formats(
-			&supported_input_formats);
-		if (count < 0)
-			continue;
-
-		if (!adef_format_intersect(
-			    format, supported_input_formats, count))
-			continue;
-
-		return implem;
-	}
-
-	return ADEC_DECODER_IMPLEM_AUTO;
+	return pick_auto_implem(format);
 }
 
 
@@ -174,6 +209,60 @@ int adec_new(struct pomp_loop *loop,
 
 	self->ops = implem_ops(self->config.implem);
 
+	if (self->config.trace_event_count > 0) {
+		ret = adec_trace_new(self->config.trace_event_count,
+				     &self->trace);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_trace_new", -ret);
+			goto error;
+		}
+	}
+
+	if (self->config.cpu_accounting) {
+		ret = adec_cpu_acct_new(&self->cpu_acct);
+		if (ret == -ENOSYS) {
+			/* Not fatal, adec_get_cpu_stats() will fail */
+			ret = 0;
+		} else if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_cpu_acct_new", -ret);
+			goto error;
+		}
+	}
+
+	if (self->config.capture_path != NULL) {
+		ret = adec_capture_new(self->config.capture_path,
+				       &self->config,
+				       &self->capture);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_capture_new", -ret);
+			goto error;
+		}
+		/* Not used past creation */
+		self->config.capture_path = NULL;
+	}
+
+	if (self->config.drift_compensation) {
+		ret = adec_drift_new(&self->config, &self->drift);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_drift_new", -ret);
+			goto error;
+		}
+	}
+
+	if (self->config.catchup) {
+		ret = adec_catchup_new(&self->config, &self->catchup);
+		if (ret < 0) {
+			ADEC_LOG_ERRNO("adec_catchup_new", -ret);
+			goto error;
+		}
+	}
+
+	ret = adec_mem_attach(self);
+	if (ret < 0) {
+		ADEC_LOG_ERRNO("adec_mem_attach", -ret);
+		goto error;
+	}
+
 	ret = self->ops->create(self);
 	if (ret < 0)
 		goto error;
@@ -192,6 +281,8 @@ int adec_flush(struct adec_decoder *self, int discard)
 {
 	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 
+	adec_capture_record_flush(self, discard);
+
 	return self->ops->flush(self, discard);
 }
 
@@ -200,6 +291,8 @@ int adec_stop(struct adec_decoder *self)
 {
 	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 
+	adec_capture_record_stop(self);
+
 	return self->ops->stop(self);
 }
 
@@ -214,12 +307,18 @@ int adec_destroy(struct adec_decoder *self)
 	ret = self->ops->destroy(self);
 
 	ADEC_LOGI("adec instance stats: [%u [%u %u] %u]",
-		  self->counters.in,
+		  atomic_load(&self->counters.in),
 		  self->counters.pushed,
 		  self->counters.pulled,
 		  self->counters.out);
 
 	if (ret == 0) {
+		adec_trace_destroy(self->trace);
+		adec_cpu_acct_destroy(self->cpu_acct);
+		adec_capture_destroy(self->capture);
+		adec_drift_destroy(self->drift);
+		adec_catchup_destroy(self->catchup);
+		adec_mem_detach(self);
 		xfree((void **)&self->dec_name);
 		xfree((void **)&self->config.name);
 		free(self);
@@ -229,6 +328,40 @@ int adec_destroy(struct adec_decoder *self)
 }
 
 
+int adec_get_frame_timings(struct adec_decoder *self,
+			   struct mbuf_audio_frame *frame,
+			   struct adec_timings *timings)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(timings == NULL, EINVAL);
+
+	return adec_frame_get_timings(frame, timings);
+}
+
+
+int adec_get_trace_events(struct adec_decoder *self,
+			  struct adec_trace_event *events,
+			  size_t max_count)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->trace == NULL, ENOSYS);
+
+	return adec_trace_read(self->trace, events, max_count);
+}
+
+
+int adec_export_trace(struct adec_decoder *self,
+		      enum adec_trace_format format,
+		      FILE *stream)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->trace == NULL, ENOSYS);
+
+	return adec_trace_export(self->trace, format, self->dec_id, stream);
+}
+
+
 int adec_set_aac_asc(struct adec_decoder *self,
 		     const uint8_t *asc,
 		     size_t asc_size,
@@ -239,6 +372,8 @@ int adec_set_aac_asc(struct adec_decoder *self,
 	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->configured, EALREADY);
 
+	adec_capture_record_asc(self, asc, asc_size, data_format);
+
 	if (self->ops->set_aac_asc)
 		ret = self->ops->set_aac_asc(self, asc, asc_size, data_format);
 	else
@@ -267,6 +402,90 @@ adec_get_input_buffer_queue(struct adec_decoder *self)
 }
 
 
+int adec_get_stats(struct adec_decoder *self, struct adec_stats *stats)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->in_frames = atomic_load(&self->counters.in);
+	stats->pushed_frames = self->counters.pushed;
+	stats->pulled_frames = self->counters.pulled;
+	stats->out_frames = self->counters.out;
+	stats->out_mem_allocs = self->counters.out_mem_allocs;
+	stats->out_frame_allocs = self->counters.out_frame_allocs;
+	stats->ancillary_allocs = self->counters.ancillary_allocs;
+	stats->in_dropped_frames =
+		atomic_load(&self->counters.in_dropped);
+	stats->silent_dropped_frames = self->counters.silent_dropped;
+	stats->out_dropped_frames = self->counters.out_dropped;
+	stats->catchup_frames = atomic_load(&self->counters.catchup_frames);
+	stats->catchup_removed_samples =
+		atomic_load(&self->counters.catchup_removed_samples);
+	if (atomic_load_explicit(&self->thread_stats_valid,
+				 memory_order_acquire))
+		stats->thread = self->thread_stats;
+
+	return 0;
+}
+
+
+int adec_get_cpu_stats(struct adec_decoder *self, struct adec_cpu_stats *stats)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->cpu_acct == NULL, ENOSYS);
+
+	return adec_cpu_acct_get(self->cpu_acct, stats);
+}
+
+
+int adec_get_memory_usage(struct adec_decoder *self,
+			  struct adec_memory_usage *usage)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(usage == NULL, EINVAL);
+
+	return adec_mem_get_usage(self, usage);
+}
+
+
+int adec_set_playout_time(struct adec_decoder *self, uint64_t timestamp_us)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->drift == NULL, ENOSYS);
+
+	adec_drift_set_playout_time(self->drift, timestamp_us);
+
+	return 0;
+}
+
+
+int adec_get_drift_stats(struct adec_decoder *self,
+			 struct adec_drift_stats *stats)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self->drift == NULL, ENOSYS);
+
+	return adec_drift_get(self->drift, stats);
+}
+
+
+int adec_get_output_channel_map(struct adec_decoder *self,
+				enum adec_channel *map,
+				size_t max_count)
+{
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ADEC_LOG_ERRNO_RETURN_ERR_IF(map == NULL, EINVAL);
+
+	if (self->ops->get_output_channel_map == NULL)
+		return -ENOSYS;
+
+	return self->ops->get_output_channel_map(self, map, max_count);
+}
+
+
 enum adec_decoder_implem adec_get_used_implem(struct adec_decoder *self)
 {
 	ADEC_LOG_ERRNO_RETURN_VAL_IF(
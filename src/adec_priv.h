@@ -49,6 +49,10 @@
 #	include <audio-decode/adec_fdk_aac.h>
 #endif
 
+#ifdef BUILD_LIBAUDIO_DECODE_NULL
+#	include <audio-decode/adec_null.h>
+#endif
+
 
 static inline void xfree(void **ptr)
 {
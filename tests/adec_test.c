@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "adec_test.h"
+
+
+static CU_SuiteInfo s_suites[] = {
+	{.pName = "alloc", .pTests = g_adec_test_alloc},
+	{.pName = "budget", .pTests = g_adec_test_budget},
+	{.pName = "capture", .pTests = g_adec_test_capture},
+	{.pName = "heaac", .pTests = g_adec_test_heaac},
+	{.pName = "lowdelay", .pTests = g_adec_test_lowdelay},
+	{.pName = "queue", .pTests = g_adec_test_queue},
+	{.pName = "timeline", .pTests = g_adec_test_timeline},
+	{.pName = "trace", .pTests = g_adec_test_trace},
+	CU_SUITE_INFO_NULL,
+};
+
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	ret = CU_initialize_registry();
+	if (ret != CUE_SUCCESS)
+		return EXIT_FAILURE;
+	ret = CU_register_suites(s_suites);
+	if (ret != CUE_SUCCESS)
+		goto out;
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	ret = CU_basic_run_tests();
+	if (ret == CUE_SUCCESS && CU_get_number_of_tests_failed() != 0)
+		ret = -1;
+
+out:
+	CU_cleanup_registry();
+	return (ret == CUE_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,407 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "adec_test.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define WARMUP_FRAME_COUNT 20
+#define FRAME_COUNT 200
+#define FRAME_SIZE 1024
+#define OUT_BUF_COUNT 4
+#define TIMEOUT_MS 5000
+/* Application ancillary data set on the input frames */
+#define APP_KEY "test.app"
+
+
+/* AAC-LC 48kHz mono raw stream: ASC and an access unit holding a single
+ * SCE with one non-zero coefficient (see adec_test_lowdelay.c) */
+static const uint8_t lc_asc[] = {0x11, 0x88};
+static const uint8_t lc_au[] = {0x01, 0x68, 0x00, 0x84, 0x21, 0x0e};
+
+
+/* Heap calls made by threads other than the test thread (i.e. the decoding
+ * thread, the test thread being the loop thread) while counting */
+static atomic_int s_counting;
+static atomic_uint s_heap_calls;
+static pthread_t s_test_thread;
+
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+
+static void count_heap_call(void)
+{
+	if (atomic_load_explicit(&s_counting, memory_order_relaxed) &&
+	    !pthread_equal(pthread_self(), s_test_thread))
+		atomic_fetch_add(&s_heap_calls, 1);
+}
+
+
+void *malloc(size_t size)
+{
+	count_heap_call();
+	return __libc_malloc(size);
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count_heap_call();
+	return __libc_calloc(nmemb, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	count_heap_call();
+	return __libc_realloc(ptr, size);
+}
+
+
+void free(void *ptr)
+{
+	if (ptr != NULL)
+		count_heap_call();
+	__libc_free(ptr);
+}
+
+#endif /* __GLIBC__ */
+
+
+struct alloc_ctx {
+	unsigned int out_count;
+	/* Output frames with their decoder timings available */
+	unsigned int timed_count;
+	/* Output frames with the deprecated per-time keys */
+	unsigned int legacy_count;
+	/* Output frames with their levels available */
+	unsigned int levels_count;
+	/* Output frames with the input frame application ancillary data */
+	unsigned int copied_count;
+	/* Output frames held by the application */
+	struct mbuf_audio_frame *held[FRAME_COUNT];
+	unsigned int held_count;
+	bool hold;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	struct alloc_ctx *ctx = userdata;
+	struct adec_timings timings;
+	struct adec_levels levels;
+	struct mbuf_ancillary_data *data;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ctx->out_count++;
+	if (adec_get_frame_timings(dec, frame, &timings) == 0 &&
+	    timings.input_time != 0 &&
+	    timings.input_time <= timings.dequeue_time &&
+	    timings.dequeue_time <= timings.output_time)
+		ctx->timed_count++;
+	if (mbuf_audio_frame_get_ancillary_data(
+		    frame, ADEC_ANCILLARY_KEY_INPUT_TIME, &data) == 0) {
+		ctx->legacy_count++;
+		mbuf_ancillary_data_unref(data);
+	}
+	if (adec_frame_get_levels(frame, &levels) == 0 &&
+	    levels.channel_count > 0)
+		ctx->levels_count++;
+	if (mbuf_audio_frame_get_ancillary_data(frame, APP_KEY, &data) == 0) {
+		ctx->copied_count++;
+		mbuf_ancillary_data_unref(data);
+	}
+	if (ctx->hold && ctx->held_count < FRAME_COUNT) {
+		mbuf_audio_frame_ref(frame);
+		ctx->held[ctx->held_count++] = frame;
+	}
+}
+
+
+static void push_frame(struct adec_decoder *dec,
+		       enum adec_decoder_implem implem,
+		       unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	void *data;
+	size_t capacity;
+	struct adef_frame info = {
+		.format = adef_aac_lc_16b_48000hz_stereo_raw,
+		.info.timestamp = (uint64_t)index * FRAME_SIZE,
+		.info.timescale = 48000,
+		.info.index = index,
+	};
+
+	/* The access unit matches the mono ASC set on the FDK AAC decoder;
+	 * the null implementation does not read the data */
+	if (implem == ADEC_DECODER_IMPLEM_FDK_AAC)
+		info.format.channel_count = 1;
+	ret = mbuf_mem_generic_new(sizeof(lc_au), &mem);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = mbuf_mem_get_data(mem, &data, &capacity);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	memcpy(data, lc_au, sizeof(lc_au));
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, sizeof(lc_au));
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_add_ancillary_buffer(
+		frame, APP_KEY, &index, sizeof(index));
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	mbuf_audio_frame_unref(frame);
+	mbuf_mem_unref(mem);
+}
+
+
+/* Run the loop until the frame has been either output or dropped */
+static void wait_frame(struct pomp_loop *loop,
+		       struct adec_decoder *dec,
+		       struct alloc_ctx *ctx,
+		       unsigned int count)
+{
+	int ret;
+	struct adec_stats stats;
+	struct timespec ts;
+	uint64_t start, now;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &start);
+	do {
+		pomp_loop_wait_and_process(loop, 10);
+		ret = adec_get_stats(dec, &stats);
+		CU_ASSERT_EQUAL_FATAL(ret, 0);
+		time_get_monotonic(&ts);
+		time_timespec_to_us(&ts, &now);
+	} while (ctx->out_count + stats.out_dropped_frames < count &&
+		 now - start < TIMEOUT_MS * 1000);
+	CU_ASSERT_EQUAL_FATAL(ctx->out_count + stats.out_dropped_frames,
+			      count);
+}
+
+
+static void run_decoder(struct alloc_ctx *ctx,
+			struct adec_stats *stats,
+			enum adec_decoder_implem implem,
+			int realtime)
+{
+	int ret;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct adec_config config = {
+		.implem = implem,
+		.encoding = ADEF_ENCODING_AAC_LC,
+		.preferred_min_out_buf_count = OUT_BUF_COUNT,
+		.realtime = realtime,
+		.levels = 1,
+		.drift_compensation = 1,
+		.catchup = 1,
+	};
+	unsigned int i;
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, ctx, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	if (implem == ADEC_DECODER_IMPLEM_FDK_AAC) {
+		ret = adec_set_aac_asc(dec,
+				       lc_asc,
+				       sizeof(lc_asc),
+				       ADEF_AAC_DATA_FORMAT_RAW);
+		CU_ASSERT_EQUAL_FATAL(ret, 0);
+	}
+
+	for (i = 0; i < WARMUP_FRAME_COUNT; i++) {
+		push_frame(dec, implem, i);
+		wait_frame(loop, dec, ctx, i + 1);
+	}
+
+	s_test_thread = pthread_self();
+	atomic_store(&s_heap_calls, 0);
+	atomic_store(&s_counting, 1);
+	for (; i < WARMUP_FRAME_COUNT + FRAME_COUNT; i++) {
+		push_frame(dec, implem, i);
+		wait_frame(loop, dec, ctx, i + 1);
+	}
+	atomic_store(&s_counting, 0);
+
+	ret = adec_get_stats(dec, stats);
+	CU_ASSERT_EQUAL(ret, 0);
+
+	for (i = 0; i < ctx->held_count; i++)
+		mbuf_audio_frame_unref(ctx->held[i]);
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	/* Process the pending idle functions */
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+static bool implem_available(enum adec_decoder_implem implem)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(implem, &formats) > 0;
+}
+
+
+/* In real-time mode the stock output frames carry the timings and levels
+ * records, filled in place; the input ancillary data is not copied */
+static void check_steady_state(enum adec_decoder_implem implem)
+{
+	struct alloc_ctx ctx = {0};
+	struct adec_stats stats;
+
+	if (!implem_available(implem))
+		return;
+
+	run_decoder(&ctx, &stats, implem, 1);
+
+	CU_ASSERT_EQUAL(ctx.out_count, WARMUP_FRAME_COUNT + FRAME_COUNT);
+	CU_ASSERT_EQUAL(ctx.timed_count, ctx.out_count);
+	CU_ASSERT_EQUAL(ctx.levels_count, ctx.out_count);
+	CU_ASSERT_EQUAL(ctx.copied_count, 0);
+	CU_ASSERT_EQUAL(stats.out_mem_allocs, 0);
+	CU_ASSERT_EQUAL(stats.out_frame_allocs, 0);
+	CU_ASSERT_EQUAL(stats.ancillary_allocs, 0);
+	CU_ASSERT_EQUAL(stats.out_dropped_frames, 0);
+#ifdef __GLIBC__
+	CU_ASSERT_EQUAL(atomic_load(&s_heap_calls), 0);
+#endif /* __GLIBC__ */
+}
+
+
+/* Without real-time decoding, each output frame carries a copy of the
+ * input frame ancillary data, a single timings record and a single levels
+ * record, allocated when the frame is built */
+static void check_records(enum adec_decoder_implem implem)
+{
+	struct alloc_ctx ctx = {0};
+	struct adec_stats stats;
+
+	if (!implem_available(implem))
+		return;
+
+	run_decoder(&ctx, &stats, implem, 0);
+
+	CU_ASSERT_EQUAL(ctx.out_count, WARMUP_FRAME_COUNT + FRAME_COUNT);
+	CU_ASSERT_EQUAL(ctx.timed_count, ctx.out_count);
+	CU_ASSERT_EQUAL(ctx.levels_count, ctx.out_count);
+	CU_ASSERT_EQUAL(ctx.copied_count, ctx.out_count);
+	CU_ASSERT_EQUAL(ctx.legacy_count, 0);
+	CU_ASSERT_EQUAL(stats.ancillary_allocs, 3 * ctx.out_count);
+}
+
+
+static void test_alloc_steady_state(void)
+{
+	check_steady_state(ADEC_DECODER_IMPLEM_NULL);
+}
+
+
+static void test_alloc_fdk_aac_steady_state(void)
+{
+	check_steady_state(ADEC_DECODER_IMPLEM_FDK_AAC);
+}
+
+
+static void test_alloc_pool_exhausted(void)
+{
+	struct alloc_ctx ctx = {.hold = true};
+	struct adec_stats stats;
+
+	if (!implem_available(ADEC_DECODER_IMPLEM_NULL))
+		return;
+
+	/* The application holds every output frame: once the output
+	 * memories are exhausted the frames are dropped, without
+	 * allocating */
+	run_decoder(&ctx, &stats, ADEC_DECODER_IMPLEM_NULL, 1);
+
+	CU_ASSERT_EQUAL(ctx.out_count, OUT_BUF_COUNT);
+	CU_ASSERT_EQUAL(stats.out_dropped_frames,
+			WARMUP_FRAME_COUNT + FRAME_COUNT - OUT_BUF_COUNT);
+	CU_ASSERT_EQUAL(stats.out_mem_allocs, 0);
+#ifdef __GLIBC__
+	CU_ASSERT_EQUAL(atomic_load(&s_heap_calls), 0);
+#endif /* __GLIBC__ */
+}
+
+
+static void test_alloc_records(void)
+{
+	check_records(ADEC_DECODER_IMPLEM_NULL);
+}
+
+
+static void test_alloc_fdk_aac_records(void)
+{
+	check_records(ADEC_DECODER_IMPLEM_FDK_AAC);
+}
+
+
+CU_TestInfo g_adec_test_alloc[] = {
+	{(char *)"steady_state", &test_alloc_steady_state},
+	{(char *)"pool_exhausted", &test_alloc_pool_exhausted},
+	{(char *)"records", &test_alloc_records},
+	{(char *)"fdk_aac_steady_state", &test_alloc_fdk_aac_steady_state},
+	{(char *)"fdk_aac_records", &test_alloc_fdk_aac_records},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,454 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define FRAME_SIZE 1024
+#define IN_FRAME_SIZE 16
+/* Null decoder output frame: 16-bit stereo */
+#define OUT_FRAME_SIZE (FRAME_SIZE * 2 * 2)
+/* Two output frames and two input frames */
+#define BUDGET (OUT_FRAME_SIZE * 2 + IN_FRAME_SIZE * 2)
+#define MAX_FRAME_COUNT 1000
+#define MAX_HELD_COUNT 4
+#define REJECTED_FRAME_COUNT 5
+#define TIMEOUT_MS 5000
+
+
+struct budget_ctx {
+	struct pomp_loop *loop;
+	struct adec_mem_group *group;
+	struct adec_decoder *dec;
+	unsigned int out_count;
+	/* Output frames kept after the output callback */
+	bool hold;
+	struct mbuf_audio_frame *held[MAX_HELD_COUNT];
+	unsigned int held_count;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	struct budget_ctx *ctx = userdata;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ctx->out_count++;
+	if (ctx->hold && ctx->held_count < MAX_HELD_COUNT) {
+		mbuf_audio_frame_ref(frame);
+		ctx->held[ctx->held_count++] = frame;
+	}
+}
+
+
+static void release_held(struct budget_ctx *ctx)
+{
+	for (unsigned int i = 0; i < ctx->held_count; i++)
+		mbuf_audio_frame_unref(ctx->held[i]);
+	ctx->held_count = 0;
+}
+
+
+static int push_frame(struct adec_decoder *dec, unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	struct adef_frame info = {
+		.format = adef_aac_lc_16b_48000hz_stereo_raw,
+		.info.timestamp = (uint64_t)index * FRAME_SIZE,
+		.info.timescale = 48000,
+		.info.index = index,
+	};
+
+	/* The null implementation does not read the data */
+	ret = mbuf_mem_generic_new(IN_FRAME_SIZE, &mem);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, IN_FRAME_SIZE);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+
+out:
+	if (frame != NULL)
+		mbuf_audio_frame_unref(frame);
+	if (mem != NULL)
+		mbuf_mem_unref(mem);
+	return ret;
+}
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	uint64_t us;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+/* Wait for the decoding thread to have decoded count frames, without
+ * running the loop (the output frames stay pending) */
+static void wait_decoded(struct budget_ctx *ctx, unsigned int count)
+{
+	int ret;
+	struct adec_stats stats;
+	uint64_t start = now_us();
+
+	do {
+		ret = adec_get_stats(ctx->dec, &stats);
+		CU_ASSERT_EQUAL_FATAL(ret, 0);
+		if (stats.pulled_frames >= count)
+			break;
+		usleep(1000);
+	} while (now_us() - start < (uint64_t)TIMEOUT_MS * 1000);
+	CU_ASSERT_EQUAL_FATAL(stats.pulled_frames, count);
+}
+
+
+/* Run the loop until count frames have been output */
+static void wait_output(struct budget_ctx *ctx, unsigned int count)
+{
+	uint64_t start = now_us();
+
+	do {
+		pomp_loop_wait_and_process(ctx->loop, 10);
+	} while (ctx->out_count < count &&
+		 now_us() - start < (uint64_t)TIMEOUT_MS * 1000);
+	CU_ASSERT_EQUAL_FATAL(ctx->out_count, count);
+}
+
+
+/* Wait for the group usage to reach a value: the decoding thread releases
+ * its references to the frames asynchronously */
+static void wait_group_usage(struct budget_ctx *ctx, size_t bytes)
+{
+	uint64_t start = now_us();
+
+	while (adec_mem_group_get_usage(ctx->group) != bytes &&
+	       now_us() - start < (uint64_t)TIMEOUT_MS * 1000)
+		usleep(1000);
+	CU_ASSERT_EQUAL(adec_mem_group_get_usage(ctx->group), bytes);
+}
+
+
+/* Check that decoding stays paused at count decoded frames while running
+ * the loop */
+static void check_paused(struct budget_ctx *ctx, unsigned int count)
+{
+	int ret;
+	struct adec_stats stats;
+
+	for (unsigned int i = 0; i < 5; i++)
+		pomp_loop_wait_and_process(ctx->loop, 10);
+	ret = adec_get_stats(ctx->dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.pulled_frames, count);
+}
+
+
+static bool null_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_NULL,
+						&formats) > 0;
+}
+
+
+static void budget_start(struct budget_ctx *ctx,
+			 struct adec_config *config,
+			 size_t budget)
+{
+	int ret;
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+
+	ctx->loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ctx->loop);
+	ret = adec_mem_group_new(budget, &ctx->group);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	config->implem = ADEC_DECODER_IMPLEM_NULL;
+	config->encoding = ADEF_ENCODING_AAC_LC;
+	config->mem_group = ctx->group;
+	ret = adec_new(ctx->loop, config, &cbs, ctx, &ctx->dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+}
+
+
+static void budget_stop(struct budget_ctx *ctx)
+{
+	int ret;
+
+	ret = adec_stop(ctx->dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(ctx->dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(ctx->loop, 0);
+	release_held(ctx);
+	ret = adec_mem_group_destroy(ctx->group);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = pomp_loop_destroy(ctx->loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* Once the next output memory does not fit in the budget, decoding pauses
+ * and new input frames are rejected once the budget is reached, until the
+ * pending output frames are consumed */
+static void test_budget_backpressure(void)
+{
+	int ret;
+	struct budget_ctx ctx = {0};
+	struct adec_config config = {0};
+	struct adec_stats stats;
+	struct adec_memory_usage usage;
+	unsigned int i;
+
+	if (!null_implem_available())
+		return;
+
+	budget_start(&ctx, &config, BUDGET);
+
+	for (i = 0; i < 2; i++) {
+		ret = push_frame(ctx.dec, i);
+		CU_ASSERT_EQUAL(ret, 0);
+		wait_decoded(&ctx, i + 1);
+	}
+
+	/* Accepted but not decoded: a third output frame does not fit */
+	for (i = 2; i < 4; i++) {
+		ret = push_frame(ctx.dec, i);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+	usleep(20000);
+	ret = adec_get_stats(ctx.dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.pulled_frames, 2);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.in_queue_bytes, 2 * IN_FRAME_SIZE);
+	CU_ASSERT_EQUAL(usage.output_bytes, 2 * OUT_FRAME_SIZE);
+	CU_ASSERT_EQUAL(usage.pool_bytes, 0);
+	CU_ASSERT_EQUAL(usage.total_bytes, BUDGET);
+	CU_ASSERT_EQUAL(usage.group_bytes, BUDGET);
+	CU_ASSERT_EQUAL(usage.group_budget_bytes, BUDGET);
+
+	/* Budget reached: rejected */
+	ret = push_frame(ctx.dec, 4);
+	CU_ASSERT_EQUAL(ret, -EPROTO);
+
+	/* Consuming the output frames resumes the decoding */
+	wait_output(&ctx, 4);
+	wait_group_usage(&ctx, 0);
+
+	ret = adec_get_stats(ctx.dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.in_frames, 4);
+	CU_ASSERT_EQUAL(stats.in_dropped_frames, 1);
+
+	budget_stop(&ctx);
+}
+
+
+/* The output memories stay accounted while the application holds the
+ * output frames, also after the decoder is destroyed */
+static void test_budget_held(void)
+{
+	int ret;
+	struct budget_ctx ctx = {0};
+	struct adec_config config = {0};
+	struct adec_memory_usage usage;
+	unsigned int i;
+
+	if (!null_implem_available())
+		return;
+
+	budget_start(&ctx, &config, BUDGET);
+	ctx.hold = true;
+
+	for (i = 0; i < 3; i++) {
+		ret = push_frame(ctx.dec, i);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+	wait_output(&ctx, 2);
+	check_paused(&ctx, 2);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.output_bytes, 2 * OUT_FRAME_SIZE);
+	CU_ASSERT_EQUAL(usage.in_queue_bytes, IN_FRAME_SIZE);
+
+	/* Releasing a held frame resumes the decoding */
+	mbuf_audio_frame_unref(ctx.held[0]);
+	ctx.held[0] = ctx.held[1];
+	ctx.held_count--;
+	wait_output(&ctx, 3);
+	wait_group_usage(&ctx, 2 * OUT_FRAME_SIZE);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.output_bytes, 2 * OUT_FRAME_SIZE);
+	CU_ASSERT_EQUAL(usage.in_queue_bytes, 0);
+
+	/* Still accounted after the decoder is destroyed */
+	ret = adec_stop(ctx.dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(ctx.dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(ctx.loop, 0);
+	CU_ASSERT_EQUAL(adec_mem_group_get_usage(ctx.group),
+			2 * OUT_FRAME_SIZE);
+	ret = adec_mem_group_destroy(ctx.group);
+	CU_ASSERT_EQUAL(ret, -EBUSY);
+	release_held(&ctx);
+	CU_ASSERT_EQUAL(adec_mem_group_get_usage(ctx.group), 0);
+	ret = adec_mem_group_destroy(ctx.group);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = pomp_loop_destroy(ctx.loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* Queued input frames are never dropped because of the budget, even with
+ * the drop-oldest policy: only the new input frames are rejected */
+static void test_budget_no_drop(void)
+{
+	int ret;
+	struct budget_ctx ctx = {0};
+	struct adec_config config = {
+		.in_queue_drop_policy = ADEC_DROP_POLICY_OLDEST,
+	};
+	struct adec_stats stats;
+	unsigned int i, accepted = 0, rejected = 0;
+
+	if (!null_implem_available())
+		return;
+
+	budget_start(&ctx, &config, BUDGET);
+
+	/* Without running the loop, until the budget is reached */
+	for (i = 0; i < MAX_FRAME_COUNT && rejected < REJECTED_FRAME_COUNT;
+	     i++) {
+		ret = push_frame(ctx.dec, i);
+		if (ret == -EPROTO) {
+			rejected++;
+		} else {
+			CU_ASSERT_EQUAL(ret, 0);
+			accepted++;
+		}
+		usleep(100);
+	}
+	CU_ASSERT_EQUAL(rejected, REJECTED_FRAME_COUNT);
+	wait_output(&ctx, accepted);
+
+	ret = adec_get_stats(ctx.dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.in_frames, accepted);
+	CU_ASSERT_EQUAL(stats.in_dropped_frames, rejected);
+	CU_ASSERT_EQUAL(stats.pulled_frames, accepted);
+
+	budget_stop(&ctx);
+}
+
+
+/* The preallocated pools are accounted at creation, which fails if they do
+ * not fit; the frames using their memories are not accounted again */
+static void test_budget_pool(void)
+{
+	int ret;
+	struct budget_ctx ctx = {0};
+	struct adec_config config = {
+		.realtime = 1,
+		.preferred_min_out_buf_count = 2,
+	};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct adec_decoder *dec = NULL;
+	struct adec_memory_usage usage;
+	size_t pool_bytes;
+
+	if (!null_implem_available())
+		return;
+
+	budget_start(&ctx, &config, 0);
+
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	pool_bytes = usage.pool_bytes;
+	CU_ASSERT(pool_bytes > 0);
+	CU_ASSERT_EQUAL(usage.total_bytes, pool_bytes);
+	CU_ASSERT_EQUAL(usage.group_bytes, pool_bytes);
+
+	ret = push_frame(ctx.dec, 0);
+	CU_ASSERT_EQUAL(ret, 0);
+	wait_decoded(&ctx, 1);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.output_bytes, 0);
+	CU_ASSERT_EQUAL(usage.group_bytes, pool_bytes);
+	wait_output(&ctx, 1);
+
+	/* No room for the pool of a second decoder */
+	ret = adec_mem_group_set_budget(ctx.group, pool_bytes * 3 / 2);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_new(ctx.loop, &config, &cbs, &ctx, &dec);
+	CU_ASSERT_EQUAL(ret, -ENOBUFS);
+	CU_ASSERT_PTR_NULL(dec);
+	CU_ASSERT_EQUAL(adec_mem_group_get_usage(ctx.group), pool_bytes);
+
+	budget_stop(&ctx);
+}
+
+
+CU_TestInfo g_adec_test_budget[] = {
+	{(char *)"backpressure", &test_budget_backpressure},
+	{(char *)"held", &test_budget_held},
+	{(char *)"no_drop", &test_budget_no_drop},
+	{(char *)"pool", &test_budget_pool},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+
+
+#define FRAME_SIZE 1024
+#define FRAME_COUNT 500
+/* Large enough for the records to wrap around the capture buffer */
+#define IN_FRAME_SIZE 4096
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+}
+
+
+static int push_frame(struct adec_decoder *dec, unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	void *data;
+	size_t capacity;
+	struct adef_frame info = {
+		.format = adef_aac_lc_16b_48000hz_stereo_raw,
+		.info.timestamp = (uint64_t)index * FRAME_SIZE,
+		.info.timescale = 48000,
+		.info.index = index,
+	};
+
+	ret = mbuf_mem_generic_new(IN_FRAME_SIZE, &mem);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_mem_get_data(mem, &data, &capacity);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	memset(data, index & 0xff, IN_FRAME_SIZE);
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, IN_FRAME_SIZE);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+
+out:
+	if (frame != NULL)
+		mbuf_audio_frame_unref(frame);
+	if (mem != NULL)
+		mbuf_mem_unref(mem);
+	return ret;
+}
+
+
+static bool null_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_NULL,
+						&formats) > 0;
+}
+
+
+/* The records are written by the writer thread and must be in the file,
+ * in order, once the decoder is destroyed; records may be dropped if the
+ * writer thread lags behind, so only their order and content are checked
+ * (the input is paced to make it unlikely) */
+static void test_capture_async(void)
+{
+	int ret;
+	char path[] = "/tmp/adec_test_capture_XXXXXX";
+	int fd;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct adec_config config = {
+		.implem = ADEC_DECODER_IMPLEM_NULL,
+		.encoding = ADEF_ENCODING_AAC_LC,
+		.capture_path = path,
+	};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct adec_capture_reader *reader = NULL;
+	struct adec_capture_record record;
+	unsigned int frames = 0;
+	unsigned int next_index = 0;
+	uint64_t last_time = 0;
+	bool stopped = false;
+
+	if (!null_implem_available())
+		return;
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	close(fd);
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, NULL, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	for (unsigned int i = 0; i < FRAME_COUNT; i++) {
+		/* The input queue may be full: retry until the frame is
+		 * accepted, running the loop to consume the output */
+		while ((ret = push_frame(dec, i)) == -EAGAIN)
+			pomp_loop_wait_and_process(loop, 1);
+		CU_ASSERT_EQUAL(ret, 0);
+		if (i % 32 == 31)
+			usleep(1000);
+	}
+
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+
+	ret = adec_capture_reader_open(path, &reader);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = adec_capture_reader_read(reader, &record);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(record.type, ADEC_CAPTURE_RECORD_CONFIG);
+	CU_ASSERT_EQUAL(record.config.implem, ADEC_DECODER_IMPLEM_NULL);
+	while ((ret = adec_capture_reader_read(reader, &record)) == 0) {
+		CU_ASSERT(record.time_us >= last_time);
+		last_time = record.time_us;
+		if (record.type == ADEC_CAPTURE_RECORD_STOP) {
+			stopped = true;
+			continue;
+		}
+		CU_ASSERT_EQUAL(record.type, ADEC_CAPTURE_RECORD_FRAME);
+		if (record.type != ADEC_CAPTURE_RECORD_FRAME)
+			continue;
+		CU_ASSERT(record.frame.info.index >= next_index);
+		next_index = record.frame.info.index + 1;
+		CU_ASSERT_EQUAL(record.len, IN_FRAME_SIZE);
+		if (record.len == IN_FRAME_SIZE) {
+			CU_ASSERT_EQUAL(record.data[0],
+					record.frame.info.index & 0xff);
+			CU_ASSERT_EQUAL(record.data[IN_FRAME_SIZE - 1],
+					record.frame.info.index & 0xff);
+		}
+		frames++;
+	}
+	CU_ASSERT_EQUAL(ret, -ENODATA);
+	CU_ASSERT(frames > 0);
+	CU_ASSERT(frames <= FRAME_COUNT);
+	CU_ASSERT(stopped);
+
+out:
+	adec_capture_reader_close(reader);
+	unlink(path);
+}
+
+
+CU_TestInfo g_adec_test_capture[] = {
+	{(char *)"async", &test_capture_async},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,342 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+
+#include <audio-decode/adec.h>
+#ifdef BUILD_LIBAUDIO_DECODE_FDK_AAC
+#	include <audio-decode/adec_fdk_aac.h>
+#endif
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define SAMPLE_RATE 48000
+/* Output frame size in samples (twice the 1024 samples of the core) */
+#define FRAME_SIZE 2048
+#define FRAME_COUNT 8
+/* Output frames skipped before checking the levels (decoder delay) */
+#define SETTLE_FRAME_COUNT 3
+#define TIMEOUT_MS 5000
+
+
+/* Test vectors: HE-AAC raw streams with explicit signaling in the ASC (24kHz
+ * mono AAC-LC core, 48kHz output); each access unit holds a SCE with a
+ * single low-frequency tone coefficient, then a fill element with the SBR
+ * data (one envelope over 16 bands, from QMF band 13 to 45). In the HE-AAC
+ * v2 stream the SBR data carries a PS extension with a 25dB inter-channel
+ * intensity difference on all bands, the left channel being the louder.
+ * They were checked against an independent decoder, which outputs 2048
+ * samples frames at 48kHz, in stereo with the 25dB difference for v2 */
+struct heaac_vector {
+	const char *name;
+	const uint8_t *asc;
+	size_t asc_size;
+	const uint8_t *au;
+	size_t au_size;
+};
+
+
+/* HE-AAC v1 (AAC-LC + SBR) */
+static const uint8_t v1_asc[] = {0x2b, 0x09, 0x88, 0x00};
+static const uint8_t v1_au[] = {
+	0x01, 0x68, 0x00, 0x84, 0x21, 0x0d, 0x7b, 0xac, 0x80,
+	0x04, 0xaa, 0x50, 0x00, 0x00, 0x00, 0x02, 0x80, 0x1c,
+};
+
+/* HE-AAC v2 (AAC-LC + SBR + PS) */
+static const uint8_t v2_asc[] = {0xeb, 0x09, 0x88, 0x00};
+static const uint8_t v2_au[] = {
+	0x01, 0x68, 0x00, 0x84, 0x21, 0x0d, 0xe0, 0x5b,
+	0xac, 0x80, 0x04, 0xaa, 0x50, 0x00, 0x00, 0x00,
+	0x02, 0x82, 0xb6, 0x02, 0xff, 0xc0, 0x00, 0x1c,
+};
+
+
+#define HEAAC_VECTOR(_name, _prefix)                                           \
+	{                                                                      \
+		.name = _name, .asc = _prefix##_asc,                           \
+		.asc_size = sizeof(_prefix##_asc), .au = _prefix##_au,         \
+		.au_size = sizeof(_prefix##_au),                               \
+	}
+
+
+static const struct heaac_vector v1_vector = HEAAC_VECTOR("HE-AAC v1", v1);
+static const struct heaac_vector v2_vector = HEAAC_VECTOR("HE-AAC v2", v2);
+
+
+struct heaac_ctx {
+	unsigned int out_count;
+	/* Channel count of the first output frame */
+	unsigned int channel_count;
+	/* Lowest left to right RMS level ratio once settled */
+	float min_ratio;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	int ret;
+	struct heaac_ctx *ctx = userdata;
+	struct adef_frame info;
+	struct adec_levels levels;
+	const void *data;
+	size_t len;
+	float ratio;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		return;
+	CU_ASSERT_EQUAL(info.format.sample_rate, SAMPLE_RATE);
+	CU_ASSERT_EQUAL(info.format.bit_depth, 16);
+	if (ctx->out_count == 0)
+		ctx->channel_count = info.format.channel_count;
+	CU_ASSERT_EQUAL(info.format.channel_count, ctx->channel_count);
+
+	ret = mbuf_audio_frame_get_buffer(frame, &data, &len);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		return;
+	CU_ASSERT_EQUAL(len,
+			(size_t)FRAME_SIZE * info.format.channel_count *
+				sizeof(int16_t));
+	mbuf_audio_frame_release_buffer(frame, data);
+
+	ret = adec_frame_get_levels(frame, &levels);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret == 0 && levels.channel_count == 2 &&
+	    ctx->out_count >= SETTLE_FRAME_COUNT) {
+		ratio = (levels.rms[1] > 0.f) ? levels.rms[0] / levels.rms[1]
+					      : 1000.f;
+		if (ctx->min_ratio == 0.f || ratio < ctx->min_ratio)
+			ctx->min_ratio = ratio;
+	}
+
+	ctx->out_count++;
+}
+
+
+static int push_au(struct adec_decoder *dec,
+		   const struct heaac_vector *vector,
+		   unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	void *data;
+	size_t capacity;
+	struct adef_frame info = {
+		.format =
+			{
+				.encoding = ADEF_ENCODING_AAC_LC,
+				.channel_count = 1,
+				.bit_depth = 16,
+				.sample_rate = SAMPLE_RATE,
+				.aac.data_format = ADEF_AAC_DATA_FORMAT_RAW,
+			},
+		.info.timestamp = (uint64_t)index * FRAME_SIZE,
+		.info.timescale = SAMPLE_RATE,
+		.info.index = index,
+	};
+
+	ret = mbuf_mem_generic_new(vector->au_size, &mem);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_mem_get_data(mem, &data, &capacity);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	memcpy(data, vector->au, vector->au_size);
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, vector->au_size);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+
+out:
+	if (frame != NULL)
+		mbuf_audio_frame_unref(frame);
+	if (mem != NULL)
+		mbuf_mem_unref(mem);
+	return ret;
+}
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	uint64_t us;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static bool fdk_aac_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_FDK_AAC,
+						&formats) > 0;
+}
+
+
+/* Decode a vector with the FDK AAC implementation, with an optional
+ * implementation specific configuration */
+static void decode_vector(const struct heaac_vector *vector,
+			  struct adec_config_impl *implem_cfg,
+			  struct heaac_ctx *ctx)
+{
+	int ret;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct adec_config config = {
+		.implem = ADEC_DECODER_IMPLEM_FDK_AAC,
+		.encoding = ADEF_ENCODING_AAC_LC,
+		.implem_cfg = implem_cfg,
+		.levels = 1,
+	};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	uint64_t start;
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, ctx, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = adec_set_aac_asc(
+		dec, vector->asc, vector->asc_size, ADEF_AAC_DATA_FORMAT_RAW);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	for (unsigned int i = 0; i < FRAME_COUNT; i++) {
+		while ((ret = push_au(dec, vector, i)) == -EAGAIN)
+			pomp_loop_wait_and_process(loop, 1);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+
+	start = now_us();
+	while (ctx->out_count < FRAME_COUNT &&
+	       now_us() - start < (uint64_t)TIMEOUT_MS * 1000)
+		pomp_loop_wait_and_process(loop, 10);
+	CU_ASSERT_EQUAL(ctx->out_count, FRAME_COUNT);
+	printf("\n    %s: %u channel(s), left to right level ratio %.1f",
+	       vector->name,
+	       ctx->channel_count,
+	       ctx->min_ratio);
+
+out:
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* HE-AAC v1 decodes to 2048 samples frames at the SBR sample rate */
+static void test_heaac_v1(void)
+{
+	struct heaac_ctx ctx = {0};
+
+	if (!fdk_aac_implem_available())
+		return;
+
+	decode_vector(&v1_vector, NULL, &ctx);
+
+	CU_ASSERT_EQUAL(ctx.channel_count, 1);
+}
+
+
+/* HE-AAC v2 decodes to stereo, with the parametric stereo applied (the
+ * left channel is 25dB louder; at least 12dB are expected) */
+static void test_heaac_v2(void)
+{
+	struct heaac_ctx ctx = {0};
+
+	if (!fdk_aac_implem_available())
+		return;
+
+	decode_vector(&v2_vector, NULL, &ctx);
+
+	CU_ASSERT_EQUAL(ctx.channel_count, 2);
+	CU_ASSERT(ctx.min_ratio > 4.f);
+}
+
+
+/* The FDK AAC specific options reduce the SBR filter bank cost and the
+ * output channel count, but do not bypass the SBR reconstruction: the
+ * output keeps the SBR sample rate and frame size */
+static void test_heaac_fdk_aac_options(void)
+{
+#ifdef BUILD_LIBAUDIO_DECODE_FDK_AAC
+	struct heaac_ctx ctx = {0};
+	struct adec_fdk_aac_config fdk_aac_config = {
+		.implem = ADEC_DECODER_IMPLEM_FDK_AAC,
+		.qmf_low_power = 1,
+		.mono_downmix = 1,
+	};
+
+	if (!fdk_aac_implem_available())
+		return;
+
+	decode_vector(&v2_vector,
+		      (struct adec_config_impl *)&fdk_aac_config,
+		      &ctx);
+
+	CU_ASSERT_EQUAL(ctx.channel_count, 1);
+#endif /* BUILD_LIBAUDIO_DECODE_FDK_AAC */
+}
+
+
+CU_TestInfo g_adec_test_heaac[] = {
+	{(char *)"v1", &test_heaac_v1},
+	{(char *)"v2", &test_heaac_v2},
+	{(char *)"fdk_aac_options", &test_heaac_fdk_aac_options},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define SAMPLE_RATE 48000
+/* Silent frames before the tone onset, then tone frames */
+#define SILENT_FRAME_COUNT 4
+#define TONE_FRAME_COUNT 8
+#define FRAME_COUNT (SILENT_FRAME_COUNT + TONE_FRAME_COUNT)
+/* Onset detection threshold; the tone peaks at about 700 */
+#define ONSET_THRESHOLD 16
+#define TIMEOUT_MS 5000
+
+
+/* Test vectors: 48kHz mono raw streams (ASC and access units) holding a
+ * single SCE with either no spectral data (silent frame) or one non-zero
+ * coefficient in the first scalefactor band (low-frequency tone); they
+ * were checked against an independent decoder, which outputs the
+ * expected frame sizes and the tone from the first tone frame */
+struct lowdelay_vector {
+	const char *name;
+	const uint8_t *asc;
+	size_t asc_size;
+	const uint8_t *silent_au;
+	size_t silent_au_size;
+	const uint8_t *tone_au;
+	size_t tone_au_size;
+	/* Expected output frame size in samples */
+	unsigned int frame_size;
+};
+
+
+/* AAC-LC, 1024 samples frames */
+static const uint8_t lc_asc[] = {0x11, 0x88};
+static const uint8_t lc_silent_au[] = {0x01, 0x68, 0x00, 0x07};
+static const uint8_t lc_tone_au[] = {0x01, 0x68, 0x00, 0x84, 0x21, 0x0e};
+
+/* ER AAC-LD, 480 samples frames (frameLengthFlag set) */
+static const uint8_t ld_asc[] = {0xb9, 0x8d, 0x00};
+static const uint8_t ld_silent_au[] = {0x0b, 0x40, 0x00, 0x00};
+static const uint8_t ld_tone_au[] = {0x0b, 0x40, 0x04, 0x21, 0x08, 0x00};
+
+/* ER AAC-ELD, 512 samples frames, no SBR */
+static const uint8_t eld_asc[] = {0xf8, 0xe6, 0x20, 0x00};
+static const uint8_t eld_silent_au[] = {0xb4, 0x00};
+static const uint8_t eld_tone_au[] = {0xb4, 0x04, 0x42, 0x40};
+
+
+#define LOWDELAY_VECTOR(_name, _prefix, _frame_size)                           \
+	{                                                                      \
+		.name = _name, .asc = _prefix##_asc,                           \
+		.asc_size = sizeof(_prefix##_asc),                             \
+		.silent_au = _prefix##_silent_au,                              \
+		.silent_au_size = sizeof(_prefix##_silent_au),                 \
+		.tone_au = _prefix##_tone_au,                                  \
+		.tone_au_size = sizeof(_prefix##_tone_au),                     \
+		.frame_size = _frame_size,                                     \
+	}
+
+
+static const struct lowdelay_vector lc_vector =
+	LOWDELAY_VECTOR("AAC-LC", lc, 1024);
+static const struct lowdelay_vector ld_vector =
+	LOWDELAY_VECTOR("AAC-LD", ld, 480);
+static const struct lowdelay_vector eld_vector =
+	LOWDELAY_VECTOR("AAC-ELD", eld, 512);
+
+
+struct lowdelay_ctx {
+	const struct lowdelay_vector *vector;
+	unsigned int out_count;
+	/* Samples output so far */
+	uint64_t out_samples;
+	/* Index of the first output sample above the threshold (-1 until
+	 * found) */
+	int64_t onset;
+	/* Sum of the input to output times reported by the decoder */
+	uint64_t latency_us;
+	unsigned int latency_count;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	int ret;
+	struct lowdelay_ctx *ctx = userdata;
+	struct adef_frame info;
+	struct adec_timings timings;
+	const void *data;
+	const int16_t *samples;
+	size_t len, count;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		return;
+	CU_ASSERT_EQUAL(info.format.channel_count, 1);
+	CU_ASSERT_EQUAL(info.format.bit_depth, 16);
+
+	ret = mbuf_audio_frame_get_buffer(frame, &data, &len);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		return;
+	samples = data;
+	count = len / sizeof(*samples);
+	CU_ASSERT_EQUAL(count, ctx->vector->frame_size);
+	for (size_t i = 0; i < count && ctx->onset < 0; i++) {
+		if (samples[i] > ONSET_THRESHOLD ||
+		    samples[i] < -ONSET_THRESHOLD)
+			ctx->onset = ctx->out_samples + i;
+	}
+	mbuf_audio_frame_release_buffer(frame, data);
+
+	ret = adec_get_frame_timings(dec, frame, &timings);
+	if (ret == 0 && timings.input_time != 0 &&
+	    timings.output_time >= timings.input_time) {
+		ctx->latency_us += timings.output_time - timings.input_time;
+		ctx->latency_count++;
+	}
+
+	ctx->out_samples += count;
+	ctx->out_count++;
+}
+
+
+static int push_au(struct adec_decoder *dec,
+		   const struct lowdelay_vector *vector,
+		   unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	const uint8_t *au = (index < SILENT_FRAME_COUNT) ? vector->silent_au
+							 : vector->tone_au;
+	size_t au_size = (index < SILENT_FRAME_COUNT) ? vector->silent_au_size
+						       : vector->tone_au_size;
+	void *data;
+	size_t capacity;
+	struct adef_frame info = {
+		.format =
+			{
+				.encoding = ADEF_ENCODING_AAC_LC,
+				.channel_count = 1,
+				.bit_depth = 16,
+				.sample_rate = SAMPLE_RATE,
+				.aac.data_format = ADEF_AAC_DATA_FORMAT_RAW,
+			},
+		.info.timestamp = (uint64_t)index * vector->frame_size,
+		.info.timescale = SAMPLE_RATE,
+		.info.index = index,
+	};
+
+	ret = mbuf_mem_generic_new(au_size, &mem);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_mem_get_data(mem, &data, &capacity);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	memcpy(data, au, au_size);
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, au_size);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+
+out:
+	if (frame != NULL)
+		mbuf_audio_frame_unref(frame);
+	if (mem != NULL)
+		mbuf_mem_unref(mem);
+	return ret;
+}
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	uint64_t us;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static bool fdk_aac_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_FDK_AAC,
+						&formats) > 0;
+}
+
+
+/* Decode a vector with the FDK AAC implementation and report its frame
+ * duration, the decoder delay (position of the tone onset in the output
+ * relative to the first tone frame) and the mean input to output time */
+static void decode_vector(const struct lowdelay_vector *vector,
+			  int64_t *delay)
+{
+	int ret;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct adec_config config = {
+		.implem = ADEC_DECODER_IMPLEM_FDK_AAC,
+		.encoding = ADEF_ENCODING_AAC_LC,
+	};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct lowdelay_ctx ctx = {
+		.vector = vector,
+		.onset = -1,
+	};
+	uint64_t start;
+
+	*delay = -1;
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, &ctx, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = adec_set_aac_asc(
+		dec, vector->asc, vector->asc_size, ADEF_AAC_DATA_FORMAT_RAW);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+
+	for (unsigned int i = 0; i < FRAME_COUNT; i++) {
+		while ((ret = push_au(dec, vector, i)) == -EAGAIN)
+			pomp_loop_wait_and_process(loop, 1);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+
+	start = now_us();
+	while (ctx.out_count < FRAME_COUNT &&
+	       now_us() - start < (uint64_t)TIMEOUT_MS * 1000)
+		pomp_loop_wait_and_process(loop, 10);
+	CU_ASSERT_EQUAL(ctx.out_count, FRAME_COUNT);
+	CU_ASSERT(ctx.onset >= 0);
+
+	if (ctx.onset >= 0) {
+		*delay = ctx.onset -
+			 (int64_t)SILENT_FRAME_COUNT * vector->frame_size;
+	}
+	printf("\n    %s: frame %u samples (%.1f ms), decoder delay %" PRIi64
+	       " samples, input to output %" PRIu64 " us",
+	       vector->name,
+	       vector->frame_size,
+	       vector->frame_size * 1000. / SAMPLE_RATE,
+	       *delay,
+	       (ctx.latency_count > 0) ? ctx.latency_us / ctx.latency_count
+				       : 0);
+
+out:
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* AAC-LD and AAC-ELD decode with 480 and 512 samples frames; the latency
+ * they add (frame duration plus decoder delay) must be lower than with
+ * AAC-LC */
+static void test_lowdelay_decode(void)
+{
+	int64_t lc_delay, ld_delay, eld_delay;
+
+	if (!fdk_aac_implem_available())
+		return;
+
+	decode_vector(&lc_vector, &lc_delay);
+	decode_vector(&ld_vector, &ld_delay);
+	decode_vector(&eld_vector, &eld_delay);
+
+	CU_ASSERT(lc_delay >= 0);
+	CU_ASSERT(ld_delay >= 0);
+	CU_ASSERT(eld_delay >= 0);
+	CU_ASSERT(ld_vector.frame_size + ld_delay <
+		  lc_vector.frame_size + lc_delay);
+	CU_ASSERT(eld_vector.frame_size + eld_delay <
+		  lc_vector.frame_size + lc_delay);
+}
+
+
+CU_TestInfo g_adec_test_lowdelay[] = {
+	{(char *)"decode", &test_lowdelay_decode},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define FRAME_SIZE 1024
+#define IN_FRAME_SIZE 16
+#define FRAME_COUNT 500
+#define MAX_IN_QUEUE_COUNT 2
+#define TIMEOUT_MS 5000
+
+
+struct queue_ctx {
+	struct pomp_loop *loop;
+	struct adec_decoder *dec;
+	unsigned int out_count;
+	unsigned int last_index;
+	unsigned int flush_count;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	int ret;
+	struct queue_ctx *ctx = userdata;
+	struct adef_frame info;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	CU_ASSERT_EQUAL(ret, 0);
+	/* Frames are output in order, whatever is dropped */
+	if (ctx->out_count > 0)
+		CU_ASSERT(info.info.index > ctx->last_index);
+	ctx->last_index = info.info.index;
+	ctx->out_count++;
+}
+
+
+static void flush_cb(struct adec_decoder *dec, void *userdata)
+{
+	struct queue_ctx *ctx = userdata;
+
+	ctx->flush_count++;
+}
+
+
+static int push_frame(struct adec_decoder *dec, unsigned int index)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	struct adef_frame info = {
+		.format = adef_aac_lc_16b_48000hz_stereo_raw,
+		.info.timestamp = (uint64_t)index * FRAME_SIZE,
+		.info.timescale = 48000,
+		.info.index = index,
+	};
+
+	/* The null implementation does not read the data */
+	ret = mbuf_mem_generic_new(IN_FRAME_SIZE, &mem);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	if (ret < 0)
+		goto out;
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, IN_FRAME_SIZE);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+
+out:
+	if (frame != NULL)
+		mbuf_audio_frame_unref(frame);
+	if (mem != NULL)
+		mbuf_mem_unref(mem);
+	return ret;
+}
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	uint64_t us;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+static bool null_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_NULL,
+						&formats) > 0;
+}
+
+
+static void queue_start(struct queue_ctx *ctx, struct adec_config *config)
+{
+	int ret;
+	struct adec_cbs cbs = {
+		.frame_output = &frame_output_cb,
+		.flush = &flush_cb,
+	};
+
+	ctx->loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ctx->loop);
+	config->implem = ADEC_DECODER_IMPLEM_NULL;
+	config->encoding = ADEF_ENCODING_AAC_LC;
+	config->max_in_queue_count = MAX_IN_QUEUE_COUNT;
+	ret = adec_new(ctx->loop, config, &cbs, ctx, &ctx->dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+}
+
+
+/* Run the loop until count flush callbacks have been called */
+static void wait_flushed(struct queue_ctx *ctx, unsigned int count)
+{
+	uint64_t start = now_us();
+
+	do {
+		pomp_loop_wait_and_process(ctx->loop, 10);
+	} while (ctx->flush_count < count &&
+		 now_us() - start < (uint64_t)TIMEOUT_MS * 1000);
+	CU_ASSERT_EQUAL(ctx->flush_count, count);
+}
+
+
+/* Flush without discarding and run the loop until the flush is complete */
+static void queue_drain(struct queue_ctx *ctx)
+{
+	int ret;
+
+	ret = adec_flush(ctx->dec, 0);
+	CU_ASSERT_EQUAL(ret, 0);
+	wait_flushed(ctx, ctx->flush_count + 1);
+}
+
+
+static void queue_stop(struct queue_ctx *ctx)
+{
+	int ret;
+
+	ret = adec_stop(ctx->dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(ctx->dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(ctx->loop, 0);
+	ret = pomp_loop_destroy(ctx->loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* The frames pushed while the decoder is busy are accounted exactly: every
+ * accepted frame is either decoded or dropped, and the latest frame is
+ * always decoded */
+static void test_queue_skip_to_latest(void)
+{
+	int ret;
+	struct queue_ctx ctx = {0};
+	struct adec_config config = {
+		.in_queue_drop_policy = ADEC_DROP_POLICY_SKIP_TO_LATEST,
+	};
+	struct adec_stats stats;
+	struct adec_memory_usage usage;
+	unsigned int i;
+
+	if (!null_implem_available())
+		return;
+
+	queue_start(&ctx, &config);
+
+	for (i = 0; i < FRAME_COUNT; i++) {
+		ret = push_frame(ctx.dec, i);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+	queue_drain(&ctx);
+
+	ret = adec_get_stats(ctx.dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.in_frames, FRAME_COUNT);
+	CU_ASSERT_EQUAL(stats.pulled_frames + stats.in_dropped_frames,
+			FRAME_COUNT);
+	CU_ASSERT_EQUAL(ctx.out_count, stats.pulled_frames);
+	CU_ASSERT_EQUAL(ctx.last_index, FRAME_COUNT - 1);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.in_queue_bytes, 0);
+
+	queue_stop(&ctx);
+}
+
+
+/* With the drop-newest policy the frames over the limits are rejected by
+ * the input filter, the accepted frames are all decoded */
+static void test_queue_newest(void)
+{
+	int ret;
+	struct queue_ctx ctx = {0};
+	struct adec_config config = {
+		.in_queue_drop_policy = ADEC_DROP_POLICY_NEWEST,
+	};
+	struct adec_stats stats;
+	struct adec_memory_usage usage;
+	unsigned int i, accepted = 0, rejected = 0;
+
+	if (!null_implem_available())
+		return;
+
+	queue_start(&ctx, &config);
+
+	for (i = 0; i < FRAME_COUNT; i++) {
+		ret = push_frame(ctx.dec, i);
+		if (ret == -EPROTO) {
+			rejected++;
+		} else {
+			CU_ASSERT_EQUAL(ret, 0);
+			accepted++;
+		}
+	}
+	queue_drain(&ctx);
+
+	ret = adec_get_stats(ctx.dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(stats.in_frames, accepted);
+	CU_ASSERT_EQUAL(stats.in_dropped_frames, rejected);
+	CU_ASSERT_EQUAL(stats.pulled_frames, accepted);
+	CU_ASSERT_EQUAL(ctx.out_count, accepted);
+	ret = adec_get_memory_usage(ctx.dec, &usage);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT_EQUAL(usage.in_queue_bytes, 0);
+
+	queue_stop(&ctx);
+}
+
+
+/* A discarding flush completes the pending non-discarding flushes: each
+ * flush is reported by its own callback */
+static void test_queue_flush(void)
+{
+	int ret;
+	struct queue_ctx ctx = {0};
+	struct adec_config config = {0};
+	unsigned int i;
+
+	if (!null_implem_available())
+		return;
+
+	queue_start(&ctx, &config);
+
+	/* Without running the loop, the barriers stay pending */
+	for (i = 0; i < 3; i++) {
+		ret = push_frame(ctx.dec, i);
+		CU_ASSERT_EQUAL(ret, 0);
+		ret = adec_flush(ctx.dec, 0);
+		CU_ASSERT_EQUAL(ret, 0);
+	}
+	ret = adec_flush(ctx.dec, 1);
+	CU_ASSERT_EQUAL(ret, 0);
+
+	/* Until the discarding flush is complete */
+	ret = adec_flush(ctx.dec, 1);
+	CU_ASSERT_EQUAL(ret, -EBUSY);
+	ret = adec_flush(ctx.dec, 0);
+	CU_ASSERT_EQUAL(ret, -EBUSY);
+	ret = push_frame(ctx.dec, 3);
+	CU_ASSERT_EQUAL(ret, -EPROTO);
+
+	wait_flushed(&ctx, 4);
+	ret = push_frame(ctx.dec, 4);
+	CU_ASSERT_EQUAL(ret, 0);
+	queue_drain(&ctx);
+	CU_ASSERT_EQUAL(ctx.flush_count, 5);
+	CU_ASSERT_EQUAL(ctx.last_index, 4);
+
+	queue_stop(&ctx);
+}
+
+
+CU_TestInfo g_adec_test_queue[] = {
+	{(char *)"skip_to_latest", &test_queue_skip_to_latest},
+	{(char *)"newest", &test_queue_newest},
+	{(char *)"flush", &test_queue_flush},
+	CU_TEST_INFO_NULL,
+};
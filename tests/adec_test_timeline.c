@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "adec_test.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <audio-decode/adec.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#include <futils/timetools.h>
+
+
+#define FRAME_SIZE 1024
+#define SAMPLE_RATE 48000
+#define BURST_FRAME_COUNT 100
+#define GAP_FRAME_COUNT 8
+#define TAIL_FRAME_COUNT 10
+#define STALL_US 300000
+#define TIMEOUT_MS 5000
+
+
+struct timeline_ctx {
+	unsigned int out_count;
+	/* Samples per channel output */
+	uint64_t out_samples;
+	/* Expected timestamp of the next output frame (end of the previous
+	 * one), and sum of the differences with the actual timestamps */
+	uint64_t next_ts;
+	int64_t ts_gaps;
+	uint64_t first_ts;
+};
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *frame,
+			    void *userdata)
+{
+	int ret;
+	struct timeline_ctx *ctx = userdata;
+	struct adef_frame info;
+	ssize_t size;
+	unsigned int samples;
+
+	CU_ASSERT_EQUAL(status, 0);
+	if (status != 0)
+		return;
+	ret = mbuf_audio_frame_get_frame_info(frame, &info);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	CU_ASSERT_EQUAL(info.info.timescale, SAMPLE_RATE);
+	size = mbuf_audio_frame_get_size(frame);
+	CU_ASSERT_FATAL(size > 0);
+	samples = size / info.format.channel_count /
+		  (info.format.bit_depth / 8);
+
+	if (ctx->out_count == 0)
+		ctx->first_ts = info.info.timestamp;
+	else
+		ctx->ts_gaps += (int64_t)(info.info.timestamp - ctx->next_ts);
+	ctx->next_ts = info.info.timestamp + samples;
+	ctx->out_samples += samples;
+	ctx->out_count++;
+}
+
+
+static void push_frame(struct adec_decoder *dec,
+		       unsigned int index,
+		       uint64_t timestamp)
+{
+	int ret;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	struct adef_frame info = {
+		.format = adef_aac_lc_16b_48000hz_stereo_raw,
+		.info.timestamp = timestamp,
+		.info.timescale = SAMPLE_RATE,
+		.info.index = index,
+	};
+
+	/* The null implementation does not read the data */
+	ret = mbuf_mem_generic_new(16, &mem);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = mbuf_audio_frame_new(&info, &frame);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	ret = mbuf_audio_frame_set_buffer(frame, mem, 0, 16);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_finalize(frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = mbuf_audio_frame_queue_push(adec_get_input_buffer_queue(dec),
+					  frame);
+	CU_ASSERT_EQUAL(ret, 0);
+	mbuf_audio_frame_unref(frame);
+	mbuf_mem_unref(mem);
+}
+
+
+/* Run the loop until count frames have been output */
+static void wait_output(struct pomp_loop *loop,
+			struct timeline_ctx *ctx,
+			unsigned int count)
+{
+	struct timespec ts;
+	uint64_t start, now;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &start);
+	do {
+		pomp_loop_wait_and_process(loop, 10);
+		time_get_monotonic(&ts);
+		time_timespec_to_us(&ts, &now);
+	} while (ctx->out_count < count &&
+		 now - start < (uint64_t)TIMEOUT_MS * 1000);
+	CU_ASSERT_EQUAL_FATAL(ctx->out_count, count);
+}
+
+
+static bool null_implem_available(void)
+{
+	const struct adef_format *formats;
+
+	return adec_get_supported_input_formats(ADEC_DECODER_IMPLEM_NULL,
+						&formats) > 0;
+}
+
+
+/* A frame arriving late after a stall leaves a backlog: the following burst
+ * is time-compressed, and the output timestamps follow the emitted samples
+ * while keeping the gaps of the input timestamps */
+static void test_timeline_catchup(void)
+{
+	int ret;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct timeline_ctx ctx = {0};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct adec_config config = {
+		.implem = ADEC_DECODER_IMPLEM_NULL,
+		.encoding = ADEF_ENCODING_AAC_LC,
+		.catchup = 1,
+	};
+	struct adec_stats stats;
+	unsigned int i, count;
+
+	if (!null_implem_available())
+		return;
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, &ctx, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	push_frame(dec, 0, 0);
+	wait_output(loop, &ctx, 1);
+	usleep(STALL_US);
+	for (i = 1; i < BURST_FRAME_COUNT; i++)
+		push_frame(dec, i, (uint64_t)i * FRAME_SIZE);
+	wait_output(loop, &ctx, BURST_FRAME_COUNT);
+	for (count = i + TAIL_FRAME_COUNT; i < count; i++) {
+		push_frame(dec,
+			   i,
+			   (uint64_t)(i + GAP_FRAME_COUNT) * FRAME_SIZE);
+	}
+	wait_output(loop, &ctx, count);
+
+	ret = adec_get_stats(dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT(stats.catchup_frames > 0);
+	CU_ASSERT(stats.catchup_removed_samples > 0);
+	CU_ASSERT_EQUAL(ctx.first_ts, 0);
+	CU_ASSERT_EQUAL(ctx.out_samples,
+			(uint64_t)count * FRAME_SIZE -
+				stats.catchup_removed_samples);
+	CU_ASSERT_EQUAL(ctx.ts_gaps, GAP_FRAME_COUNT * FRAME_SIZE);
+
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+/* With a latency under the set-point the drift compensation lengthens the
+ * output, and the output timestamps stay contiguous */
+static void test_timeline_drift(void)
+{
+	int ret;
+	struct pomp_loop *loop;
+	struct adec_decoder *dec = NULL;
+	struct timeline_ctx ctx = {0};
+	struct adec_cbs cbs = {.frame_output = &frame_output_cb};
+	struct adec_config config = {
+		.implem = ADEC_DECODER_IMPLEM_NULL,
+		.encoding = ADEF_ENCODING_AAC_LC,
+		.drift_compensation = 1,
+		.drift_target_latency_ms = 500,
+	};
+	struct adec_stats stats;
+	struct adec_drift_stats drift;
+	unsigned int i;
+
+	if (!null_implem_available())
+		return;
+
+	loop = pomp_loop_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(loop);
+	ret = adec_new(loop, &config, &cbs, &ctx, &dec);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	push_frame(dec, 0, 0);
+	wait_output(loop, &ctx, 1);
+	ret = adec_set_playout_time(dec, 0);
+	CU_ASSERT_EQUAL(ret, 0);
+	for (i = 1; i < BURST_FRAME_COUNT; i++)
+		push_frame(dec, i, (uint64_t)i * FRAME_SIZE);
+	wait_output(loop, &ctx, BURST_FRAME_COUNT);
+
+	ret = adec_get_stats(dec, &stats);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_get_drift_stats(dec, &drift);
+	CU_ASSERT_EQUAL(ret, 0);
+	CU_ASSERT(drift.sample_offset > 0);
+	CU_ASSERT_EQUAL(ctx.first_ts, 0);
+	CU_ASSERT_EQUAL((int64_t)ctx.out_samples,
+			(int64_t)BURST_FRAME_COUNT * FRAME_SIZE +
+				drift.sample_offset);
+	CU_ASSERT_EQUAL(ctx.ts_gaps, 0);
+
+	ret = adec_stop(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = adec_destroy(dec);
+	CU_ASSERT_EQUAL(ret, 0);
+	pomp_loop_wait_and_process(loop, 0);
+	ret = pomp_loop_destroy(loop);
+	CU_ASSERT_EQUAL(ret, 0);
+}
+
+
+CU_TestInfo g_adec_test_timeline[] = {
+	{(char *)"catchup", &test_timeline_catchup},
+	{(char *)"drift", &test_timeline_drift},
+	CU_TEST_INFO_NULL,
+};
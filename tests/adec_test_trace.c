@@ -0,0 +1,256 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "adec_test.h"
+
+#include <pthread.h>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif /* __linux__ */
+
+
+#define WRITER_COUNT 4
+#define WRITER_EVENT_COUNT 20000
+#define WRITER_SHIFT 24
+
+
+struct writer {
+	struct adec_decoder *base;
+	unsigned int id;
+	uint32_t thread_id;
+};
+
+
+static uint32_t get_thread_id(void)
+{
+#ifdef __linux__
+	return (uint32_t)syscall(SYS_gettid);
+#else /* !__linux__ */
+	return (uint32_t)(uintptr_t)pthread_self();
+#endif /* !__linux__ */
+}
+
+
+static void test_trace_wrap(void)
+{
+	int ret;
+	struct adec_decoder base = {0};
+	struct adec_trace_event events[16];
+
+	/* The ring size is rounded up to a power of 2 */
+	ret = adec_trace_new(5, &base.trace);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	ret = adec_trace_read(base.trace, events, 16);
+	CU_ASSERT_EQUAL(ret, 0);
+
+	for (uint32_t i = 0; i < 20; i++)
+		adec_trace_record(&base, ADEC_TRACE_EVENT_INPUT + i % 5, i);
+
+	/* Only the last 8 events are kept, oldest first */
+	ret = adec_trace_read(base.trace, events, 16);
+	CU_ASSERT_EQUAL(ret, 8);
+	for (int i = 0; i < ret; i++) {
+		CU_ASSERT_EQUAL(events[i].index, (uint32_t)(12 + i));
+		CU_ASSERT_EQUAL(events[i].type,
+				ADEC_TRACE_EVENT_INPUT + (12 + i) % 5);
+		CU_ASSERT_EQUAL(events[i].thread_id, get_thread_id());
+		if (i > 0)
+			CU_ASSERT(events[i].ts_us >= events[i - 1].ts_us);
+	}
+
+	/* A smaller array gets the most recent events */
+	ret = adec_trace_read(base.trace, events, 3);
+	CU_ASSERT_EQUAL(ret, 3);
+	CU_ASSERT_EQUAL(events[0].index, 17);
+	CU_ASSERT_EQUAL(events[2].index, 19);
+
+	adec_trace_destroy(base.trace);
+}
+
+
+static void *writer_thread(void *userdata)
+{
+	struct writer *writer = userdata;
+
+	writer->thread_id = get_thread_id();
+	for (uint32_t i = 0; i < WRITER_EVENT_COUNT; i++) {
+		adec_trace_record(writer->base,
+				  ADEC_TRACE_EVENT_DEQUEUE,
+				  (writer->id << WRITER_SHIFT) | i);
+	}
+	return NULL;
+}
+
+
+static void check_events(const struct adec_trace_event *events,
+			 int count,
+			 const struct writer *writers,
+			 uint32_t *last)
+{
+	unsigned int id;
+	uint32_t seq;
+
+	for (int i = 0; i < count; i++) {
+		/* Each event must be consistent (no torn slot) and the
+		 * events of a thread must stay in order */
+		CU_ASSERT_EQUAL(events[i].type, ADEC_TRACE_EVENT_DEQUEUE);
+		id = events[i].index >> WRITER_SHIFT;
+		seq = events[i].index & ((1 << WRITER_SHIFT) - 1);
+		CU_ASSERT_FATAL(id < WRITER_COUNT);
+		CU_ASSERT(seq < WRITER_EVENT_COUNT);
+		if (writers[id].thread_id != 0)
+			CU_ASSERT_EQUAL(events[i].thread_id,
+					writers[id].thread_id);
+		if (last[id] != UINT32_MAX)
+			CU_ASSERT(seq > last[id]);
+		last[id] = seq;
+	}
+}
+
+
+static void test_trace_concurrent(void)
+{
+	int ret;
+	struct adec_decoder base = {0};
+	struct writer writers[WRITER_COUNT];
+	pthread_t threads[WRITER_COUNT];
+	struct adec_trace_event *events;
+	uint32_t last[WRITER_COUNT];
+	unsigned int done;
+
+	events = calloc(1024, sizeof(*events));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(events);
+	ret = adec_trace_new(1024, &base.trace);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	for (unsigned int i = 0; i < WRITER_COUNT; i++) {
+		writers[i].base = &base;
+		writers[i].id = i;
+		writers[i].thread_id = 0;
+		ret = pthread_create(
+			&threads[i], NULL, writer_thread, &writers[i]);
+		CU_ASSERT_EQUAL_FATAL(ret, 0);
+	}
+
+	/* Read while the ring is being written */
+	for (done = 0; done < 200; done++) {
+		for (unsigned int i = 0; i < WRITER_COUNT; i++)
+			last[i] = UINT32_MAX;
+		ret = adec_trace_read(base.trace, events, 1024);
+		CU_ASSERT(ret >= 0 && ret <= 1024);
+		check_events(events, ret, writers, last);
+	}
+
+	for (unsigned int i = 0; i < WRITER_COUNT; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Contended events can be dropped, but never torn */
+	for (unsigned int i = 0; i < WRITER_COUNT; i++)
+		last[i] = UINT32_MAX;
+	ret = adec_trace_read(base.trace, events, 1024);
+	CU_ASSERT(ret > 0 && ret <= 1024);
+	check_events(events, ret, writers, last);
+
+	/* A full lap from a single writer leaves the ring complete */
+	writers[0].thread_id = get_thread_id();
+	for (uint32_t i = 0; i < 1024; i++)
+		adec_trace_record(&base,
+				  ADEC_TRACE_EVENT_DEQUEUE,
+				  WRITER_EVENT_COUNT + i);
+	ret = adec_trace_read(base.trace, events, 1024);
+	CU_ASSERT_EQUAL(ret, 1024);
+	for (int i = 0; i < ret; i++) {
+		CU_ASSERT_EQUAL(events[i].index, WRITER_EVENT_COUNT + i);
+		CU_ASSERT_EQUAL(events[i].thread_id, writers[0].thread_id);
+	}
+
+	adec_trace_destroy(base.trace);
+	free(events);
+}
+
+
+static void test_trace_export(void)
+{
+	int ret;
+	struct adec_decoder base = {0};
+	struct writer writer = {.base = &base, .id = 1};
+	pthread_t thread;
+	char *buf = NULL, *p;
+	size_t len = 0;
+	char expected[64];
+	FILE *stream;
+
+	ret = adec_trace_new(WRITER_EVENT_COUNT + 1, &base.trace);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+
+	adec_trace_record(&base, ADEC_TRACE_EVENT_INPUT, 0);
+	ret = pthread_create(&thread, NULL, writer_thread, &writer);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	pthread_join(thread, NULL);
+
+	stream = open_memstream(&buf, &len);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(stream);
+	ret = adec_trace_export(
+		base.trace, ADEC_TRACE_FORMAT_CHROME_JSON, 7, stream);
+	CU_ASSERT_EQUAL(ret, 0);
+	fclose(stream);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+
+	/* The input event is on the track of the recording thread, the
+	 * other events on the track of the writer thread */
+	p = strstr(buf, "\"name\":\"INPUT\"");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(p);
+	snprintf(expected,
+		 sizeof(expected),
+		 "\"pid\":7,\"tid\":%" PRIu32 ",",
+		 get_thread_id());
+	CU_ASSERT(strncmp(strstr(p, "\"pid\""), expected, strlen(expected)) ==
+		  0);
+	p = strstr(p, "\"name\":\"DEQUEUE\"");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(p);
+	snprintf(expected,
+		 sizeof(expected),
+		 "\"pid\":7,\"tid\":%" PRIu32 ",",
+		 writer.thread_id);
+	CU_ASSERT(strncmp(strstr(p, "\"pid\""), expected, strlen(expected)) ==
+		  0);
+	CU_ASSERT_NOT_EQUAL(writer.thread_id, get_thread_id());
+
+	free(buf);
+	adec_trace_destroy(base.trace);
+}
+
+
+CU_TestInfo g_adec_test_trace[] = {
+	{(char *)"wrap", &test_trace_wrap},
+	{(char *)"concurrent", &test_trace_concurrent},
+	{(char *)"export", &test_trace_export},
+	CU_TEST_INFO_NULL,
+};
@@ -65,6 +65,15 @@ static inline const char *strsignal(int signum)
 #define DEFAULT_IN_BUF_COUNT 25
 #define DEFAULT_TS_INC 33333
 #define AAC_FRAME_LENGTH 1024
+#define DEFAULT_TRACE_EVENT_COUNT 65536
+
+
+struct latency_stats {
+	unsigned int count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
 
 
 struct adec_prog {
@@ -113,6 +122,10 @@ struct adec_prog {
 	uint8_t *pending_frame;
 	size_t pending_frame_len;
 	struct aac_adts pending_frame_adts;
+	char *trace_file;
+	struct latency_stats dequeue_latency;
+	struct latency_stats decode_latency;
+	struct latency_stats overall_latency;
 };
 
 
@@ -592,26 +605,57 @@ out:
 }
 
 
-static uint64_t get_timestamp(struct mbuf_audio_frame *frame, const char *key)
+static void latency_stats_add(struct latency_stats *stats,
+			      uint64_t start,
+			      uint64_t end)
 {
-	int res;
-	struct mbuf_ancillary_data *data;
-	uint64_t ts = 0;
-	const void *raw_data;
-	size_t len;
+	uint64_t val;
 
-	res = mbuf_audio_frame_get_ancillary_data(frame, key, &data);
-	if (res < 0)
-		return 0;
+	if (start == 0 || end < start)
+		return;
 
-	raw_data = mbuf_ancillary_data_get_buffer(data, &len);
-	if (!raw_data || len != sizeof(ts))
-		goto out;
-	memcpy(&ts, raw_data, sizeof(ts));
+	val = end - start;
+	if (stats->count == 0 || val < stats->min)
+		stats->min = val;
+	if (val > stats->max)
+		stats->max = val;
+	stats->sum += val;
+	stats->count++;
+}
 
-out:
-	mbuf_ancillary_data_unref(data);
-	return ts;
+
+static void latency_stats_print(const char *name,
+				const struct latency_stats *stats)
+{
+	if (stats->count == 0)
+		return;
+
+	printf("%s latency: avg=%.2fms min=%.2fms max=%.2fms\n",
+	       name,
+	       (float)stats->sum / stats->count / 1000.,
+	       (float)stats->min / 1000.,
+	       (float)stats->max / 1000.);
+}
+
+
+static void channel_map_output(struct adec_prog *self)
+{
+	int res;
+	enum adec_channel map[ADEC_MAX_CHANNEL_COUNT];
+
+	res = adec_get_output_channel_map(
+		self->decoder, map, ADEC_MAX_CHANNEL_COUNT);
+	if (res < 0) {
+		if (res != -ENOSYS)
+			ULOG_ERRNO("adec_get_output_channel_map", -res);
+		return;
+	}
+
+	printf("Output channels (%s order):",
+	       adec_channel_order_str(self->config.output_channel_order));
+	for (int i = 0; i < res; i++)
+		printf(" %s", adec_channel_str(map[i]));
+	printf("\n");
 }
 
 
@@ -619,28 +663,29 @@ static int frame_output(struct adec_prog *self,
 			struct mbuf_audio_frame *out_frame)
 {
 	int res = 0;
-	uint64_t input_time, dequeue_time, output_time;
-	struct adef_frame info;
+	struct adec_timings timings;
+
+	if (self->first_out_frame)
+		channel_map_output(self);
 
 	res = wav_output(self, out_frame);
 	if (res < 0)
 		ULOG_ERRNO("wav_output", -res);
 
-	input_time = get_timestamp(out_frame, ADEC_ANCILLARY_KEY_INPUT_TIME);
-	dequeue_time =
-		get_timestamp(out_frame, ADEC_ANCILLARY_KEY_DEQUEUE_TIME);
-	output_time = get_timestamp(out_frame, ADEC_ANCILLARY_KEY_OUTPUT_TIME);
-
-	res = mbuf_audio_frame_get_frame_info(out_frame, &info);
-	if (res < 0)
-		ULOG_ERRNO("mbuf_audio_frame_get_frame_info", -res);
-
-	ULOGI("decoded frame #%d, dequeue: %.2fms, decode: %.2fms, "
-	      "overall: %.2fms",
-	      info.info.index,
-	      (float)(dequeue_time - input_time) / 1000.,
-	      (float)(output_time - dequeue_time) / 1000.,
-	      (float)(output_time - input_time) / 1000.);
+	/* Per-frame latencies are only accumulated here, the summary is
+	 * printed when decoding is finished */
+	res = adec_get_frame_timings(self->decoder, out_frame, &timings);
+	if (res == 0) {
+		latency_stats_add(&self->dequeue_latency,
+				  timings.input_time,
+				  timings.dequeue_time);
+		latency_stats_add(&self->decode_latency,
+				  timings.dequeue_time,
+				  timings.output_time);
+		latency_stats_add(&self->overall_latency,
+				  timings.input_time,
+				  timings.output_time);
+	}
 
 	self->first_out_frame = 0;
 
@@ -648,6 +693,65 @@ static int frame_output(struct adec_prog *self,
 }
 
 
+static void stats_output(struct adec_prog *self)
+{
+	int res;
+	struct adec_stats stats;
+	struct adec_cpu_stats cpu;
+
+	res = adec_get_stats(self->decoder, &stats);
+	if (res < 0) {
+		ULOG_ERRNO("adec_get_stats", -res);
+		return;
+	}
+
+	printf("Decoding path allocations: memories=%u frames=%u "
+	       "ancillary=%u (dropped frames: %u)\n",
+	       stats.out_mem_allocs,
+	       stats.out_frame_allocs,
+	       stats.ancillary_allocs,
+	       stats.out_dropped_frames);
+
+	res = adec_get_cpu_stats(self->decoder, &cpu);
+	if (res < 0 || cpu.frame_count == 0)
+		return;
+	printf("Decoding CPU time: total=%.3fms per frame: p50=%.1fus "
+	       "p90=%.1fus p99=%.1fus max=%.1fus\n",
+	       (double)cpu.total_ns / 1000000.,
+	       (double)cpu.p50_ns / 1000.,
+	       (double)cpu.p90_ns / 1000.,
+	       (double)cpu.p99_ns / 1000.,
+	       (double)cpu.max_ns / 1000.);
+}
+
+
+static int trace_output(struct adec_prog *self)
+{
+	int res;
+	FILE *f;
+
+	if (self->trace_file == NULL || self->decoder == NULL)
+		return 0;
+
+	f = fopen(self->trace_file, "w");
+	if (f == NULL) {
+		res = -errno;
+		ULOG_ERRNO("fopen('%s')", -res, self->trace_file);
+		return res;
+	}
+
+	res = adec_export_trace(
+		self->decoder, ADEC_TRACE_FORMAT_CHROME_JSON, f);
+	if (res < 0)
+		ULOG_ERRNO("adec_export_trace", -res);
+	else
+		printf("Trace written to %s\n", self->trace_file);
+
+	fclose(f);
+	return res;
+}
+
+
 static void frame_output_cb(struct adec_decoder *dec,
 			    int status,
 			    struct mbuf_audio_frame *out_frame,
@@ -838,7 +942,7 @@ static void sig_handler(int signum)
 }
 
 
-static const char short_options[] = "hi:o:s:n:";
+static const char short_options[] = "hi:o:s:n:t:m:rI:c:C:";
 
 
 static const struct option long_options[] = {
@@ -847,6 +951,12 @@ static const struct option long_options[] = {
 	{"outfile", required_argument, NULL, 'o'},
 	{"start", required_argument, NULL, 's'},
 	{"count", required_argument, NULL, 'n'},
+	{"trace", required_argument, NULL, 't'},
+	{"timing", required_argument, NULL, 'm'},
+	{"realtime", no_argument, NULL, 'r'},
+	{"implem", required_argument, NULL, 'I'},
+	{"channel-order", required_argument, NULL, 'c'},
+	{"capture", required_argument, NULL, 'C'},
 	{0, 0, 0, 0},
 };
 
@@ -873,6 +983,24 @@ static void usage(char *prog_name)
 	       "Start decoding at frame index i\n"
 	       "  -n | --count <n>                   "
 	       "Decode at most n frames\n"
+	       "  -t | --trace <file_name>           "
+	       "Record per-frame timing events and export them as a\n"
+	       "                                     "
+	       "Chrome trace JSON file (chrome://tracing, Perfetto)\n"
+	       "  -m | --timing <mode>               "
+	       "Frame timing mode: 'precise' (default), 'coarse' or 'none'\n"
+	       "  -r | --realtime                    "
+	       "Real-time decoding (preallocated output memories)\n"
+	       "  -I | --implem <implem>             "
+	       "Decoder implementation: 'auto' (default), 'fdk_aac' or\n"
+	       "                                     "
+	       "'null' (no decoding, measures the library overhead)\n"
+	       "  -c | --channel-order <order>       "
+	       "Output channel order: 'wav' (default) or 'mpeg'\n"
+	       "  -C | --capture <file_name>         "
+	       "Record a capture of the decoder input, to be replayed\n"
+	       "                                     "
+	       "with adec-replay\n"
 	       "\n",
 	       prog_name);
 }
@@ -948,6 +1076,69 @@ int main(int argc, char **argv)
 			self->max_count = atoi(optarg);
 			break;
 
+		case 'm':
+			if (strcasecmp(optarg, "precise") == 0) {
+				self->config.timing_mode =
+					ADEC_TIMING_MODE_PRECISE;
+			} else if (strcasecmp(optarg, "coarse") == 0) {
+				self->config.timing_mode =
+					ADEC_TIMING_MODE_COARSE;
+			} else if (strcasecmp(optarg, "none") == 0) {
+				self->config.timing_mode =
+					ADEC_TIMING_MODE_NONE;
+			} else {
+				ULOGE("invalid timing mode: '%s'", optarg);
+				usage(argv[0]);
+				status = EXIT_FAILURE;
+				goto out;
+			}
+			break;
+
+		case 'r':
+			self->config.realtime = 1;
+			break;
+
+		case 'c':
+			if (strcasecmp(optarg, "wav") == 0) {
+				self->config.output_channel_order =
+					ADEC_CHANNEL_ORDER_WAV;
+			} else if (strcasecmp(optarg, "mpeg") == 0) {
+				self->config.output_channel_order =
+					ADEC_CHANNEL_ORDER_MPEG;
+			} else {
+				ULOGE("invalid channel order: '%s'", optarg);
+				usage(argv[0]);
+				status = EXIT_FAILURE;
+				goto out;
+			}
+			break;
+
+		case 'I':
+			if (strcasecmp(optarg, "auto") == 0) {
+				self->config.implem = ADEC_DECODER_IMPLEM_AUTO;
+			} else if (strcasecmp(optarg, "fdk_aac") == 0) {
+				self->config.implem =
+					ADEC_DECODER_IMPLEM_FDK_AAC;
+			} else if (strcasecmp(optarg, "null") == 0) {
+				self->config.implem = ADEC_DECODER_IMPLEM_NULL;
+			} else {
+				ULOGE("invalid implementation: '%s'", optarg);
+				usage(argv[0]);
+				status = EXIT_FAILURE;
+				goto out;
+			}
+			break;
+
+		case 'C':
+			self->config.capture_path = optarg;
+			break;
+
+		case 't':
+			self->trace_file = optarg;
+			self->config.trace_event_count =
+				DEFAULT_TRACE_EVENT_COUNT;
+			break;
+
 		default:
 			usage(argv[0]);
 			status = EXIT_FAILURE;
@@ -1002,6 +1193,7 @@ int main(int argc, char **argv)
 	}
 
 	self->in_info.info.timescale = 1000000;
+	self->config.cpu_accounting = 1;
 	if (self->config.implem == ADEC_DECODER_IMPLEM_AUTO)
 		self->config.implem = adec_get_auto_implem();
 
@@ -1066,6 +1258,12 @@ int main(int argc, char **argv)
 		       bitrate_scaled,
 		       bitrate_str);
 	}
+	latency_stats_print("Dequeue", &self->dequeue_latency);
+	latency_stats_print("Decode", &self->decode_latency);
+	latency_stats_print("Overall", &self->overall_latency);
+	stats_output(self);
+
+	(void)trace_output(self);
 
 out:
 	/* Cleanup and exit */
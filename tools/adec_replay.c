@@ -0,0 +1,709 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#	include <winsock2.h>
+#	include <windows.h>
+#else /* !_WIN32 */
+#	include <arpa/inet.h>
+#endif /* !_WIN32 */
+
+#include <audio-decode/adec.h>
+#include <futils/futils.h>
+#include <libpomp.h>
+#include <media-buffers/mbuf_audio_frame.h>
+#include <media-buffers/mbuf_mem_generic.h>
+#define ULOG_TAG adec_replay
+#include <ulog.h>
+ULOG_DECLARE_TAG(adec_replay);
+
+/* Win32 stubs */
+#ifdef _WIN32
+static inline const char *strsignal(int signum)
+{
+	return "??";
+}
+#endif /* _WIN32 */
+
+
+struct latency_stats {
+	unsigned int count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+
+struct adec_replay {
+	char *capture_file;
+	int fast;
+	struct pomp_loop *loop;
+	struct pomp_timer *timer;
+	struct adec_capture_reader *reader;
+	struct adec_capture_record record;
+	int record_pending;
+	struct adec_decoder *decoder;
+	struct adec_config config;
+	struct mbuf_pool *in_pool;
+	struct mbuf_audio_frame_queue *in_queue;
+	uint64_t start_time;
+	int input_finished;
+	int stopping;
+	int stopped;
+	unsigned int input_count;
+	unsigned int rejected_count;
+	unsigned int output_count;
+	uint64_t audio_duration_us;
+	struct latency_stats latency;
+};
+
+
+static struct adec_replay *s_self;
+static int s_stopping;
+
+
+static void replay_idle(void *userdata);
+
+
+static uint64_t get_time_us(void)
+{
+	struct timespec cur_ts = {0, 0};
+	uint64_t ts_us = 0;
+
+	time_get_monotonic(&cur_ts);
+	time_timespec_to_us(&cur_ts, &ts_us);
+	return ts_us;
+}
+
+
+static void latency_stats_add(struct latency_stats *stats,
+			      uint64_t start,
+			      uint64_t end)
+{
+	uint64_t val;
+
+	if (start == 0 || end < start)
+		return;
+
+	val = end - start;
+	if (stats->count == 0 || val < stats->min)
+		stats->min = val;
+	if (val > stats->max)
+		stats->max = val;
+	stats->sum += val;
+	stats->count++;
+}
+
+
+static void stop_decoder(struct adec_replay *self)
+{
+	int res;
+
+	if (self->stopping)
+		return;
+	self->stopping = 1;
+
+	res = adec_stop(self->decoder);
+	if (res < 0)
+		ULOG_ERRNO("adec_stop", -res);
+}
+
+
+static int push_frame(struct adec_replay *self,
+		      const struct adec_capture_record *record)
+{
+	int res, err;
+	struct mbuf_mem *mem = NULL;
+	struct mbuf_audio_frame *frame = NULL;
+	void *data;
+	size_t capacity;
+
+	if (self->in_queue == NULL) {
+		self->in_queue = adec_get_input_buffer_queue(self->decoder);
+		if (self->in_queue == NULL) {
+			res = -EPROTO;
+			ULOG_ERRNO("adec_get_input_buffer_queue", -res);
+			return res;
+		}
+		self->in_pool = adec_get_input_buffer_pool(self->decoder);
+	}
+
+	/* Use the decoder pool if any; if it is exhausted the frame is still
+	 * pushed, to keep the original arrival timing */
+	res = (self->in_pool != NULL) ? mbuf_pool_get(self->in_pool, &mem)
+				      : -ENOENT;
+	if (res == 0) {
+		res = mbuf_mem_get_data(mem, &data, &capacity);
+		if (res < 0 || capacity < record->len) {
+			mbuf_mem_unref(mem);
+			mem = NULL;
+		}
+	}
+	if (mem == NULL) {
+		res = mbuf_mem_generic_new(record->len, &mem);
+		if (res < 0) {
+			ULOG_ERRNO("mbuf_mem_generic_new", -res);
+			return res;
+		}
+		res = mbuf_mem_get_data(mem, &data, &capacity);
+		if (res < 0) {
+			ULOG_ERRNO("mbuf_mem_get_data", -res);
+			goto out;
+		}
+	}
+	memcpy(data, record->data, record->len);
+
+	res = mbuf_audio_frame_new((struct adef_frame *)&record->frame,
+				   &frame);
+	if (res < 0) {
+		ULOG_ERRNO("mbuf_audio_frame_new", -res);
+		goto out;
+	}
+	res = mbuf_audio_frame_set_buffer(frame, mem, 0, record->len);
+	if (res < 0) {
+		ULOG_ERRNO("mbuf_audio_frame_set_buffer", -res);
+		goto out;
+	}
+	res = mbuf_audio_frame_finalize(frame);
+	if (res < 0) {
+		ULOG_ERRNO("mbuf_audio_frame_finalize", -res);
+		goto out;
+	}
+
+	res = mbuf_audio_frame_queue_push(self->in_queue, frame);
+	if (res < 0) {
+		/* Rejected by the input filter (e.g. queue limits) */
+		self->rejected_count++;
+		res = 0;
+	} else {
+		self->input_count++;
+	}
+
+out:
+	if (frame != NULL) {
+		err = mbuf_audio_frame_unref(frame);
+		if (err < 0)
+			ULOG_ERRNO("mbuf_audio_frame_unref", -err);
+	}
+	err = mbuf_mem_unref(mem);
+	if (err < 0)
+		ULOG_ERRNO("mbuf_mem_unref", -err);
+	return res;
+}
+
+
+static int process_record(struct adec_replay *self,
+			  const struct adec_capture_record *record)
+{
+	int res = 0;
+
+	switch (record->type) {
+	case ADEC_CAPTURE_RECORD_ASC:
+		res = adec_set_aac_asc(self->decoder,
+				       record->data,
+				       record->len,
+				       record->asc.data_format);
+		if (res < 0)
+			ULOG_ERRNO("adec_set_aac_asc", -res);
+		break;
+	case ADEC_CAPTURE_RECORD_FRAME:
+		res = push_frame(self, record);
+		break;
+	case ADEC_CAPTURE_RECORD_FLUSH:
+		res = adec_flush(self->decoder, record->flush.discard);
+		if (res < 0)
+			ULOG_ERRNO("adec_flush", -res);
+		break;
+	case ADEC_CAPTURE_RECORD_STOP:
+		stop_decoder(self);
+		break;
+	default:
+		/* Nothing to replay */
+		break;
+	}
+
+	return res;
+}
+
+
+static void finish(struct adec_replay *self)
+{
+	int res;
+
+	if (self->input_finished)
+		return;
+	self->input_finished = 1;
+
+	ULOGI("replay is finished (input, count=%u)", self->input_count);
+	if (self->stopping)
+		return;
+
+	/* Drain the decoder; the flush callback stops it */
+	res = adec_flush(self->decoder, s_stopping ? 1 : 0);
+	if (res < 0) {
+		ULOG_ERRNO("adec_flush", -res);
+		stop_decoder(self);
+	}
+}
+
+
+static void replay_step(struct adec_replay *self)
+{
+	int res;
+	uint64_t now, delay;
+
+	while (!self->stopping && !s_stopping) {
+		if (!self->record_pending) {
+			res = adec_capture_reader_read(self->reader,
+						       &self->record);
+			if (res < 0) {
+				if (res != -ENODATA)
+					ULOG_ERRNO("adec_capture_reader_read",
+						   -res);
+				break;
+			}
+			self->record_pending = 1;
+		}
+
+		if (!self->fast) {
+			/* Wait for the original arrival time */
+			now = get_time_us() - self->start_time;
+			if (self->record.time_us > now) {
+				delay = (self->record.time_us - now + 999) /
+					1000;
+				res = pomp_timer_set(self->timer, delay);
+				if (res < 0)
+					ULOG_ERRNO("pomp_timer_set", -res);
+				return;
+			}
+		}
+
+		self->record_pending = 0;
+		res = process_record(self, &self->record);
+		if (res < 0)
+			break;
+
+		if (self->fast) {
+			/* Let the loop process the output frames */
+			res = pomp_loop_idle_add_with_cookie(
+				self->loop, replay_idle, self, self);
+			if (res < 0)
+				ULOG_ERRNO("pomp_loop_idle_add_with_cookie",
+					   -res);
+			return;
+		}
+	}
+
+	finish(self);
+}
+
+
+static void replay_idle(void *userdata)
+{
+	replay_step(userdata);
+}
+
+
+static void timer_cb(struct pomp_timer *timer, void *userdata)
+{
+	replay_step(userdata);
+}
+
+
+static void frame_output_cb(struct adec_decoder *dec,
+			    int status,
+			    struct mbuf_audio_frame *out_frame,
+			    void *userdata)
+{
+	int res;
+	struct adec_replay *self = userdata;
+	struct adec_timings timings;
+	struct adef_frame info;
+	ssize_t len;
+
+	ULOG_ERRNO_RETURN_IF(self == NULL, EINVAL);
+
+	if (status != 0) {
+		ULOGE("decoder error, resync required");
+		return;
+	}
+	ULOG_ERRNO_RETURN_IF(out_frame == NULL, EINVAL);
+
+	self->output_count++;
+
+	res = adec_get_frame_timings(self->decoder, out_frame, &timings);
+	if (res == 0) {
+		latency_stats_add(&self->latency,
+				  timings.input_time,
+				  timings.output_time);
+	}
+
+	res = mbuf_audio_frame_get_frame_info(out_frame, &info);
+	len = mbuf_audio_frame_get_size(out_frame);
+	if (res == 0 && len > 0 && info.format.sample_rate > 0 &&
+	    info.format.channel_count > 0 && info.format.bit_depth > 0) {
+		self->audio_duration_us +=
+			(uint64_t)len * 8 * 1000000 /
+			(info.format.channel_count * info.format.bit_depth *
+			 info.format.sample_rate);
+	}
+}
+
+
+static void flush_cb(struct adec_decoder *dec, void *userdata)
+{
+	struct adec_replay *self = userdata;
+
+	ULOG_ERRNO_RETURN_IF(self == NULL, EINVAL);
+
+	ULOGI("decoder is flushed");
+
+	/* Flushes recorded in the capture are replayed as is; only the final
+	 * one stops the decoder */
+	if (self->input_finished)
+		stop_decoder(self);
+}
+
+
+static void stop_cb(struct adec_decoder *dec, void *userdata)
+{
+	struct adec_replay *self = userdata;
+
+	ULOG_ERRNO_RETURN_IF(self == NULL, EINVAL);
+
+	ULOGI("decoder is stopped");
+	self->stopped = 1;
+
+	pomp_loop_wakeup(self->loop);
+}
+
+
+static const struct adec_cbs adec_cbs = {
+	.frame_output = frame_output_cb,
+	.flush = flush_cb,
+	.stop = stop_cb,
+};
+
+
+static void sig_handler(int signum)
+{
+	ULOGI("signal %d(%s) received", signum, strsignal(signum));
+	printf("Stopping...\n");
+
+	s_stopping = 1;
+	signal(SIGINT, SIG_DFL);
+
+	if (s_self == NULL)
+		return;
+
+	pomp_loop_wakeup(s_self->loop);
+}
+
+
+static void print_stats(struct adec_replay *self, uint64_t elapsed)
+{
+	int res;
+	struct adec_stats stats;
+	struct adec_cpu_stats cpu;
+
+	printf("\nTotal frames: input=%u rejected=%u output=%u\n",
+	       self->input_count,
+	       self->rejected_count,
+	       self->output_count);
+	printf("Overall time: %.2fs\n", (float)elapsed / 1000000.);
+	if (elapsed > 0 && self->output_count > 0) {
+		printf("Throughput: %.1f frames/s, %.2fx real time\n",
+		       (double)self->output_count * 1000000. / elapsed,
+		       (double)self->audio_duration_us / elapsed);
+	}
+	if (self->latency.count > 0) {
+		printf("Latency: avg=%.2fms min=%.2fms max=%.2fms\n",
+		       (float)self->latency.sum / self->latency.count / 1000.,
+		       (float)self->latency.min / 1000.,
+		       (float)self->latency.max / 1000.);
+	}
+
+	res = adec_get_stats(self->decoder, &stats);
+	if (res == 0 && stats.in_dropped_frames > 0)
+		printf("Dropped input frames: %u\n", stats.in_dropped_frames);
+
+	res = adec_get_cpu_stats(self->decoder, &cpu);
+	if (res < 0 || cpu.frame_count == 0)
+		return;
+	printf("Decoding CPU time: total=%.3fms per frame: p50=%.1fus "
+	       "p90=%.1fus p99=%.1fus max=%.1fus\n",
+	       (double)cpu.total_ns / 1000000.,
+	       (double)cpu.p50_ns / 1000.,
+	       (double)cpu.p90_ns / 1000.,
+	       (double)cpu.p99_ns / 1000.,
+	       (double)cpu.max_ns / 1000.);
+}
+
+
+static const char short_options[] = "hi:fI:r";
+
+
+static const struct option long_options[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"infile", required_argument, NULL, 'i'},
+	{"fast", no_argument, NULL, 'f'},
+	{"implem", required_argument, NULL, 'I'},
+	{"realtime", no_argument, NULL, 'r'},
+	{0, 0, 0, 0},
+};
+
+
+static void welcome(char *prog_name)
+{
+	printf("\n%s - Audio decoding capture replay program\n"
+	       "Copyright (c) 2023 Parrot Drones SAS\n\n",
+	       prog_name);
+}
+
+
+static void usage(char *prog_name)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h | --help                        "
+	       "Print this message\n"
+	       "  -i | --infile <file_name>          "
+	       "Capture input file (see adec --capture)\n"
+	       "  -f | --fast                        "
+	       "Replay as fast as possible instead of with the original\n"
+	       "                                     "
+	       "timing\n"
+	       "  -I | --implem <implem>             "
+	       "Decoder implementation: 'capture' (default, as recorded),\n"
+	       "                                     "
+	       "'auto', 'fdk_aac' or 'null'\n"
+	       "  -r | --realtime                    "
+	       "Real-time decoding (preallocated output memories)\n"
+	       "\n",
+	       prog_name);
+}
+
+
+int main(int argc, char **argv)
+{
+	int err = 0, status = EXIT_SUCCESS;
+	int idx, c;
+	int implem_set = 0;
+	struct adec_replay *self = NULL;
+	enum adec_decoder_implem implem = ADEC_DECODER_IMPLEM_AUTO;
+	struct adec_capture_record record;
+	uint64_t end_time;
+
+	s_self = NULL;
+	s_stopping = 0;
+
+	welcome(argv[0]);
+
+	/* Context allocation */
+	self = calloc(1, sizeof(*self));
+	if (self == NULL) {
+		ULOG_ERRNO("calloc", ENOMEM);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	s_self = self;
+
+	/* Command-line parameters */
+	while ((c = getopt_long(
+			argc, argv, short_options, long_options, &idx)) != -1) {
+		switch (c) {
+		case 0:
+			break;
+
+		case 'h':
+			usage(argv[0]);
+			status = EXIT_SUCCESS;
+			goto out;
+
+		case 'i':
+			self->capture_file = optarg;
+			break;
+
+		case 'f':
+			self->fast = 1;
+			break;
+
+		case 'I':
+			implem_set = 1;
+			if (strcasecmp(optarg, "capture") == 0) {
+				implem_set = 0;
+			} else if (strcasecmp(optarg, "auto") == 0) {
+				implem = ADEC_DECODER_IMPLEM_AUTO;
+			} else if (strcasecmp(optarg, "fdk_aac") == 0) {
+				implem = ADEC_DECODER_IMPLEM_FDK_AAC;
+			} else if (strcasecmp(optarg, "null") == 0) {
+				implem = ADEC_DECODER_IMPLEM_NULL;
+			} else {
+				ULOGE("invalid implementation: '%s'", optarg);
+				usage(argv[0]);
+				status = EXIT_FAILURE;
+				goto out;
+			}
+			break;
+
+		case 'r':
+			self->config.realtime = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+			status = EXIT_FAILURE;
+			goto out;
+		}
+	}
+
+	/* Check the parameters */
+	if (self->capture_file == NULL) {
+		ULOGE("invalid input file");
+		usage(argv[0]);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* Setup signal handlers */
+	signal(SIGINT, &sig_handler);
+	signal(SIGTERM, &sig_handler);
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	/* Open the capture; the first record holds the configuration */
+	err = adec_capture_reader_open(self->capture_file, &self->reader);
+	if (err < 0) {
+		ULOG_ERRNO("adec_capture_reader_open", -err);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	err = adec_capture_reader_read(self->reader, &record);
+	if (err < 0 || record.type != ADEC_CAPTURE_RECORD_CONFIG) {
+		ULOGE("invalid capture file: missing configuration");
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	self->config.encoding = record.config.encoding;
+	self->config.stream_input = record.config.stream_input;
+	self->config.implem = implem_set ? implem : record.config.implem;
+	self->config.cpu_accounting = 1;
+	if (self->config.implem == ADEC_DECODER_IMPLEM_AUTO)
+		self->config.implem = adec_get_auto_implem();
+	if (self->config.implem == ADEC_DECODER_IMPLEM_AUTO) {
+		ULOGE("unsupported audio encoding");
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	printf("Replaying %s with %s decoder (%s timing)\n",
+	       self->capture_file,
+	       adec_decoder_implem_str(self->config.implem),
+	       self->fast ? "fast" : "original");
+
+	/* Loop */
+	self->loop = pomp_loop_new();
+	if (!self->loop) {
+		ULOG_ERRNO("pomp_loop_new", ENOMEM);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	self->timer = pomp_timer_new(self->loop, timer_cb, self);
+	if (!self->timer) {
+		ULOG_ERRNO("pomp_timer_new", ENOMEM);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* Create the decoder */
+	err = adec_new(
+		self->loop, &self->config, &adec_cbs, self, &self->decoder);
+	if (err < 0) {
+		ULOG_ERRNO("adec_new", -err);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* Start */
+	self->start_time = get_time_us();
+	err = pomp_loop_idle_add_with_cookie(
+		self->loop, replay_idle, self, self);
+	if (err < 0) {
+		ULOG_ERRNO("pomp_loop_idle_add_with_cookie", -err);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* Main loop */
+	while (!self->stopped) {
+		if (s_stopping && !self->input_finished)
+			finish(self);
+		(void)pomp_loop_wait_and_process(self->loop, 100);
+	}
+
+	end_time = get_time_us();
+	print_stats(self, end_time - self->start_time);
+
+out:
+	/* Cleanup and exit */
+	if (self != NULL) {
+		if (self->loop) {
+			err = pomp_loop_idle_remove_by_cookie(self->loop, self);
+			if (err < 0)
+				ULOG_ERRNO("pomp_loop_idle_remove_by_cookie",
+					   -err);
+		}
+		if (self->timer != NULL) {
+			err = pomp_timer_destroy(self->timer);
+			if (err < 0)
+				ULOG_ERRNO("pomp_timer_destroy", -err);
+		}
+		if (self->decoder != NULL) {
+			err = adec_destroy(self->decoder);
+			if (err < 0)
+				ULOG_ERRNO("adec_destroy", -err);
+		}
+		adec_capture_reader_close(self->reader);
+		if (self->loop) {
+			err = pomp_loop_destroy(self->loop);
+			if (err < 0)
+				ULOG_ERRNO("pomp_loop_destroy", -err);
+		}
+		free(self);
+	}
+
+	printf("\n%s\n", (status == EXIT_SUCCESS) ? "Finished!" : "Failed!");
+	exit(status);
+}